@@ -0,0 +1,248 @@
+#include "alloc_stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+
+extern int last_status;
+
+//the wrappers can be called from anywhere so the counters are file global
+static alloc_stats_t alloc_stats;
+
+#ifdef ALLOC_STATS
+
+/*
+ * The linker sends the shell's calls to these with --wrap, __real_x is
+ * the libc function. Sizes come from malloc_usable_size() on both sides
+ * so every free takes back exactly what its allocation added
+ */
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+void __real_free(void* ptr);
+char* __real_strdup(const char* str);
+char* __real_strndup(const char* str, size_t length);
+ssize_t __real_getline(char** line, size_t* capacity, FILE* stream);
+
+static void count_alloc(void* ptr)
+{
+	if(ptr == NULL)
+	{
+		return;
+	}
+
+	size_t size = malloc_usable_size(ptr);
+
+	alloc_stats.allocs++;
+	alloc_stats.bytes_allocated += size;
+	alloc_stats.live++;
+	alloc_stats.live_bytes += size;
+
+	if(alloc_stats.live_bytes > alloc_stats.peak_bytes)
+	{
+		alloc_stats.peak_bytes = alloc_stats.live_bytes;
+	}
+
+	if(alloc_stats.live_bytes > alloc_stats.command_peak)
+	{
+		alloc_stats.command_peak = alloc_stats.live_bytes;
+	}
+}
+
+static void count_free(void* ptr)
+{
+	if(ptr == NULL)
+	{
+		return;
+	}
+
+	alloc_stats.frees++;
+	alloc_stats.live--;
+	alloc_stats.live_bytes -= malloc_usable_size(ptr);
+}
+
+void* __wrap_malloc(size_t size)
+{
+	void* ptr = __real_malloc(size);
+
+	count_alloc(ptr);
+
+	return ptr;
+}
+
+void* __wrap_calloc(size_t count, size_t size)
+{
+	void* ptr = __real_calloc(count, size);
+
+	count_alloc(ptr);
+
+	return ptr;
+}
+
+//a realloc is counted as a free of the old block and a new allocation
+void* __wrap_realloc(void* ptr, size_t size)
+{
+	size_t old_size = ptr != NULL ? malloc_usable_size(ptr) : 0;
+
+	void* new_ptr = __real_realloc(ptr, size);
+
+	if(new_ptr == NULL && size != 0)
+	{
+		return NULL;
+	}
+
+	if(ptr != NULL)
+	{
+		alloc_stats.frees++;
+		alloc_stats.live--;
+		alloc_stats.live_bytes -= old_size;
+	}
+
+	count_alloc(new_ptr);
+
+	return new_ptr;
+}
+
+void __wrap_free(void* ptr)
+{
+	count_free(ptr);
+
+	__real_free(ptr);
+}
+
+char* __wrap_strdup(const char* str)
+{
+	char* copy = __real_strdup(str);
+
+	count_alloc(copy);
+
+	return copy;
+}
+
+char* __wrap_strndup(const char* str, size_t length)
+{
+	char* copy = __real_strndup(str, length);
+
+	count_alloc(copy);
+
+	return copy;
+}
+
+//getline grows the buffer with libc's own realloc, which isn't wrapped
+ssize_t __wrap_getline(char** line, size_t* capacity, FILE* stream)
+{
+	char* old_line = *line;
+	size_t old_size = old_line != NULL ? malloc_usable_size(old_line) : 0;
+
+	ssize_t length = __real_getline(line, capacity, stream);
+
+	if(*line != old_line)
+	{
+		if(old_line != NULL)
+		{
+			alloc_stats.frees++;
+			alloc_stats.live--;
+			alloc_stats.live_bytes -= old_size;
+		}
+
+		count_alloc(*line);
+	}
+
+	return length;
+}
+
+#endif
+
+/**
+ * Starts counting a command, called as each command line is read
+**/
+void begin_alloc_window()
+{
+	alloc_stats.start_allocs = alloc_stats.allocs;
+	alloc_stats.start_frees = alloc_stats.frees;
+	alloc_stats.start_live = alloc_stats.live;
+	alloc_stats.start_bytes = alloc_stats.live_bytes;
+	alloc_stats.command_peak = alloc_stats.live_bytes;
+}
+
+/**
+ * Keeps the figures of the command that just finished for allocs to print
+**/
+void end_alloc_window()
+{
+	alloc_stats.last_allocs = alloc_stats.allocs - alloc_stats.start_allocs;
+	alloc_stats.last_frees = alloc_stats.frees - alloc_stats.start_frees;
+	alloc_stats.last_net = alloc_stats.live - alloc_stats.start_live;
+	alloc_stats.last_net_bytes = alloc_stats.live_bytes - alloc_stats.start_bytes;
+	alloc_stats.last_peak = alloc_stats.command_peak - alloc_stats.start_bytes;
+}
+
+static void print_alloc_stats()
+{
+	printf("live\t\t%lld blocks, %lld bytes\n", (long long) alloc_stats.live, (long long) alloc_stats.live_bytes);
+	printf("peak\t\t%lld bytes\n", (long long) alloc_stats.peak_bytes);
+	printf("total\t\t%llu allocs, %llu frees, %llu bytes\n", (unsigned long long) alloc_stats.allocs,
+		(unsigned long long) alloc_stats.frees, (unsigned long long) alloc_stats.bytes_allocated);
+	printf("last command\t%llu allocs, %llu frees, net %lld blocks %lld bytes, peak +%lld bytes\n",
+		(unsigned long long) alloc_stats.last_allocs, (unsigned long long) alloc_stats.last_frees,
+		(long long) alloc_stats.last_net, (long long) alloc_stats.last_net_bytes, (long long) alloc_stats.last_peak);
+	fflush(stdout);
+}
+
+/**
+ * The "allocs" builtin, only useful in a make ALLOC_STATS=1 build
+ * "allocs" prints live and peak memory and the last command's counts
+ * "allocs mark" remembers what is live now and restarts the peak
+ * "allocs check [BYTES]" fails unless the live blocks match the mark,
+ * and with BYTES unless the peak stayed within BYTES above the mark
+**/
+void allocs_builtin(char** tokens)
+{
+	last_status = 0;
+
+#ifndef ALLOC_STATS
+	fprintf(stderr, "allocs: not counting, build with make ALLOC_STATS=1\n");
+	last_status = 1;
+	return;
+#endif
+
+	if(tokens[1] == NULL)
+	{
+		print_alloc_stats();
+		return;
+	}
+
+	if(strcmp(tokens[1], "mark") == 0)
+	{
+		alloc_stats.mark_live = alloc_stats.live;
+		alloc_stats.mark_bytes = alloc_stats.live_bytes;
+		alloc_stats.mark_peak = alloc_stats.live_bytes;
+		alloc_stats.peak_bytes = alloc_stats.live_bytes;
+		return;
+	}
+
+	if(strcmp(tokens[1], "check") == 0)
+	{
+		long long net = alloc_stats.live - alloc_stats.mark_live;
+		long long net_bytes = alloc_stats.live_bytes - alloc_stats.mark_bytes;
+		long long peak = alloc_stats.peak_bytes - alloc_stats.mark_peak;
+		long long limit = tokens[2] != NULL ? atoll(tokens[2]) : -1;
+
+		if(net != 0)
+		{
+			fprintf(stderr, "allocs: %lld blocks (%lld bytes) more live than at the mark\n", net, net_bytes);
+			last_status = 1;
+		}
+
+		if(limit >= 0 && peak > limit)
+		{
+			fprintf(stderr, "allocs: peak %lld bytes above the mark, limit %lld\n", peak, limit);
+			last_status = 1;
+		}
+		return;
+	}
+
+	fprintf(stderr, "usage: allocs [mark | check [BYTES]]\n");
+	last_status = 2;
+}
@@ -0,0 +1,52 @@
+#ifndef ALLOC_STATS_H
+#define ALLOC_STATS_H
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Counters kept by the malloc wrappers of a make ALLOC_STATS=1 build,
+ * only allocations made by the shell's own code are seen
+**/
+typedef struct alloc_stats_t
+{
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t bytes_allocated;
+
+	//blocks and bytes currently allocated
+	int64_t live;
+	int64_t live_bytes;
+
+	//highest live_bytes since the last reset
+	int64_t peak_bytes;
+
+	//highest live_bytes since the current command started
+	int64_t command_peak;
+
+	//taken when the current command started
+	uint64_t start_allocs;
+	uint64_t start_frees;
+	int64_t start_live;
+	int64_t start_bytes;
+
+	//figures of the last finished command
+	uint64_t last_allocs;
+	uint64_t last_frees;
+	int64_t last_net;
+	int64_t last_net_bytes;
+	int64_t last_peak;
+
+	//set with allocs mark, compared by allocs check
+	int64_t mark_live;
+	int64_t mark_bytes;
+	int64_t mark_peak;
+
+}alloc_stats_t;
+
+void begin_alloc_window();
+
+void end_alloc_window();
+
+void allocs_builtin(char** tokens);
+
+#endif
@@ -0,0 +1,23 @@
+#!/bin/bash
+# Pipe throughput for different pipesize settings.
+# Streams BYTES through a three stage pipeline run by the shell
+# and reports MB/s for each pipe size.
+# usage: bench/pipe_size.sh [shell binary] [bytes]
+
+SHELL_BIN=${1:-./shell}
+BYTES=${2:-4G}
+SIZES="64K 256K 1M"
+
+printf "%-10s %10s %10s\n" "pipesize" "seconds" "MB/s"
+
+for size in $SIZES; do
+	start=$(date +%s%N)
+	printf 'pipesize %s head -c %s /dev/zero | cat | cat > /dev/null\n' "$size" "$BYTES" | "$SHELL_BIN" > /dev/null
+	end=$(date +%s%N)
+
+	bytes=$(numfmt --from=iec "$BYTES")
+	elapsed_ns=$((end - start))
+
+	awk -v ns="$elapsed_ns" -v bytes="$bytes" -v size="$size" \
+		'BEGIN { printf "%-10s %10.2f %10.1f\n", size, ns / 1e9, bytes / 1048576 / (ns / 1e9) }'
+done
@@ -0,0 +1,43 @@
+#!/bin/bash
+# Per-command overhead of the executor.
+# Runs loops of a builtin, a plain command, a redirected command and
+# a two stage pipeline, and reports the wall time per iteration along
+# with the CPU time the shell process itself used per iteration, read
+# from /proc once the loop is done. Children are not in that figure,
+# so it shows what the shell adds around fork and exec.
+# Pass more than one binary to compare builds.
+# usage: bench/plan_overhead.sh [shell binary...]
+
+ITERATIONS=${ITERATIONS:-5000}
+BUILTIN_ITERATIONS=${BUILTIN_ITERATIONS:-200000}
+
+[ $# -eq 0 ] && set -- ./shell
+
+TICK_US=$((1000000 / $(getconf CLK_TCK)))
+
+printf "%-16s %-10s %10s %12s %14s\n" "shell" "loop" "iterations" "wall us/it" "shell cpu us/it"
+
+measure() {
+	local bin=$1 name=$2 count=$3 body=$4
+	local words
+	words=$(seq "$count" | tr '\n' ' ')
+
+	local start end ticks
+	start=$(date +%s%N)
+	ticks=$(printf 'for i in %s; do %s; done\n/bin/sh -c "echo cpu \\$(cut -d\\" \\" -f14,15 /proc/\\$PPID/stat)"\n' "$words" "$body" |
+		CSHELLRC= "$bin" 2>/dev/null | grep -o 'cpu [0-9]* [0-9]*' | cut -d' ' -f2,3)
+	end=$(date +%s%N)
+
+	awk -v bin="$bin" -v name="$name" -v count="$count" -v ns="$((end - start))" -v ticks="$ticks" -v tick="$TICK_US" '
+		BEGIN {
+			split(ticks, t, " ")
+			printf "%-16s %-10s %10d %12.2f %14.2f\n", bin, name, count, ns / 1000 / count, (t[1] + t[2]) * tick / count
+		}'
+}
+
+for bin in "$@"; do
+	measure "$bin" builtin "$BUILTIN_ITERATIONS" "set +b"
+	measure "$bin" simple "$ITERATIONS" "/bin/true"
+	measure "$bin" redirect "$ITERATIONS" "/bin/true > /dev/null"
+	measure "$bin" pipeline "$ITERATIONS" "/bin/true | /bin/true"
+done
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Line processing speed of while read.
+# Writes a file of LINES lines and times a loop that reads every
+# line into two variables, once from the file and once from a fifo.
+# usage: bench/read_lines.sh [shell binary] [lines]
+
+SHELL_BIN=${1:-./shell}
+LINES=${2:-1000000}
+DIR=$(mktemp -d)
+
+trap 'rm -rf "$DIR"' EXIT
+
+seq "$LINES" | sed 's/$/ some words after the number/' > "$DIR/lines"
+mkfifo "$DIR/fifo"
+
+printf "%-10s %10s %12s\n" "input" "seconds" "lines/s"
+
+for input in file fifo; do
+	if [ "$input" = fifo ]; then
+		cat "$DIR/lines" > "$DIR/fifo" &
+		source="$DIR/fifo"
+	else
+		source="$DIR/lines"
+	fi
+
+	start=$(date +%s%N)
+	printf 'while read n rest; do last=$n; done < %s\n' "$source" | "$SHELL_BIN" > /dev/null
+	end=$(date +%s%N)
+
+	awk -v ns="$((end - start))" -v lines="$LINES" -v input="$input" \
+		'BEGIN { printf "%-10s %10.2f %12.0f\n", input, ns / 1e9, lines / (ns / 1e9) }'
+done
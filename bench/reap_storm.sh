@@ -0,0 +1,25 @@
+#!/bin/bash
+# Reaping a burst of background jobs.
+# Starts JOBS /bin/true jobs from one loop so they all exit within
+# a few milliseconds, waits for them and reports the wall time of
+# the run and what the stats builtin recorded for reaping.
+# usage: bench/reap_storm.sh [shell binary] [jobs]
+
+SHELL_BIN=${1:-./shell}
+JOBS=${2:-1000}
+RUNS=3
+
+WORDS=$(seq "$JOBS" | tr '\n' ' ')
+
+printf "%-6s %8s %10s %10s %10s %10s\n" "run" "jobs" "wall ms" "passes" "reap p99" "reap total"
+
+for run in $(seq "$RUNS"); do
+	start=$(date +%s%N)
+	output=$(printf 'for i in %s; do /bin/true & done\nwait\nstats\n' "$WORDS" | CSHELLRC= "$SHELL_BIN" 2>&1)
+	end=$(date +%s%N)
+
+	echo "$output" | awk -v run="$run" -v ms="$(( (end - start) / 1000000 ))" '
+		$1 == "reap" { p99 = $5 }
+		$1 == "reaped" { jobs = $2; passes = $5; total = $7 }
+		END { printf "%-6s %8s %10s %10s %10s %10s\n", run, jobs, ms, passes, p99, total }'
+done
@@ -0,0 +1,48 @@
+#!/bin/bash
+# Startup time with a large rc file.
+# Writes an rc of VARS variables, ALIASES aliases and FUNCTIONS
+# functions, then reports --startup-bench without an rc, for the
+# run that evaluates the rc and writes its snapshot, and for the
+# runs after it that map the snapshot.
+# usage: bench/startup.sh [shell binary] [functions]
+
+SHELL_BIN=${1:-./shell}
+FUNCTIONS=${2:-500}
+VARS=200
+ALIASES=200
+RUNS=5
+DIR=$(mktemp -d)
+
+trap 'rm -rf "$DIR"' EXIT
+
+{
+	echo "# generated by bench/startup.sh"
+	for i in $(seq "$VARS"); do
+		echo "VAR_$i=\$HOME/value/$i"
+	done
+	for i in $(seq "$ALIASES"); do
+		echo "alias a$i='/bin/echo alias $i'"
+	done
+	for i in $(seq "$FUNCTIONS"); do
+		echo "f$i() {"
+		echo "	if [ \"\$1\" = x ]; then /bin/echo one \$1; else /bin/echo two \$VAR_1; fi"
+		echo "	for w in a b c; do /bin/echo \$w | /bin/cat; done"
+		echo "}"
+	done
+	echo "set -o notify"
+} > "$DIR/rc"
+
+echo "rc: $(wc -c < "$DIR/rc") bytes, $VARS variables, $ALIASES aliases, $FUNCTIONS functions"
+printf "%-10s %10s %10s\n" "run" "rc ms" "startup ms"
+
+report() {
+	CSHELLRC="$DIR/rc" "$SHELL_BIN" --startup-bench "$@" |
+		awk -v run="$RUN" -F'\t+' '$1 == "rc load" { rc = $2 } $1 == "startup" { total = $2 } END { sub(/ ms/, "", rc); sub(/ ms/, "", total); printf "%-10s %10s %10s\n", run, rc, total }'
+}
+
+RUN=norc report --norc
+RUN=evaluate report
+
+for i in $(seq "$RUNS"); do
+	RUN=snapshot report
+done
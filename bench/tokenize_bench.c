@@ -0,0 +1,208 @@
+#include "../input_parser.h"
+#include "../char_scan.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Tokenizer throughput, scalar lookup table against the vector scans
+ * usage: bench/tokenize_bench [line bytes] [iterations]
+ *
+ * scan      index build plus word and blank boundaries, no tokens
+ * tokenize  the shell's tokenize(), words lexed in place
+ * trim      remove_whitespace() on a line padded with blanks
+ *
+ * The vector paths' tokens and trimmed line are compared with the
+ * scalar path's, any difference fails the bench
+**/
+
+static double now_seconds()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Builds a machine generated looking command line of about size bytes
+**/
+static char* make_line(size_t size)
+{
+	//room for the last argument plus the padding the scan index reads
+	char* line = malloc(size + 64 + SCAN_PADDING);
+	size_t length = sprintf(line, "cc -O2 -c");
+	int arg = 0;
+
+	while(length < size)
+	{
+		switch(arg % 4)
+		{
+			case 0: length += sprintf(line + length, " -Iinclude/module_%d", arg); break;
+			case 1: length += sprintf(line + length, " src/generated/file_%05d.c", arg); break;
+			case 2: length += sprintf(line + length, "  -DVALUE_%d=%d", arg, arg * 7); break;
+			default: length += sprintf(line + length, " >> build/log_%d.txt", arg); break;
+		}
+		arg++;
+	}
+
+	return line;
+}
+
+static int scan_words(const char* line, size_t length)
+{
+	scan_index_t index;
+	int words = 0;
+
+	build_scan_index(&index, line, length);
+
+	const char* pos = skip_blanks_indexed(&index, line);
+
+	while(*pos != '\0')
+	{
+		const char* end = find_word_end(&index, pos);
+
+		pos = skip_blanks_indexed(&index, end == pos ? end + 1 : end);
+		words++;
+	}
+
+	free_scan_index(&index);
+
+	return words;
+}
+
+/**
+ * Compares the tokens of one path with the scalar path's
+ * @return the index of the first token that differs, -1 if none
+**/
+static int first_mismatch(char** tokens, int count, char** expected, int expected_count)
+{
+	for(int i = 0; i < count && i < expected_count; i++)
+	{
+		if(strcmp(tokens[i], expected[i]) != 0)
+		{
+			return i;
+		}
+	}
+
+	return count == expected_count ? -1 : (count < expected_count ? count : expected_count);
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = argc > 1 ? strtoul(argv[1], NULL, 10) : 16384;
+	int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+
+	char* line = make_line(size);
+	size_t length = strlen(line);
+
+	//the same line with 4K of blanks on both sides for trimming
+	char* padded = malloc(length + 8193);
+	memset(padded, ' ', 4096);
+	memcpy(padded + 4096, line, length);
+	memset(padded + 4096 + length, '\t', 4096);
+	padded[length + 8192] = '\0';
+
+	int levels[] = {SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2};
+	char** expected = NULL;
+	int expected_count = 0;
+	char* expected_trim = NULL;
+	int failed = 0;
+
+	printf("%zu byte line, %d iterations\n", length, iterations);
+	printf("%-8s %12s %12s %12s\n", "path", "scan MB/s", "token MB/s", "trim MB/s");
+
+	for(int l = 0; l < 3; l++)
+	{
+		if(set_scan_level(levels[l]) != levels[l])
+		{
+			continue;
+		}
+
+		int words = 0;
+		int count = 0;
+		double start = now_seconds();
+
+		for(int i = 0; i < iterations; i++)
+		{
+			words = scan_words(line, length);
+		}
+
+		double scan_time = now_seconds() - start;
+		start = now_seconds();
+
+		for(int i = 0; i < iterations; i++)
+		{
+			int incomplete;
+			char** tokens = tokenize(line, &count, &incomplete);
+			free_tokens(tokens);
+		}
+
+		double token_time = now_seconds() - start;
+		start = now_seconds();
+
+		for(int i = 0; i < iterations; i++)
+		{
+			free(remove_whitespace(padded));
+		}
+
+		double trim_time = now_seconds() - start;
+
+		//every path has to produce the scalar path's tokens and trim,
+		//a wrong answer must not be reported as a speedup
+		int incomplete;
+		char** tokens = tokenize(line, &count, &incomplete);
+		char* trimmed = remove_whitespace(padded);
+
+		if(expected == NULL)
+		{
+			expected = tokens;
+			expected_count = count;
+			expected_trim = trimmed;
+		}
+		else
+		{
+			int mismatch = first_mismatch(tokens, count, expected, expected_count);
+
+			if(mismatch != -1)
+			{
+				fprintf(stderr, "%s token %d is '%s', scalar has '%s'\n", scan_name(levels[l]), mismatch,
+					mismatch < count ? tokens[mismatch] : "(none)", mismatch < expected_count ? expected[mismatch] : "(none)");
+				failed = 1;
+			}
+
+			if(strcmp(trimmed, expected_trim) != 0)
+			{
+				fprintf(stderr, "%s trims the line differently from scalar\n", scan_name(levels[l]));
+				failed = 1;
+			}
+
+			free_tokens(tokens);
+			free(trimmed);
+
+			if(failed)
+			{
+				break;
+			}
+		}
+
+		double megabytes = (double) length * iterations / 1048576;
+
+		printf("%-8s %12.1f %12.1f %12.1f   (%d words)\n", scan_name(levels[l]),
+			megabytes / scan_time, megabytes / token_time,
+			(megabytes + 8192.0 * iterations / 1048576) / trim_time, words);
+	}
+
+	if(expected != NULL)
+	{
+		free_tokens(expected);
+		free(expected_trim);
+	}
+
+	free(line);
+	free(padded);
+
+	return failed;
+}
@@ -0,0 +1,357 @@
+#include "char_scan.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) && defined(__SSE2__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+/**
+ * One entry per byte value, the scalar path looks every byte up here
+ * and the vector paths test the same classes 16 or 32 bytes at a time
+**/
+const unsigned char char_class[256] =
+{
+	['\0'] = CLASS_END,
+	[' '] = CLASS_BLANK,
+	['\t'] = CLASS_BLANK,
+	['\v'] = CLASS_BLANK,
+	['\f'] = CLASS_BLANK,
+	['\r'] = CLASS_BLANK,
+	['\n'] = CLASS_NEWLINE,
+	['|'] = CLASS_OPERATOR,
+	['&'] = CLASS_OPERATOR,
+	['<'] = CLASS_OPERATOR,
+	['>'] = CLASS_OPERATOR,
+	[';'] = CLASS_SEPARATOR,
+	['\''] = CLASS_QUOTE,
+	['"'] = CLASS_QUOTE,
+	['\\'] = CLASS_QUOTE,
+};
+
+//-1 until the cpu has been checked
+static int scan_level = -1;
+
+static int best_scan_level()
+{
+#ifdef HAVE_X86_SIMD
+	return __builtin_cpu_supports("avx2") ? SCAN_AVX2 : SCAN_SSE2;
+#else
+	return SCAN_SCALAR;
+#endif
+}
+
+/**
+ * @return the widest scan the cpu supports, unless lowered with set_scan_level()
+**/
+int get_scan_level()
+{
+	if(scan_level == -1)
+	{
+		scan_level = best_scan_level();
+	}
+
+	return scan_level;
+}
+
+/**
+ * Picks the scan width, used to compare the paths against each other
+ * @param level SCAN_SCALAR, SCAN_SSE2 or SCAN_AVX2
+ * @return the level in use, capped at what the cpu supports
+**/
+int set_scan_level(int level)
+{
+	int best = best_scan_level();
+
+	scan_level = level > best ? best : level;
+
+	return scan_level;
+}
+
+const char* scan_name(int level)
+{
+	switch(level)
+	{
+		case SCAN_AVX2: return "avx2";
+		case SCAN_SSE2: return "sse2";
+		default: return "scalar";
+	}
+}
+
+#ifdef HAVE_X86_SIMD
+
+/**
+ * Marks the blanks in a vector, \t \v \f \r are 9 to 13 so one
+ * unsigned range check covers them along with \n
+**/
+static inline __m128i blank_mask_sse2(__m128i bytes, int newlines)
+{
+	__m128i offset = _mm_sub_epi8(bytes, _mm_set1_epi8('\t'));
+	__m128i control = _mm_cmpeq_epi8(_mm_min_epu8(offset, _mm_set1_epi8(4)), offset);
+
+	if(!newlines)
+	{
+		control = _mm_andnot_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8('\n')), control);
+	}
+
+	return _mm_or_si128(control, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')));
+}
+
+static inline __m128i word_end_mask_sse2(__m128i bytes)
+{
+	__m128i mask = blank_mask_sse2(bytes, 1);
+
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('|')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('&')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('<')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('>')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8(';')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\'')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('"')));
+	mask = _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_set1_epi8('\\')));
+
+	return _mm_or_si128(mask, _mm_cmpeq_epi8(bytes, _mm_setzero_si128()));
+}
+
+/*
+ * The scans only do aligned loads, an aligned block never crosses a page
+ * so reading past the terminating NUL can't fault. Bytes of the first
+ * block that come before the start are masked off
+ */
+
+static char* skip_blanks_sse2(const char* input, int newlines)
+{
+	uintptr_t misalign = (uintptr_t) input & 15;
+	const char* block = input - misalign;
+
+	unsigned int stop = ~_mm_movemask_epi8(blank_mask_sse2(_mm_load_si128((const __m128i*) block), newlines)) & (0xffffu << misalign) & 0xffffu;
+
+	while(stop == 0)
+	{
+		block += 16;
+		stop = ~_mm_movemask_epi8(blank_mask_sse2(_mm_load_si128((const __m128i*) block), newlines)) & 0xffffu;
+	}
+
+	return (char*) block + __builtin_ctz(stop);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i blank_mask_avx2(__m256i bytes, int newlines)
+{
+	__m256i offset = _mm256_sub_epi8(bytes, _mm256_set1_epi8('\t'));
+	__m256i control = _mm256_cmpeq_epi8(_mm256_min_epu8(offset, _mm256_set1_epi8(4)), offset);
+
+	if(!newlines)
+	{
+		control = _mm256_andnot_si256(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('\n')), control);
+	}
+
+	return _mm256_or_si256(control, _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(' ')));
+}
+
+/**
+ * Classifies 32 bytes with two 16 entry nibble tables, a byte breaks a word
+ * when the bits for its low and high nibble overlap. Every word break
+ * character is below 0x80 and a set top bit makes the shuffle return 0
+ *   bit 0  0x00 and \t to \r     bit 2  ; < >     bit 4  backslash
+ *   bit 1  space & " '           bit 3  |
+ * @return a mask of the bytes that do not end a word
+**/
+__attribute__((target("avx2")))
+static inline __m256i word_mask_avx2(__m256i bytes)
+{
+	const __m256i low_table = _mm256_setr_epi8(
+		3, 0, 2, 0, 0, 0, 2, 2, 0, 1, 1, 5, 29, 1, 4, 0,
+		3, 0, 2, 0, 0, 0, 2, 2, 0, 1, 1, 5, 29, 1, 4, 0);
+	const __m256i high_table = _mm256_setr_epi8(
+		1, 0, 2, 4, 0, 16, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0,
+		1, 0, 2, 4, 0, 16, 0, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+
+	__m256i high = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), _mm256_set1_epi8(0x0f));
+	__m256i bits = _mm256_and_si256(_mm256_shuffle_epi8(low_table, bytes), _mm256_shuffle_epi8(high_table, high));
+
+	return _mm256_cmpeq_epi8(bits, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static char* skip_blanks_avx2(const char* input, int newlines)
+{
+	uintptr_t misalign = (uintptr_t) input & 31;
+	const char* block = input - misalign;
+
+	unsigned int stop = ~(unsigned int) _mm256_movemask_epi8(blank_mask_avx2(_mm256_load_si256((const __m256i*) block), newlines)) & (0xffffffffu << misalign);
+
+	while(stop == 0)
+	{
+		block += 32;
+		stop = ~(unsigned int) _mm256_movemask_epi8(blank_mask_avx2(_mm256_load_si256((const __m256i*) block), newlines));
+	}
+
+	return (char*) block + __builtin_ctz(stop);
+}
+
+/*
+ * The index builders read 64 bytes per step with unaligned loads, the
+ * caller pads the string with SCAN_PADDING readable bytes so the last
+ * step stays inside the allocation
+ */
+
+static void build_index_sse2(scan_index_t* index, const char* input, size_t words)
+{
+	for(size_t i = 0; i < words; i++)
+	{
+		uint64_t word_end = 0;
+		uint64_t blank = 0;
+
+		for(int j = 0; j < 4; j++)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*) (input + i * 64 + j * 16));
+
+			word_end |= (uint64_t) _mm_movemask_epi8(word_end_mask_sse2(bytes)) << (j * 16);
+			blank |= (uint64_t) _mm_movemask_epi8(blank_mask_sse2(bytes, 0)) << (j * 16);
+		}
+
+		index->word_end[i] = word_end;
+		index->blank[i] = blank;
+	}
+}
+
+__attribute__((target("avx2")))
+static void build_index_avx2(scan_index_t* index, const char* input, size_t words)
+{
+	for(size_t i = 0; i < words; i++)
+	{
+		__m256i low = _mm256_loadu_si256((const __m256i*) (input + i * 64));
+		__m256i high = _mm256_loadu_si256((const __m256i*) (input + i * 64 + 32));
+
+		uint64_t word = (uint32_t) _mm256_movemask_epi8(word_mask_avx2(low)) | (uint64_t) (uint32_t) _mm256_movemask_epi8(word_mask_avx2(high)) << 32;
+		uint64_t blank = (uint32_t) _mm256_movemask_epi8(blank_mask_avx2(low, 0)) | (uint64_t) (uint32_t) _mm256_movemask_epi8(blank_mask_avx2(high, 0)) << 32;
+
+		index->word_end[i] = ~word;
+		index->blank[i] = blank;
+	}
+}
+
+#endif
+
+/**
+ * Builds the boundary bitmaps of a string, input that is short or
+ * a cpu without vectors leaves the index empty and lookups fall
+ * back to the table
+ * @param input string followed by SCAN_PADDING readable bytes
+ * @param length of the string without the terminating NUL
+**/
+void build_scan_index(scan_index_t* index, const char* input, size_t length)
+{
+	index->base = input;
+	index->word_end = NULL;
+	index->blank = NULL;
+
+	if(length < SCAN_INDEX_MIN || get_scan_level() == SCAN_SCALAR)
+	{
+		return;
+	}
+
+#ifdef HAVE_X86_SIMD
+	//the NUL is indexed too, it ends the last word
+	size_t words = length / 64 + 1;
+
+	index->word_end = malloc(2 * words * sizeof(uint64_t));
+
+	if(index->word_end == NULL)
+	{
+		return;
+	}
+
+	index->blank = index->word_end + words;
+
+	if(get_scan_level() == SCAN_AVX2)
+	{
+		build_index_avx2(index, input, words);
+	}
+	else
+	{
+		build_index_sse2(index, input, words);
+	}
+#endif
+}
+
+void free_scan_index(scan_index_t* index)
+{
+	free(index->word_end);
+
+	index->word_end = NULL;
+	index->blank = NULL;
+}
+
+/**
+ * Skips whitespace, stopping at the terminating NUL at the latest
+ * @param newlines 1 to skip newlines as well, 0 to stop at them
+ * @return the first character that isn't skipped
+**/
+char* skip_blanks_fast(const char* input, int newlines)
+{
+	int skip = newlines ? CLASS_SPACE : CLASS_BLANK;
+
+	//words are mostly split by a single blank, not worth a vector load
+	if(!(char_class[(unsigned char) input[0]] & skip))
+	{
+		return (char*) input;
+	}
+
+	if(!(char_class[(unsigned char) input[1]] & skip))
+	{
+		return (char*) input + 1;
+	}
+
+#ifdef HAVE_X86_SIMD
+	switch(get_scan_level())
+	{
+		case SCAN_AVX2: return skip_blanks_avx2(input, newlines);
+		case SCAN_SSE2: return skip_blanks_sse2(input, newlines);
+	}
+#endif
+
+	while(char_class[(unsigned char) *input] & skip)
+	{
+		input++;
+	}
+
+	return (char*) input;
+}
+
+/**
+ * Walks back over trailing whitespace, the vector path only loads
+ * inside the string so unaligned loads are safe here
+ * @param start first character of the string
+ * @param end one past the last character
+ * @return one past the last character that isn't whitespace, start if there is none
+**/
+char* trim_end(const char* start, const char* end)
+{
+#ifdef HAVE_X86_SIMD
+	if(get_scan_level() != SCAN_SCALAR)
+	{
+		while(end - start >= 16)
+		{
+			__m128i bytes = _mm_loadu_si128((const __m128i*) (end - 16));
+			unsigned int keep = ~_mm_movemask_epi8(blank_mask_sse2(bytes, 1)) & 0xffffu;
+
+			if(keep != 0)
+			{
+				return (char*) end - 16 + (32 - __builtin_clz(keep));
+			}
+
+			end -= 16;
+		}
+	}
+#endif
+
+	while(end > start && (char_class[(unsigned char) end[-1]] & CLASS_SPACE))
+	{
+		end--;
+	}
+
+	return (char*) end;
+}
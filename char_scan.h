@@ -0,0 +1,125 @@
+#ifndef CHAR_SCAN_H
+#define CHAR_SCAN_H
+#include <stddef.h>
+#include <stdint.h>
+
+//classes of the characters the tokenizer cares about
+#define CLASS_BLANK 1
+#define CLASS_NEWLINE 2
+#define CLASS_OPERATOR 4
+#define CLASS_SEPARATOR 8
+#define CLASS_END 16
+#define CLASS_QUOTE 32
+
+#define CLASS_SPACE (CLASS_BLANK | CLASS_NEWLINE)
+#define CLASS_WORD_END (CLASS_SPACE | CLASS_OPERATOR | CLASS_SEPARATOR | CLASS_END)
+
+//a plain run of word characters also stops where the lexer has to look at quoting
+#define CLASS_WORD_BREAK (CLASS_WORD_END | CLASS_QUOTE)
+
+#define SCAN_SCALAR 0
+#define SCAN_SSE2 1
+#define SCAN_AVX2 2
+
+//shorter input is scanned with the lookup table, an index doesn't pay off
+#define SCAN_INDEX_MIN 128
+
+//readable bytes build_scan_index() needs after the terminating NUL
+#define SCAN_PADDING 64
+
+/**
+ * Bitmaps over an input string with one bit per byte, built in
+ * one vector pass so finding the next boundary is a count of
+ * trailing zeros instead of a loop over bytes
+**/
+typedef struct scan_index_t
+{
+	const char* base;
+
+	//whitespace, | & < > ; quotes, backslash and the terminating NUL
+	uint64_t* word_end;
+
+	//blanks other than newline
+	uint64_t* blank;
+
+}scan_index_t;
+
+extern const unsigned char char_class[256];
+
+int get_scan_level();
+
+int set_scan_level(int level);
+
+const char* scan_name(int level);
+
+void build_scan_index(scan_index_t* index, const char* input, size_t length);
+
+void free_scan_index(scan_index_t* index);
+
+char* skip_blanks_fast(const char* input, int newlines);
+
+char* trim_end(const char* start, const char* end);
+
+/*
+ * The lookups run once or twice per token so they live here to be
+ * inlined into the tokenizer
+ */
+
+/**
+ * @return position of the first set bit at or after pos, one must exist
+**/
+static inline size_t next_bit(const uint64_t* bits, size_t pos, uint64_t flip)
+{
+	size_t i = pos >> 6;
+	uint64_t word = (bits[i] ^ flip) & (~0ULL << (pos & 63));
+
+	while(word == 0)
+	{
+		word = bits[++i] ^ flip;
+	}
+
+	return (i << 6) + __builtin_ctzll(word);
+}
+
+/**
+ * Finds where a plain run of word characters ends, at whitespace,
+ * one of | & < > ; a quote, a backslash or the terminating NUL
+ * @param index built over the string input points into
+ * @return the first character that isn't part of the run
+**/
+static inline char* find_word_end(scan_index_t* index, const char* input)
+{
+	if(index->word_end != NULL)
+	{
+		return (char*) index->base + next_bit(index->word_end, input - index->base, 0);
+	}
+
+	while(!(char_class[(unsigned char) *input] & CLASS_WORD_BREAK))
+	{
+		input++;
+	}
+
+	return (char*) input;
+}
+
+/**
+ * Skips blanks up to a newline or the terminating NUL
+ * @param index built over the string input points into
+ * @return the first character that isn't a blank
+**/
+static inline char* skip_blanks_indexed(scan_index_t* index, const char* input)
+{
+	if(index->word_end != NULL)
+	{
+		return (char*) index->base + next_bit(index->blank, input - index->base, ~0ULL);
+	}
+
+	while(char_class[(unsigned char) *input] & CLASS_BLANK)
+	{
+		input++;
+	}
+
+	return (char*) input;
+}
+
+#endif
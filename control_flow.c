@@ -0,0 +1,1054 @@
+#include "control_flow.h"
+#include "variables.h"
+#include "input_parser.h"
+#include "shell.h"
+#include "functions.h"
+#include "line_reader.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+typedef struct compiler_t
+{
+	program_t* program;
+	char** tokens;
+	int token_count;
+	int position;
+
+}compiler_t;
+
+typedef struct for_state_t
+{
+	char** items;
+	int count;
+	int next;
+
+}for_state_t;
+
+extern var_table_t var_table;
+extern int last_status;
+extern volatile sig_atomic_t interrupted;
+extern function_table_t function_table;
+extern line_reader_t line_reader;
+
+static int compile_list(compiler_t* compiler, char** terminators);
+
+static int compile_if(compiler_t* compiler);
+
+static int compile_while(compiler_t* compiler);
+
+static int compile_for(compiler_t* compiler);
+
+//the OP_EXEC whose pipeline ends in a compound command, while it runs
+static instruction_t* piped_compound = NULL;
+
+/**
+ * Appends an instruction to the program, growing the code array if needed
+ * @return index of the new instruction
+**/
+static int emit(program_t* program, opcode_t op)
+{
+	if(program->length == program->capacity)
+	{
+		program->capacity *= 2;
+		program->code = realloc(program->code, sizeof(instruction_t) * program->capacity);
+
+		if(program->code == NULL)
+		{
+			perror("Could not grow program");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	instruction_t* instruction = &program->code[program->length];
+	instruction->op = op;
+	instruction->words = NULL;
+	instruction->word_count = 0;
+	instruction->expand = 0;
+	instruction->target = -1;
+	instruction->slot = -1;
+	instruction->var = NULL;
+	instruction->stage = NULL;
+
+	return program->length++;
+}
+
+/**
+ * @return an empty program over tokens
+**/
+static program_t* new_program(char** tokens, int token_count)
+{
+	program_t* program = malloc(sizeof(program_t));
+
+	if(program == NULL)
+	{
+		perror("Could not allocate memory for program");
+		exit(EXIT_FAILURE);
+	}
+
+	program->capacity = 16;
+	program->length = 0;
+	program->loop_slots = 0;
+	program->redirect_slots = 0;
+	program->tokens = tokens;
+	program->token_count = token_count;
+	program->code = malloc(sizeof(instruction_t) * program->capacity);
+
+	if(program->code == NULL)
+	{
+		perror("Could not allocate memory for program");
+		exit(EXIT_FAILURE);
+	}
+
+	return program;
+}
+
+/**
+ * Checks if a token is one of the given terminators
+ * @param terminators NULL terminated list, may be NULL itself
+**/
+static int is_one_of(char* token, char** terminators)
+{
+	for(int i = 0; terminators != NULL && terminators[i] != NULL; i++)
+	{
+		if(strcmp(token, terminators[i]) == 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int is_separator(char* token)
+{
+	return is_operator(token, ";");
+}
+
+static char* current(compiler_t* compiler)
+{
+	if(compiler->position >= compiler->token_count)
+	{
+		return NULL;
+	}
+	return compiler->tokens[compiler->position];
+}
+
+static void skip_separators(compiler_t* compiler)
+{
+	while(current(compiler) != NULL && is_separator(current(compiler)))
+	{
+		compiler->position++;
+	}
+}
+
+/**
+ * Consumes the expected keyword
+ * @return COMPILE_OK, COMPILE_INCOMPLETE at the end of input
+ * or COMPILE_ERROR for any other token
+**/
+static int expect(compiler_t* compiler, char* keyword)
+{
+	char* token = current(compiler);
+
+	if(token == NULL)
+	{
+		return COMPILE_INCOMPLETE;
+	}
+
+	if(strcmp(token, keyword) != 0)
+	{
+		fprintf(stderr, "syntax error near unexpected token '%s'\n", token);
+		return COMPILE_ERROR;
+	}
+
+	compiler->position++;
+	return COMPILE_OK;
+}
+
+/**
+ * Flags words that need variable expansion so plain words
+ * are never scanned at run time
+**/
+static int needs_expansion(char** words, int word_count)
+{
+	for(int i = 0; i < word_count; i++)
+	{
+		if(has_expansion(words[i]))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * @return 1 for a keyword that starts a compound command
+**/
+static int is_compound(char* token)
+{
+	return !is_any_operator(token) && (strcmp(token, "while") == 0 || strcmp(token, "for") == 0 || strcmp(token, "if") == 0);
+}
+
+/**
+ * Compiles the loop or if that ends a pipeline into a program of its
+ * own, the pipeline's last child runs it with the pipe as its input
+ * @param stage set to the compiled program, it shares the tokens
+**/
+static int compile_compound_stage(compiler_t* compiler, program_t** stage)
+{
+	compiler_t inner = {new_program(compiler->tokens, compiler->token_count), compiler->tokens, compiler->token_count, compiler->position};
+	char* keyword = current(compiler);
+	int result;
+
+	//the tokens belong to the outer program
+	inner.program->tokens = NULL;
+
+	if(strcmp(keyword, "while") == 0)
+	{
+		result = compile_while(&inner);
+	}
+	else if(strcmp(keyword, "for") == 0)
+	{
+		result = compile_for(&inner);
+	}
+	else
+	{
+		result = compile_if(&inner);
+	}
+
+	compiler->position = inner.position;
+
+	//the block ends the pipeline in the foreground, nothing can be piped
+	//from it or send it to the background
+	char* next = current(compiler);
+
+	if(result == COMPILE_OK && next != NULL && (is_operator(next, "&") || is_operator(next, "|") || is_operator(next, "|&") || is_operator(next, "|>")))
+	{
+		fprintf(stderr, "syntax error near unexpected token '%s'\n", next);
+		result = COMPILE_ERROR;
+	}
+
+	if(result != COMPILE_OK)
+	{
+		free_program(inner.program);
+		return result;
+	}
+
+	*stage = inner.program;
+	return COMPILE_OK;
+}
+
+/**
+ * Compiles a simple command, which runs until a separator, or
+ * until and including a trailing & so it runs in the background
+**/
+static int compile_simple(compiler_t* compiler)
+{
+	int start = compiler->position;
+	char* compound = NULL;
+
+	while(current(compiler) != NULL && !is_separator(current(compiler)))
+	{
+		char* token = current(compiler);
+		compiler->position++;
+
+		if(is_operator(token, "&"))
+		{
+			break;
+		}
+
+		//a loop or if after a pipe is the pipeline's last stage
+		if((is_operator(token, "|") || is_operator(token, "|&")) && current(compiler) != NULL && is_compound(current(compiler)))
+		{
+			compound = current(compiler);
+			break;
+		}
+	}
+
+	int word_count = compiler->position - start;
+	program_t* stage = NULL;
+
+	if(compound != NULL)
+	{
+		int result = compile_compound_stage(compiler, &stage);
+
+		if(result != COMPILE_OK)
+		{
+			return result;
+		}
+	}
+
+	int index = emit(compiler->program, OP_EXEC);
+	instruction_t* instruction = &compiler->program->code[index];
+	instruction->words = &compiler->tokens[start];
+	instruction->word_count = word_count;
+	instruction->expand = needs_expansion(instruction->words, instruction->word_count);
+	instruction->var = compound;
+	instruction->stage = stage;
+	plan_command(instruction->words, instruction->word_count, &instruction->plan);
+
+	return COMPILE_OK;
+}
+
+/**
+ * if LIST then LIST [elif LIST then LIST]... [else LIST] fi
+ * jumps to the end of the block are chained through their
+ * target field and patched once fi is reached
+**/
+static int compile_if(compiler_t* compiler)
+{
+	char* condition_end[] = {"then", NULL};
+	char* branch_end[] = {"elif", "else", "fi", NULL};
+	char* else_end[] = {"fi", NULL};
+
+	program_t* program = compiler->program;
+	int pending_end = -1;
+	int result;
+
+	compiler->position++;
+
+	while(1)
+	{
+		if((result = compile_list(compiler, condition_end)) != COMPILE_OK)
+		{
+			return result;
+		}
+
+		if((result = expect(compiler, "then")) != COMPILE_OK)
+		{
+			return result;
+		}
+
+		int skip_branch = emit(program, OP_JUMP_IF_FALSE);
+
+		if((result = compile_list(compiler, branch_end)) != COMPILE_OK)
+		{
+			return result;
+		}
+
+		char* token = current(compiler);
+
+		if(strcmp(token, "fi") == 0)
+		{
+			program->code[skip_branch].target = program->length;
+			break;
+		}
+
+		int end_jump = emit(program, OP_JUMP);
+		program->code[end_jump].target = pending_end;
+		pending_end = end_jump;
+
+		program->code[skip_branch].target = program->length;
+		compiler->position++;
+
+		if(strcmp(token, "else") == 0)
+		{
+			if((result = compile_list(compiler, else_end)) != COMPILE_OK)
+			{
+				return result;
+			}
+			break;
+		}
+	}
+
+	compiler->position++;
+
+	while(pending_end != -1)
+	{
+		int next = program->code[pending_end].target;
+		program->code[pending_end].target = program->length;
+		pending_end = next;
+	}
+
+	return COMPILE_OK;
+}
+
+/**
+ * Handles "< FILE" after a loop's done, the whole loop then reads FILE
+ * and the shell's own input is put back once it finishes
+ * @param redirect the OP_REDIRECT_INPUT placed before the loop,
+ * it stays a no-op when the loop has no redirection
+**/
+static int compile_loop_redirect(compiler_t* compiler, int redirect)
+{
+	program_t* program = compiler->program;
+	char* token = current(compiler);
+
+	if(token == NULL || !is_operator(token, "<"))
+	{
+		return COMPILE_OK;
+	}
+
+	compiler->position++;
+
+	char* file = current(compiler);
+
+	if(file == NULL || is_any_operator(file))
+	{
+		fprintf(stderr, "syntax error near unexpected token '<'\n");
+		return COMPILE_ERROR;
+	}
+
+	compiler->position++;
+
+	int restore = emit(program, OP_RESTORE_INPUT);
+	program->code[restore].slot = program->redirect_slots++;
+
+	program->code[redirect].var = file;
+	program->code[redirect].expand = has_expansion(file);
+	program->code[redirect].slot = program->code[restore].slot;
+	program->code[redirect].target = restore + 1;
+
+	return COMPILE_OK;
+}
+
+/**
+ * while LIST do LIST done
+**/
+static int compile_while(compiler_t* compiler)
+{
+	char* condition_end[] = {"do", NULL};
+	char* body_end[] = {"done", NULL};
+
+	program_t* program = compiler->program;
+	int result;
+
+	compiler->position++;
+
+	int redirect = emit(program, OP_REDIRECT_INPUT);
+	int loop_start = program->length;
+
+	if((result = compile_list(compiler, condition_end)) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	if((result = expect(compiler, "do")) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	int exit_jump = emit(program, OP_JUMP_IF_FALSE);
+
+	if((result = compile_list(compiler, body_end)) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	compiler->position++;
+
+	int back_jump = emit(program, OP_JUMP);
+	program->code[back_jump].target = loop_start;
+	program->code[exit_jump].target = program->length;
+
+	return compile_loop_redirect(compiler, redirect);
+}
+
+/**
+ * for NAME in WORDS; do LIST done
+ * each loop gets its own slot so nested loops keep
+ * separate positions at run time
+**/
+static int compile_for(compiler_t* compiler)
+{
+	char* body_end[] = {"done", NULL};
+
+	program_t* program = compiler->program;
+	int result;
+
+	compiler->position++;
+
+	char* name = current(compiler);
+
+	if(name == NULL)
+	{
+		return COMPILE_INCOMPLETE;
+	}
+
+	if(!is_valid_name(name, strlen(name)))
+	{
+		fprintf(stderr, "'%s' is not a valid loop variable\n", name);
+		return COMPILE_ERROR;
+	}
+
+	compiler->position++;
+
+	if((result = expect(compiler, "in")) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	int start = compiler->position;
+
+	while(current(compiler) != NULL && !is_separator(current(compiler)))
+	{
+		compiler->position++;
+	}
+
+	int redirect = emit(program, OP_REDIRECT_INPUT);
+	int init = emit(program, OP_FOR_INIT);
+	program->code[init].words = &compiler->tokens[start];
+	program->code[init].word_count = compiler->position - start;
+	program->code[init].expand = needs_expansion(program->code[init].words, program->code[init].word_count);
+	program->code[init].slot = program->loop_slots++;
+
+	skip_separators(compiler);
+
+	if((result = expect(compiler, "do")) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	int next = emit(program, OP_FOR_NEXT);
+	program->code[next].slot = program->code[init].slot;
+	program->code[next].var = name;
+
+	if((result = compile_list(compiler, body_end)) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	compiler->position++;
+
+	int back_jump = emit(program, OP_JUMP);
+	program->code[back_jump].target = next;
+	program->code[next].target = program->length;
+
+	return compile_loop_redirect(compiler, redirect);
+}
+
+/**
+ * @return length of a function name written as NAME(), -1 for other words
+**/
+static int function_header_length(char* word)
+{
+	size_t length = strlen(word);
+
+	return length > 2 && strcmp(word + length - 2, "()") == 0 ? (int) length - 2 : -1;
+}
+
+/**
+ * @return 1 if the command at the current position starts a
+ * function definition, function NAME or NAME() or NAME ()
+**/
+static int is_function_definition(compiler_t* compiler)
+{
+	char* token = current(compiler);
+	char* next = compiler->position + 1 < compiler->token_count ? compiler->tokens[compiler->position + 1] : NULL;
+
+	return strcmp(token, "function") == 0 || function_header_length(token) > 0 || (next != NULL && strcmp(next, "()") == 0);
+}
+
+/**
+ * function NAME [()] { LIST } or NAME() { LIST }
+ * the body is compiled here only to check it and find the closing
+ * brace, OP_FUNCTION compiles it into its own program when the
+ * definition runs
+**/
+static int compile_function(compiler_t* compiler)
+{
+	char* body_end[] = {"}", NULL};
+
+	program_t* program = compiler->program;
+	int result;
+
+	if(strcmp(current(compiler), "function") == 0)
+	{
+		compiler->position++;
+	}
+
+	char* name = current(compiler);
+
+	if(name == NULL)
+	{
+		return COMPILE_INCOMPLETE;
+	}
+
+	compiler->position++;
+
+	int length = function_header_length(name);
+
+	//the token is owned by this program so the () can be cut off in place
+	if(length > 0)
+	{
+		name[length] = '\0';
+	}
+	else if(current(compiler) != NULL && strcmp(current(compiler), "()") == 0)
+	{
+		compiler->position++;
+	}
+
+	skip_separators(compiler);
+
+	if((result = expect(compiler, "{")) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	int start = compiler->position;
+	int code_length = program->length;
+
+	if((result = compile_list(compiler, body_end)) != COMPILE_OK)
+	{
+		return result;
+	}
+
+	program->length = code_length;
+
+	int index = emit(program, OP_FUNCTION);
+	program->code[index].var = name;
+	program->code[index].words = &compiler->tokens[start];
+	program->code[index].word_count = compiler->position - start;
+
+	compiler->position++;
+
+	return COMPILE_OK;
+}
+
+/**
+ * Compiles commands until one of the terminators is found in
+ * command position, the terminator is left for the caller
+ * @param terminators NULL for the top level list
+**/
+static int compile_list(compiler_t* compiler, char** terminators)
+{
+	char* stray[] = {"then", "elif", "else", "fi", "do", "done", "}", NULL};
+
+	while(1)
+	{
+		skip_separators(compiler);
+
+		char* token = current(compiler);
+
+		if(token == NULL)
+		{
+			return terminators == NULL ? COMPILE_OK : COMPILE_INCOMPLETE;
+		}
+
+		if(is_one_of(token, terminators))
+		{
+			return COMPILE_OK;
+		}
+
+		int result;
+
+		if(strcmp(token, "if") == 0)
+		{
+			result = compile_if(compiler);
+		}
+		else if(strcmp(token, "while") == 0)
+		{
+			result = compile_while(compiler);
+		}
+		else if(strcmp(token, "for") == 0)
+		{
+			result = compile_for(compiler);
+		}
+		else if(is_function_definition(compiler))
+		{
+			result = compile_function(compiler);
+		}
+		else if(is_one_of(token, stray))
+		{
+			fprintf(stderr, "syntax error near unexpected token '%s'\n", token);
+			result = COMPILE_ERROR;
+		}
+		else
+		{
+			result = compile_simple(compiler);
+		}
+
+		if(result != COMPILE_OK)
+		{
+			return result;
+		}
+	}
+}
+
+/**
+ * Compiles a token array into bytecode, the program takes
+ * ownership of the tokens once compilation succeeds
+ * @param tokens NULL terminated token array from tokenize()
+ * @param token_count number of tokens
+ * @param result set to COMPILE_OK, COMPILE_INCOMPLETE when a block
+ * is still open at the end of input, or COMPILE_ERROR
+ * @return compiled program, NULL unless result is COMPILE_OK
+**/
+program_t* compile_program(char** tokens, int token_count, int* result)
+{
+	program_t* program = new_program(tokens, token_count);
+
+	compiler_t compiler = {program, tokens, token_count, 0};
+
+	*result = compile_list(&compiler, NULL);
+
+	if(*result != COMPILE_OK)
+	{
+		//the caller still owns the tokens on failure
+		program->tokens = NULL;
+		free_program(program);
+		return NULL;
+	}
+
+	return program;
+}
+
+/**
+ * Expands the words of a for loop once when the loop starts,
+ * expanded words are split on whitespace
+**/
+static void init_for_state(for_state_t* state, instruction_t* instruction)
+{
+	for(int i = 0; i < state->count; i++)
+	{
+		free(state->items[i]);
+	}
+	free(state->items);
+
+	int capacity = instruction->word_count + 1;
+
+	state->items = malloc(sizeof(char*) * capacity);
+	state->count = 0;
+	state->next = 0;
+
+	if(state->items == NULL)
+	{
+		perror("Could not allocate memory for loop");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < instruction->word_count; i++)
+	{
+		char* word = instruction->words[i];
+
+		if(!has_expansion(word))
+		{
+			state->items[state->count++] = strdup(word);
+			continue;
+		}
+
+		char* expanded = expand_word(&var_table, word, last_status);
+		char* save_ptr;
+
+		for(char* field = strtok_r(expanded, " \t\n", &save_ptr); field != NULL; field = strtok_r(NULL, " \t\n", &save_ptr))
+		{
+			if(state->count == capacity)
+			{
+				capacity *= 2;
+				state->items = realloc(state->items, sizeof(char*) * capacity);
+
+				if(state->items == NULL)
+				{
+					perror("Could not grow loop list");
+					exit(EXIT_FAILURE);
+				}
+			}
+			state->items[state->count++] = strdup(field);
+		}
+
+		free(expanded);
+	}
+}
+
+/**
+ * @return 1 if the command has a pipe, redirection or & that
+ * the executor has to handle
+**/
+static int has_operators(char** argv, int word_count)
+{
+	for(int i = 0; i < word_count; i++)
+	{
+		if(is_any_operator(argv[i]))
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Expands aliases and the words of a command, then calls the shell
+ * function it names or hands it to the executor. A function with a
+ * pipe, redirection or & runs in the executor's child instead
+ * @return exit status of the command
+**/
+static int exec_instruction(instruction_t* instruction)
+{
+	char** words = instruction->words;
+	int word_count = instruction->word_count;
+	int expand = instruction->expand;
+	command_plan_t* plan = &instruction->plan;
+	command_plan_t aliased_plan;
+	char** aliased = NULL;
+
+	if(function_table.alias_count > 0)
+	{
+		int count = expand_aliases(&function_table, words, word_count, &aliased);
+
+		//the alias brings words of its own, so the compiled plan no longer fits
+		if(count != -1)
+		{
+			words = aliased;
+			word_count = count;
+			expand = 1;
+			plan_command(words, word_count, &aliased_plan);
+			plan = &aliased_plan;
+		}
+	}
+
+	char* argv[word_count + 2];
+	int argc = word_count;
+
+	for(int i = 0; i < word_count; i++)
+	{
+		char* word = words[i];
+
+		argv[i] = (expand && has_expansion(word)) ? expand_word(&var_table, word, last_status) : word;
+	}
+
+	//the keyword stands in for the compound stage, run_compound_stage() knows it
+	if(instruction->stage != NULL)
+	{
+		argv[argc++] = instruction->var;
+	}
+
+	argv[argc] = NULL;
+
+	function_t* function = function_table.count > 0 ? find_function(&function_table, argv[0]) : NULL;
+	int status;
+
+	//a simple command is known to have no operators without a scan
+	int plain = plan->kind == PLAN_SIMPLE && !plan->background;
+
+	if(function != NULL && (plain || !has_operators(argv, argc)))
+	{
+		status = call_function(&function_table, function, argv, argc);
+	}
+	else
+	{
+		instruction_t* outer = piped_compound;
+
+		piped_compound = instruction->stage != NULL ? instruction : outer;
+		status = execute_plan(plan, argv, argc);
+		piped_compound = outer;
+	}
+
+	for(int i = 0; i < word_count; i++)
+	{
+		if(argv[i] != words[i] && argv[i] != NULL)
+		{
+			free(argv[i]);
+		}
+	}
+
+	free(aliased);
+
+	return status;
+}
+
+/**
+ * Runs in the child of a pipeline's last stage, when that stage is
+ * the loop or if the running pipeline ends in it runs the compiled
+ * block and exits with its status
+ * @param command the stage's words
+ * @return only if command isn't a compound stage
+**/
+void run_compound_stage(char** command)
+{
+	if(piped_compound == NULL || command[0] != piped_compound->var)
+	{
+		return;
+	}
+
+	//bytes the shell buffered from its own input aren't this stage's
+	reset_line_reader(&line_reader);
+
+	run_program(piped_compound->stage);
+
+	fflush(stdout);
+	exit(last_status);
+}
+
+/**
+ * Points the shell's standard input at a loop's file, the old input
+ * is kept in saved above the low descriptors commands expect
+ * @return 0 on success, -1 if the file can't be opened
+**/
+static int redirect_input(instruction_t* instruction, int* saved)
+{
+	char* file = instruction->expand ? expand_word(&var_table, instruction->var, last_status) : instruction->var;
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+	if(fd < 0)
+	{
+		fprintf(stderr, "%s: %s\n", file, strerror(errno));
+	}
+
+	if(file != instruction->var)
+	{
+		free(file);
+	}
+
+	if(fd < 0)
+	{
+		return -1;
+	}
+
+	*saved = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+
+	if(*saved == -1 || dup2(fd, STDIN_FILENO) == -1)
+	{
+		perror("Could not redirect loop input");
+		exit(EXIT_FAILURE);
+	}
+
+	close(fd);
+	reset_line_reader(&line_reader);
+
+	return 0;
+}
+
+static void restore_input(int* saved)
+{
+	if(*saved == -1)
+	{
+		return;
+	}
+
+	dup2(*saved, STDIN_FILENO);
+	close(*saved);
+	*saved = -1;
+	reset_line_reader(&line_reader);
+}
+
+/**
+ * Runs a compiled program, loops only cost the commands they
+ * actually execute since nothing is parsed again
+ * @return exit status of the last command run
+**/
+int run_program(program_t* program)
+{
+	for_state_t loops[program->loop_slots + 1];
+
+	for(int i = 0; i < program->loop_slots; i++)
+	{
+		loops[i].items = NULL;
+		loops[i].count = 0;
+		loops[i].next = 0;
+	}
+
+	int saved_input[program->redirect_slots + 1];
+
+	for(int i = 0; i < program->redirect_slots; i++)
+	{
+		saved_input[i] = -1;
+	}
+
+	int pc = 0;
+
+	while(pc < program->length && !interrupted && !function_table.returning)
+	{
+		instruction_t* instruction = &program->code[pc];
+
+		switch(instruction->op)
+		{
+			case OP_EXEC:
+				last_status = exec_instruction(instruction);
+				pc++;
+				break;
+
+			case OP_JUMP:
+				pc = instruction->target;
+				break;
+
+			case OP_JUMP_IF_FALSE:
+				pc = last_status == 0 ? pc + 1 : instruction->target;
+				break;
+
+			case OP_FOR_INIT:
+				init_for_state(&loops[instruction->slot], instruction);
+				pc++;
+				break;
+
+			case OP_FOR_NEXT:
+			{
+				for_state_t* state = &loops[instruction->slot];
+
+				if(state->next == state->count)
+				{
+					pc = instruction->target;
+					break;
+				}
+
+				set_var(&var_table, instruction->var, state->items[state->next++]);
+				pc++;
+				break;
+			}
+
+			case OP_FUNCTION:
+				define_function(&function_table, instruction->var, instruction->words, instruction->word_count);
+				pc++;
+				break;
+
+			case OP_REDIRECT_INPUT:
+				if(instruction->var != NULL && redirect_input(instruction, &saved_input[instruction->slot]) == -1)
+				{
+					last_status = 1;
+					pc = instruction->target;
+					break;
+				}
+				pc++;
+				break;
+
+			case OP_RESTORE_INPUT:
+				restore_input(&saved_input[instruction->slot]);
+				pc++;
+				break;
+		}
+	}
+
+	for(int i = 0; i < program->loop_slots; i++)
+	{
+		for(int j = 0; j < loops[i].count; j++)
+		{
+			free(loops[i].items[j]);
+		}
+		free(loops[i].items);
+	}
+
+	//a return or interrupt can leave a redirected loop early
+	for(int i = program->redirect_slots - 1; i >= 0; i--)
+	{
+		restore_input(&saved_input[i]);
+	}
+
+	return last_status;
+}
+
+/**
+ * Deallocates a program along with the tokens it owns
+**/
+void free_program(program_t* program)
+{
+	if(program == NULL)
+	{
+		return;
+	}
+
+	if(program->tokens != NULL)
+	{
+		free_tokens(program->tokens);
+	}
+
+	for(int i = 0; i < program->length; i++)
+	{
+		free_program(program->code[i].stage);
+	}
+
+	free(program->code);
+	free(program);
+}
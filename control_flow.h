@@ -0,0 +1,65 @@
+#ifndef CONTROL_FLOW_H
+#define CONTROL_FLOW_H
+#include "plan.h"
+
+#define COMPILE_OK 0
+#define COMPILE_INCOMPLETE 1
+#define COMPILE_ERROR 2
+
+typedef enum opcode_t
+{
+	OP_EXEC,
+	OP_JUMP,
+	OP_JUMP_IF_FALSE,
+	OP_FOR_INIT,
+	OP_FOR_NEXT,
+	OP_FUNCTION,
+	OP_REDIRECT_INPUT,
+	OP_RESTORE_INPUT
+
+}opcode_t;
+
+/**
+ * A single bytecode instruction, words point into the
+ * token array owned by the program so nothing is copied
+**/
+typedef struct instruction_t
+{
+	opcode_t op;
+	char** words;
+	int word_count;
+	int expand;
+	int target;
+	int slot;
+	char* var;
+
+	//how OP_EXEC runs its words, worked out when it is compiled
+	command_plan_t plan;
+
+	//the loop or if that ends the pipeline of an OP_EXEC, var then
+	//holds its keyword, NULL for other instructions
+	struct program_t* stage;
+
+}instruction_t;
+
+typedef struct program_t
+{
+	instruction_t* code;
+	int length;
+	int capacity;
+	int loop_slots;
+	int redirect_slots;
+	char** tokens;
+	int token_count;
+
+}program_t;
+
+program_t* compile_program(char** tokens, int token_count, int* result);
+
+int run_program(program_t* program);
+
+void free_program(program_t* program);
+
+void run_compound_stage(char** command);
+
+#endif
@@ -0,0 +1,279 @@
+#include "coproc.h"
+#include "shell.h"
+#include "variables.h"
+#include "line_reader.h"
+#include "functions.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern var_table_t var_table;
+extern function_table_t function_table;
+extern int last_status;
+
+void init_coproc_table(coproc_table_t* table)
+{
+	for(int i = 0; i < MAX_COPROCS; i++)
+	{
+		table->coprocs[i].name = NULL;
+		table->coprocs[i].pid = 0;
+		table->coprocs[i].read_fd = -1;
+		table->coprocs[i].write_fd = -1;
+	}
+}
+
+static coproc_t* find_coproc(coproc_table_t* table, char* name)
+{
+	for(int i = 0; i < MAX_COPROCS; i++)
+	{
+		if(table->coprocs[i].name != NULL && strcmp(table->coprocs[i].name, name) == 0)
+		{
+			return &table->coprocs[i];
+		}
+	}
+	return NULL;
+}
+
+static void close_coproc_fd(int* fd)
+{
+	if(*fd != -1)
+	{
+		forget_fd_reader(*fd);
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+/**
+ * Sets NAME[0], NAME[1] and NAME_PID, a closed end reads as empty
+**/
+static void export_coproc(coproc_t* coproc)
+{
+	int length = strlen(coproc->name);
+	char name[length + 8];
+	char value[24];
+
+	snprintf(name, sizeof(name), "%s[0]", coproc->name);
+	snprintf(value, sizeof(value), "%d", coproc->read_fd);
+	set_var(&var_table, name, coproc->read_fd != -1 ? value : "");
+
+	snprintf(name, sizeof(name), "%s[1]", coproc->name);
+	snprintf(value, sizeof(value), "%d", coproc->write_fd);
+	set_var(&var_table, name, coproc->write_fd != -1 ? value : "");
+
+	snprintf(name, sizeof(name), "%s_PID", coproc->name);
+	snprintf(value, sizeof(value), "%d", (int) coproc->pid);
+	set_var(&var_table, name, value);
+}
+
+/**
+ * Moves a pipe end the shell keeps out of the low descriptors
+ * that redirections name, it stays close-on-exec
+ * @return the new descriptor, -1 on error
+**/
+static int raise_fd(int fd)
+{
+	int raised = fcntl(fd, F_DUPFD_CLOEXEC, COPROC_FD_MIN);
+
+	close(fd);
+	return raised;
+}
+
+/**
+ * @return 1 if word runs something as a command, a builtin, a
+ * function or a program found in PATH
+**/
+static int is_command_name(char* word)
+{
+	if(find_builtin(word) != NULL || find_function(&function_table, word) != NULL)
+	{
+		return 1;
+	}
+
+	char* path = getenv("PATH");
+
+	if(path == NULL)
+	{
+		return 0;
+	}
+
+	size_t word_length = strlen(word);
+
+	while(*path != '\0')
+	{
+		size_t dir_length = strcspn(path, ":");
+		char candidate[dir_length + word_length + 2];
+
+		snprintf(candidate, sizeof(candidate), "%.*s/%s", (int) dir_length, path, word);
+
+		if(dir_length > 0 && access(candidate, X_OK) == 0)
+		{
+			return 1;
+		}
+
+		path += dir_length;
+
+		if(*path == ':')
+		{
+			path++;
+		}
+	}
+
+	return 0;
+}
+
+static void print_coprocs(coproc_table_t* table)
+{
+	for(int i = 0; i < MAX_COPROCS; i++)
+	{
+		coproc_t* coproc = &table->coprocs[i];
+
+		if(coproc->name != NULL)
+		{
+			printf("%s\t%d\t%s[0]=%d\t%s[1]=%d\n", coproc->name, (int) coproc->pid, coproc->name, coproc->read_fd, coproc->name, coproc->write_fd);
+		}
+	}
+	fflush(stdout);
+}
+
+/**
+ * The "coproc" builtin starts a helper that stays running with a pipe
+ * to its standard input and one from its standard output, the shell
+ * reaches them through redirections and read
+ * "coproc NAME cmd args" sets ${NAME[1]} to write to it,
+ * ${NAME[0]} to read from it and $NAME_PID
+ * "coproc cmd" with a single word uses the name COPROC, a NAME that
+ * is itself a command is refused so "coproc sort -n" can't run -n
+ * "coproc -c NAME" closes its input so it sees end of file,
+ * plain "coproc" lists the helpers
+ * echo 2+2 >&${BC[1]}; read -r sum <&${BC[0]} asks a "coproc BC bc"
+**/
+void coproc_builtin(char** tokens, coproc_table_t* table)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		print_coprocs(table);
+		return;
+	}
+
+	if(strcmp(tokens[1], "-c") == 0)
+	{
+		coproc_t* coproc = tokens[2] != NULL ? find_coproc(table, tokens[2]) : NULL;
+
+		if(coproc == NULL)
+		{
+			fprintf(stderr, "coproc: %s: no such coprocess\n", tokens[2] != NULL ? tokens[2] : "");
+			last_status = 1;
+			return;
+		}
+
+		close_coproc_fd(&coproc->write_fd);
+		export_coproc(coproc);
+		return;
+	}
+
+	char* name = tokens[2] != NULL ? tokens[1] : "COPROC";
+	char** command = tokens[2] != NULL ? &tokens[2] : &tokens[1];
+
+	if(!is_valid_name(name, strlen(name)))
+	{
+		fprintf(stderr, "coproc: '%s' is not a valid name\n", name);
+		last_status = 2;
+		return;
+	}
+
+	if(tokens[2] != NULL && is_command_name(name))
+	{
+		fprintf(stderr, "coproc: '%s' is a command, name the coprocess first: coproc NAME %s ...\n", name, name);
+		last_status = 2;
+		return;
+	}
+
+	coproc_t* coproc = find_coproc(table, name);
+
+	//a name that is reused drops the old helper's pipes, which ends it
+	//the way closing its input would
+	if(coproc != NULL)
+	{
+		close_coproc_fd(&coproc->read_fd);
+		close_coproc_fd(&coproc->write_fd);
+	}
+
+	for(int i = 0; i < MAX_COPROCS && coproc == NULL; i++)
+	{
+		if(table->coprocs[i].name == NULL)
+		{
+			coproc = &table->coprocs[i];
+			coproc->name = strdup(name);
+		}
+	}
+
+	if(coproc == NULL)
+	{
+		fprintf(stderr, "coproc: at most %d coprocesses\n", MAX_COPROCS);
+		last_status = 1;
+		return;
+	}
+
+	int to_child[2];
+	int from_child[2];
+
+	if(pipe2(to_child, O_CLOEXEC) == -1)
+	{
+		perror("Pipe error");
+		last_status = 1;
+		return;
+	}
+
+	if(pipe2(from_child, O_CLOEXEC) == -1)
+	{
+		perror("Pipe error");
+		close(to_child[0]);
+		close(to_child[1]);
+		last_status = 1;
+		return;
+	}
+
+	to_child[1] = raise_fd(to_child[1]);
+	from_child[0] = raise_fd(from_child[0]);
+
+	if(to_child[1] == -1 || from_child[0] == -1)
+	{
+		perror("Could not move coprocess pipe");
+		coproc->pid = -1;
+	}
+	else
+	{
+		coproc->pid = spawn_coproc(command, to_child, from_child);
+	}
+
+	close(to_child[0]);
+	close(from_child[1]);
+
+	if(coproc->pid == -1)
+	{
+		if(to_child[1] != -1)
+		{
+			close(to_child[1]);
+		}
+
+		if(from_child[0] != -1)
+		{
+			close(from_child[0]);
+		}
+
+		free(coproc->name);
+		coproc->name = NULL;
+		coproc->pid = 0;
+		last_status = 1;
+		return;
+	}
+
+	coproc->read_fd = from_child[0];
+	coproc->write_fd = to_child[1];
+	export_coproc(coproc);
+}
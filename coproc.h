@@ -0,0 +1,34 @@
+#ifndef COPROC_H
+#define COPROC_H
+#include <sys/types.h>
+
+//helpers that can run at once
+#define MAX_COPROCS 16
+
+//the shell's ends are moved this high, clear of anything exec opens
+#define COPROC_FD_MIN 60
+
+/**
+ * A helper started with coproc, the shell writes its standard input
+ * through write_fd and reads its standard output through read_fd
+**/
+typedef struct coproc_t
+{
+	char* name;
+	pid_t pid;
+	int read_fd;
+	int write_fd;
+
+}coproc_t;
+
+typedef struct coproc_table_t
+{
+	coproc_t coprocs[MAX_COPROCS];
+
+}coproc_table_t;
+
+void init_coproc_table(coproc_table_t* table);
+
+void coproc_builtin(char** tokens, coproc_table_t* table);
+
+#endif
@@ -0,0 +1,204 @@
+#include "server.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/**
+ * Small client for shell --server, sends one command line along with
+ * this process's stdin, stdout and stderr and exits with the status
+ * the server reports
+ *
+ * usage: cshell_client [-r] SOCKET COMMAND...
+ *   -r  print the request's rusage to stderr when it finishes
+**/
+
+static void usage(char* name)
+{
+	fprintf(stderr, "usage: %s [-r] SOCKET COMMAND...\n", name);
+	exit(2);
+}
+
+/**
+ * Joins the command words back into one line separated by spaces
+ * @param words NULL terminated argument list
+ * @return malloc'd command line
+**/
+static char* join_words(char** words)
+{
+	size_t length = 1;
+
+	for(int i = 0; words[i] != NULL; i++)
+	{
+		length += strlen(words[i]) + 1;
+	}
+
+	char* line = malloc(length);
+
+	if(line == NULL)
+	{
+		perror("Could not allocate memory for command");
+		exit(EXIT_FAILURE);
+	}
+
+	line[0] = '\0';
+
+	for(int i = 0; words[i] != NULL; i++)
+	{
+		if(i > 0)
+		{
+			strcat(line, " ");
+		}
+		strcat(line, words[i]);
+	}
+
+	return line;
+}
+
+/**
+ * Sends the header with our stdio attached, then the command line
+ * @return 0 on success, -1 on error
+**/
+static int send_request(int sock, char* line)
+{
+	server_request_t header = {SERVER_MAGIC, strlen(line)};
+	int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(fds))];
+		struct cmsghdr align;
+	}control;
+
+	struct iovec iov = {&header, sizeof(header)};
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&control, 0, sizeof(control));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	if(sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(header))
+	{
+		return -1;
+	}
+
+	size_t sent = 0;
+
+	while(sent < header.length)
+	{
+		ssize_t n = send(sock, line + sent, header.length - sent, MSG_NOSIGNAL);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			return -1;
+		}
+
+		sent += n;
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	int print_usage = 0;
+	int arg = 1;
+
+	if(arg < argc && strcmp(argv[arg], "-r") == 0)
+	{
+		print_usage = 1;
+		arg++;
+	}
+
+	if(argc - arg < 2)
+	{
+		usage(argv[0]);
+	}
+
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if(strlen(argv[arg]) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "socket path too long: %s\n", argv[arg]);
+		return EXIT_FAILURE;
+	}
+
+	strcpy(addr.sun_path, argv[arg]);
+
+	int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if(sock < 0 || connect(sock, (struct sockaddr*) &addr, sizeof(addr)) < 0)
+	{
+		perror(argv[arg]);
+		return EXIT_FAILURE;
+	}
+
+	char* line = join_words(argv + arg + 1);
+
+	if(strlen(line) > SERVER_MAX_REQUEST || send_request(sock, line) < 0)
+	{
+		perror("Could not send request");
+		return EXIT_FAILURE;
+	}
+
+	free(line);
+
+	server_reply_t reply;
+	size_t received = 0;
+
+	while(received < sizeof(reply))
+	{
+		ssize_t n = recv(sock, (char*) &reply + received, sizeof(reply) - received, 0);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			fprintf(stderr, "server closed the connection without a reply\n");
+			return EXIT_FAILURE;
+		}
+
+		received += n;
+	}
+
+	close(sock);
+
+	if(print_usage)
+	{
+		fprintf(stderr, "status %d  wall %.3fs  user %.3fs  sys %.3fs  maxrss %lldKB  faults %lld/%lld  ctxsw %lld/%lld\n",
+			reply.status, reply.wall_us / 1e6, reply.user_us / 1e6, reply.sys_us / 1e6,
+			(long long) reply.max_rss_kb, (long long) reply.minor_faults, (long long) reply.major_faults,
+			(long long) reply.voluntary_switches, (long long) reply.involuntary_switches);
+
+		if(reply.pipe_bytes > 0)
+		{
+			fprintf(stderr, "pipes %lld bytes  wait-in %.3fs  wait-out %.3fs\n", (long long) reply.pipe_bytes,
+				reply.pipe_read_wait_us / 1e6, reply.pipe_write_wait_us / 1e6);
+		}
+	}
+
+	return reply.status & 0xff;
+}
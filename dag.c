@@ -0,0 +1,627 @@
+#include "dag.h"
+#include "shell.h"
+#include "job_wait.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern int last_status;
+extern volatile sig_atomic_t interrupted;
+
+/**
+ * Trims whitespace from both ends in place
+ * @return pointer to the first character that isn't whitespace
+**/
+static char* trim(char* text)
+{
+	while(isspace((unsigned char) *text))
+	{
+		text++;
+	}
+
+	char* end = text + strlen(text);
+
+	while(end > text && isspace((unsigned char) end[-1]))
+	{
+		end--;
+	}
+
+	*end = '\0';
+
+	return text;
+}
+
+static int find_task(dag_t* dag, char* name)
+{
+	for(int i = 0; i < dag->count; i++)
+	{
+		if(strcmp(dag->tasks[i].name, name) == 0)
+		{
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Adds a task, its dependencies are resolved once the whole file is read
+ * @param dep_names whitespace separated names, kept until then
+**/
+static void add_task(dag_t* dag, char* name, char* command, char*** dep_names)
+{
+	if(dag->count == dag->capacity)
+	{
+		dag->capacity = dag->capacity == 0 ? 16 : dag->capacity * 2;
+		dag->tasks = realloc(dag->tasks, sizeof(dag_task_t) * dag->capacity);
+		*dep_names = realloc(*dep_names, sizeof(char*) * dag->capacity);
+
+		if(dag->tasks == NULL || *dep_names == NULL)
+		{
+			perror("Could not allocate memory for tasks");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	dag_task_t* task = &dag->tasks[dag->count++];
+
+	memset(task, 0, sizeof(dag_task_t));
+	task->name = strdup(name);
+	task->command = strdup(command);
+	task->gate = -1;
+}
+
+/**
+ * Turns every task's dependency names into indexes
+ * @return 0 on success, -1 if a name is unknown
+**/
+static int resolve_deps(dag_t* dag, char** dep_names)
+{
+	for(int i = 0; i < dag->count; i++)
+	{
+		dag_task_t* task = &dag->tasks[i];
+		char* save;
+
+		task->deps = malloc(sizeof(int) * (strlen(dep_names[i]) / 2 + 1));
+
+		if(task->deps == NULL)
+		{
+			perror("Could not allocate memory for tasks");
+			exit(EXIT_FAILURE);
+		}
+
+		for(char* name = strtok_r(dep_names[i], " \t", &save); name != NULL; name = strtok_r(NULL, " \t", &save))
+		{
+			int dep = find_task(dag, name);
+
+			if(dep == -1)
+			{
+				fprintf(stderr, "dag: %s depends on unknown task %s\n", task->name, name);
+				return -1;
+			}
+
+			task->deps[task->dep_count++] = dep;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Checks the graph has no cycle by peeling off tasks
+ * whose prerequisites are all gone, as Kahn's algorithm does
+ * @return 0 if every task can run, -1 on a cycle
+**/
+static int check_cycles(dag_t* dag)
+{
+	int remaining[dag->count];
+	int peeled = 0;
+	int progress = 1;
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		remaining[i] = dag->tasks[i].dep_count;
+	}
+
+	while(progress)
+	{
+		progress = 0;
+
+		for(int i = 0; i < dag->count; i++)
+		{
+			if(remaining[i] != 0)
+			{
+				continue;
+			}
+
+			remaining[i] = -1;
+			peeled++;
+			progress = 1;
+
+			for(int j = 0; j < dag->count; j++)
+			{
+				for(int k = 0; k < dag->tasks[j].dep_count; k++)
+				{
+					if(dag->tasks[j].deps[k] == i)
+					{
+						remaining[j]--;
+					}
+				}
+			}
+		}
+	}
+
+	for(int i = 0; i < dag->count && peeled < dag->count; i++)
+	{
+		if(remaining[i] > 0)
+		{
+			fprintf(stderr, "dag: dependency cycle through %s\n", dag->tasks[i].name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Reads a task file, one "name : deps : command" per line, blank
+ * lines and lines starting with # are skipped and tasks may depend
+ * on tasks defined further down
+ * @param dag filled in, free with free_dag() whatever the result
+ * @return 0 on success, -1 if the file can't be read or is malformed
+**/
+int load_dag(char* file_name, dag_t* dag)
+{
+	dag->tasks = NULL;
+	dag->count = 0;
+	dag->capacity = 0;
+
+	FILE* file = fopen(file_name, "r");
+
+	if(file == NULL)
+	{
+		perror(file_name);
+		return -1;
+	}
+
+	char** dep_names = NULL;
+	char* line = NULL;
+	size_t line_capacity = 0;
+	int line_number = 0;
+	int result = 0;
+
+	while(result == 0 && getline(&line, &line_capacity, file) != -1)
+	{
+		line_number++;
+
+		char* text = trim(line);
+
+		if(*text == '\0' || *text == '#')
+		{
+			continue;
+		}
+
+		char* deps = strchr(text, ':');
+		char* command = deps != NULL ? strchr(deps + 1, ':') : NULL;
+
+		if(command == NULL)
+		{
+			fprintf(stderr, "dag: %s:%d: expected name : deps : command\n", file_name, line_number);
+			result = -1;
+			break;
+		}
+
+		*deps++ = '\0';
+		*command++ = '\0';
+
+		char* name = trim(text);
+		deps = trim(deps);
+		command = trim(command);
+
+		if(*name == '\0' || strpbrk(name, " \t") != NULL || *command == '\0')
+		{
+			fprintf(stderr, "dag: %s:%d: a task needs a one word name and a command\n", file_name, line_number);
+			result = -1;
+		}
+		else if(find_task(dag, name) != -1)
+		{
+			fprintf(stderr, "dag: %s:%d: task %s is defined twice\n", file_name, line_number, name);
+			result = -1;
+		}
+		else
+		{
+			add_task(dag, name, command, &dep_names);
+			dep_names[dag->count-1] = strdup(deps);
+		}
+	}
+
+	free(line);
+	fclose(file);
+
+	if(result == 0 && dag->count == 0)
+	{
+		fprintf(stderr, "dag: %s has no tasks\n", file_name);
+		result = -1;
+	}
+
+	if(result == 0 && (resolve_deps(dag, dep_names) == -1 || check_cycles(dag) == -1))
+	{
+		result = -1;
+	}
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		free(dep_names[i]);
+	}
+	free(dep_names);
+
+	return result;
+}
+
+/**
+ * Forks a copy of the shell that runs the task's command line, in its
+ * own process group so a failure can stop everything the task started
+ * @return 0 if the task is running, -1 if fork fails
+**/
+static int start_task(dag_task_t* task, sigset_t* prev_mask)
+{
+	//anything still buffered would be written again by the child
+	fflush(NULL);
+
+	task->start = now_ns();
+	task->pid = fork();
+
+	if(task->pid == -1)
+	{
+		perror("Fork error");
+		return -1;
+	}
+
+	if(task->pid == 0)
+	{
+		sigprocmask(SIG_SETMASK, prev_mask, NULL);
+		setpgid(0, 0);
+
+		//tasks run side by side, none of them gets the terminal
+		int null_fd = open("/dev/null", O_RDONLY);
+
+		if(null_fd != -1)
+		{
+			dup2(null_fd, STDIN_FILENO);
+			close(null_fd);
+		}
+
+		run_command_line(strdup(task->command), 0);
+		exit(last_status);
+	}
+
+	//set on both sides so kill() can't race the child
+	setpgid(task->pid, task->pid);
+	task->state = DAG_RUNNING;
+
+	return 0;
+}
+
+/**
+ * Stops every task that is still running
+**/
+static void stop_tasks(dag_t* dag, int sig)
+{
+	for(int i = 0; i < dag->count; i++)
+	{
+		if(dag->tasks[i].state == DAG_RUNNING)
+		{
+			kill(-dag->tasks[i].pid, sig);
+		}
+	}
+}
+
+/**
+ * Records a finished task and releases the tasks waiting on it
+ * @return the task's exit status
+**/
+static int finish_task(dag_t* dag, int index, int status)
+{
+	dag_task_t* task = &dag->tasks[index];
+
+	task->end = now_ns();
+	task->status = decode_status(status);
+	task->state = task->status == 0 ? DAG_DONE : DAG_FAILED;
+
+	if(task->state == DAG_FAILED)
+	{
+		return task->status;
+	}
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		for(int j = 0; j < dag->tasks[i].dep_count; j++)
+		{
+			if(dag->tasks[i].deps[j] == index)
+			{
+				//the last prerequisite to finish is the one the task waited on
+				dag->tasks[i].waiting--;
+				dag->tasks[i].gate = index;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Runs the tasks in dependency order with up to max_jobs at once, a task
+ * starts as soon as its last prerequisite finishes. The first failure or
+ * a Ctrl-C stops the running tasks and nothing new is started
+ * @return 0 if every task succeeded, else the status of the first failure
+**/
+int run_dag(dag_t* dag, int max_jobs)
+{
+	sigset_t prev_mask;
+	int running = 0;
+	int unwatched = 0;
+	int result = 0;
+	int stopping = 0;
+
+	//no more than every task can run at once, whatever -j asked for
+	if(max_jobs > dag->count)
+	{
+		max_jobs = dag->count > 0 ? dag->count : 1;
+	}
+
+	struct pollfd* fds = malloc(sizeof(struct pollfd) * max_jobs);
+	int* fd_tasks = malloc(sizeof(int) * max_jobs);
+
+	if(fds == NULL || fd_tasks == NULL)
+	{
+		perror("Could not allocate memory for dag");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		dag->tasks[i].waiting = dag->tasks[i].dep_count;
+		dag->tasks[i].state = DAG_PENDING;
+	}
+
+	//statuses are collected here, the SIGCHLD handler must not see them
+	block_sig_chld(&prev_mask);
+
+	while(1)
+	{
+		for(int i = 0; i < dag->count && running < max_jobs && !stopping; i++)
+		{
+			dag_task_t* task = &dag->tasks[i];
+
+			if(task->state != DAG_PENDING || task->waiting != 0)
+			{
+				continue;
+			}
+
+			if(start_task(task, &prev_mask) == -1)
+			{
+				task->state = DAG_FAILED;
+				task->status = 1;
+				result = 1;
+				stopping = 1;
+				stop_tasks(dag, SIGTERM);
+				break;
+			}
+
+			//out of descriptors the task is left to the periodic waitpid below
+			fds[running].fd = open_pidfd(task->pid);
+			fds[running].events = POLLIN;
+			fd_tasks[running] = i;
+
+			if(fds[running].fd == -1)
+			{
+				unwatched++;
+			}
+			running++;
+		}
+
+		if(running == 0)
+		{
+			break;
+		}
+
+		if(poll(fds, running, unwatched > 0 ? UNWATCHED_POLL_MS : -1) < 0 && errno != EINTR)
+		{
+			perror("dag: poll");
+		}
+
+		if(interrupted && !stopping)
+		{
+			stopping = 1;
+			result = 130;
+			stop_tasks(dag, SIGINT);
+		}
+
+		for(int i = 0; i < running; i++)
+		{
+			int status;
+			dag_task_t* task = &dag->tasks[fd_tasks[i]];
+
+			if(waitpid(task->pid, &status, WNOHANG) <= 0)
+			{
+				continue;
+			}
+
+			int task_status = finish_task(dag, fd_tasks[i], status);
+
+			if(task_status != 0 && !stopping)
+			{
+				fprintf(stderr, "dag: task %s failed with status %d\n", task->name, task_status);
+				stopping = 1;
+				result = task_status;
+				stop_tasks(dag, SIGTERM);
+			}
+
+			if(fds[i].fd == -1)
+			{
+				unwatched--;
+			}
+			else
+			{
+				close(fds[i].fd);
+			}
+
+			running--;
+			fds[i] = fds[running];
+			fd_tasks[i] = fd_tasks[running];
+			i--;
+		}
+	}
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		if(dag->tasks[i].state == DAG_PENDING)
+		{
+			dag->tasks[i].state = DAG_SKIPPED;
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+
+	free(fds);
+	free(fd_tasks);
+
+	return result;
+}
+
+/**
+ * Prints how many tasks ran and the critical path, the chain of tasks
+ * that each waited on the one before it and ended with the last task
+ * to finish, speeding up anything else would not have helped
+ * @param elapsed wall time of the whole run in nanoseconds
+**/
+void print_dag_summary(dag_t* dag, uint64_t elapsed)
+{
+	int counts[DAG_SKIPPED + 1] = {0};
+	uint64_t first_start = 0;
+	uint64_t task_time = 0;
+	int last = -1;
+
+	for(int i = 0; i < dag->count; i++)
+	{
+		dag_task_t* task = &dag->tasks[i];
+
+		counts[task->state]++;
+
+		if(task->state != DAG_DONE && task->state != DAG_FAILED)
+		{
+			continue;
+		}
+
+		task_time += task->end - task->start;
+
+		if(first_start == 0 || task->start < first_start)
+		{
+			first_start = task->start;
+		}
+
+		if(last == -1 || task->end > dag->tasks[last].end)
+		{
+			last = i;
+		}
+	}
+
+	printf("dag: %d tasks, %d done, %d failed, %d skipped, %.3fs wall, %.3fs of task time\n",
+		dag->count, counts[DAG_DONE], counts[DAG_FAILED], counts[DAG_SKIPPED],
+		elapsed / 1e9, task_time / 1e9);
+
+	if(last == -1)
+	{
+		fflush(stdout);
+		return;
+	}
+
+	int path[dag->count];
+	int length = 0;
+
+	for(int i = last; i != -1; i = dag->tasks[i].gate)
+	{
+		path[length++] = i;
+	}
+
+	printf("critical path %.3fs:\n", (dag->tasks[last].end - first_start) / 1e9);
+
+	for(int i = length - 1; i >= 0; i--)
+	{
+		dag_task_t* task = &dag->tasks[path[i]];
+
+		printf("  %-20s start %8.3fs  took %8.3fs", task->name,
+			(task->start - first_start) / 1e9, (task->end - task->start) / 1e9);
+
+		if(task->state == DAG_FAILED)
+		{
+			printf("  status %d", task->status);
+		}
+
+		printf("\n");
+	}
+
+	fflush(stdout);
+}
+
+void free_dag(dag_t* dag)
+{
+	for(int i = 0; i < dag->count; i++)
+	{
+		free(dag->tasks[i].name);
+		free(dag->tasks[i].command);
+		free(dag->tasks[i].deps);
+	}
+
+	free(dag->tasks);
+	dag->tasks = NULL;
+	dag->count = 0;
+}
+
+/**
+ * The "dag" builtin
+ * dag [-j N] FILE   runs the tasks in FILE with up to N at once,
+ *                   N defaults to the number of online cpus
+**/
+void dag_builtin(char** tokens)
+{
+	int max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int i = 1;
+
+	if(tokens[i] != NULL && strcmp(tokens[i], "-j") == 0)
+	{
+		max_jobs = tokens[i+1] != NULL ? atoi(tokens[i+1]) : 0;
+		i += 2;
+	}
+
+	if(max_jobs < 1 || tokens[i] == NULL || tokens[i+1] != NULL)
+	{
+		fprintf(stderr, "usage: dag [-j N] FILE\n");
+		last_status = 2;
+		return;
+	}
+
+	dag_t dag;
+
+	if(load_dag(tokens[i], &dag) == -1)
+	{
+		free_dag(&dag);
+		last_status = 2;
+		return;
+	}
+
+	uint64_t start = now_ns();
+
+	last_status = run_dag(&dag, max_jobs);
+
+	print_dag_summary(&dag, now_ns() - start);
+	free_dag(&dag);
+}
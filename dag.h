@@ -0,0 +1,55 @@
+#ifndef DAG_H
+#define DAG_H
+#include <sys/types.h>
+#include <stdint.h>
+
+#define DAG_PENDING 0
+#define DAG_RUNNING 1
+#define DAG_DONE 2
+#define DAG_FAILED 3
+#define DAG_SKIPPED 4
+
+/**
+ * One line of a task file, "name : deps : command"
+**/
+typedef struct dag_task_t
+{
+	char* name;
+	char* command;
+
+	int* deps;
+	int dep_count;
+
+	//prerequisites that have not finished yet
+	int waiting;
+
+	int state;
+	pid_t pid;
+	int status;
+	uint64_t start;
+	uint64_t end;
+
+	//the prerequisite that finished last, the one this task waited on
+	int gate;
+
+}dag_task_t;
+
+typedef struct dag_t
+{
+	dag_task_t* tasks;
+	int count;
+	int capacity;
+
+}dag_t;
+
+int load_dag(char* file_name, dag_t* dag);
+
+int run_dag(dag_t* dag, int max_jobs);
+
+void print_dag_summary(dag_t* dag, uint64_t elapsed);
+
+void free_dag(dag_t* dag);
+
+void dag_builtin(char** tokens);
+
+#endif
@@ -0,0 +1,233 @@
+#include "fanout.h"
+#include "utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+/**
+ * Reads exactly length bytes that are already sitting in the pipe
+**/
+static void read_all(int fd, char* buffer, ssize_t length)
+{
+	while(length > 0)
+	{
+		ssize_t bytes_read = read(fd, buffer, length);
+
+		if(bytes_read <= 0)
+		{
+			if(bytes_read < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			perror("Fan-out lost data");
+			exit(EXIT_FAILURE);
+		}
+
+		buffer += bytes_read;
+		length -= bytes_read;
+	}
+}
+
+/**
+ * Moves length bytes from in_fd to out_fd with splice()
+ * @return 0 on success, -1 if the consumer went away, what
+ * was not moved is still in in_fd
+**/
+static int splice_all(int in_fd, int out_fd, ssize_t* length)
+{
+	while(*length > 0)
+	{
+		ssize_t moved = splice(in_fd, NULL, out_fd, NULL, *length, SPLICE_F_MOVE);
+
+		if(moved < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+
+		*length -= moved;
+	}
+	return 0;
+}
+
+/**
+ * Drops consumers that closed their end, they are marked
+ * with -1 in done and the arrays are compacted
+ * @return the new number of consumers
+**/
+static int drop_closed(int* out_fds, ssize_t* done, int out_count)
+{
+	int kept = 0;
+
+	for(int i = 0; i < out_count; i++)
+	{
+		if(done[i] == -1)
+		{
+			close(out_fds[i]);
+			continue;
+		}
+		out_fds[kept++] = out_fds[i];
+	}
+	return kept;
+}
+
+/**
+ * Returns the buffer used on the slow path, allocated on first use
+**/
+static char* slow_path_buffer(char** buffer)
+{
+	if(*buffer == NULL)
+	{
+		*buffer = malloc(FANOUT_CHUNK);
+
+		if(*buffer == NULL)
+		{
+			perror("Could not allocate fan-out buffer");
+			exit(EXIT_FAILURE);
+		}
+	}
+	return *buffer;
+}
+
+/**
+ * Copies everything written into the pipe in_fd to every pipe in
+ * out_fds without the data passing through user space. Each round
+ * tee()s what is buffered in in_fd to all consumers but the last,
+ * then splice()s it to the last one, which consumes it. A tee() can
+ * come up short when a consumer's pipe is nearly full, and since tee()
+ * always starts at the front of in_fd, that round is read once and
+ * the missing parts are written out normally. Consumers that exit are
+ * dropped, the relay ends at end of input or once nobody is left
+ * @param in_fd read end of the producer's pipe
+ * @param out_fds write ends of the consumers' pipes
+ * @param out_count number of consumers
+**/
+void relay_fanout(int in_fd, int* out_fds, int out_count)
+{
+	ssize_t done[out_count];
+	char* buffer = NULL;
+
+	//a consumer that exits must not take the relay with it
+	signal(SIGPIPE, SIG_IGN);
+
+	while(out_count > 0)
+	{
+		ssize_t round;
+
+		if(out_count == 1)
+		{
+			round = splice(in_fd, NULL, out_fds[0], NULL, FANOUT_CHUNK, SPLICE_F_MOVE);
+		}
+		else
+		{
+			round = tee(in_fd, out_fds[0], FANOUT_CHUNK, 0);
+		}
+
+		if(round == 0)
+		{
+			break;
+		}
+
+		if(round < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+
+			if(errno != EPIPE)
+			{
+				perror("Fan-out error");
+				exit(EXIT_FAILURE);
+			}
+
+			//nothing was taken from in_fd, only the first consumer goes
+			for(int i = 0; i < out_count; i++)
+			{
+				done[i] = i == 0 ? -1 : 0;
+			}
+			out_count = drop_closed(out_fds, done, out_count);
+			continue;
+		}
+
+		for(int i = 0; i < out_count; i++)
+		{
+			done[i] = round;
+		}
+
+		if(out_count == 1)
+		{
+			continue;
+		}
+
+		int partial = 0;
+		int last = out_count - 1;
+
+		for(int i = 1; i < last; i++)
+		{
+			do
+			{
+				done[i] = tee(in_fd, out_fds[i], round, 0);
+			}
+			while(done[i] < 0 && errno == EINTR);
+
+			if(done[i] < 0)
+			{
+				done[i] = -1;
+			}
+			else if(done[i] < round)
+			{
+				partial = 1;
+			}
+		}
+
+		if(!partial)
+		{
+			ssize_t remaining = round;
+
+			if(splice_all(in_fd, out_fds[last], &remaining) == -1)
+			{
+				//the last consumer went away part way, the rest of
+				//the round is already in every other consumer
+				read_all(in_fd, slow_path_buffer(&buffer), remaining);
+				done[last] = -1;
+			}
+		}
+		else
+		{
+			//slow path, the round is read out once and
+			//each consumer gets whatever it is missing
+			read_all(in_fd, slow_path_buffer(&buffer), round);
+
+			if(write_all(out_fds[last], buffer, round) == -1)
+			{
+				done[last] = -1;
+			}
+
+			for(int i = 1; i < last; i++)
+			{
+				if(done[i] != -1 && done[i] < round && write_all(out_fds[i], buffer + done[i], round - done[i]) == -1)
+				{
+					done[i] = -1;
+				}
+			}
+		}
+
+		out_count = drop_closed(out_fds, done, out_count);
+	}
+
+	for(int i = 0; i < out_count; i++)
+	{
+		close(out_fds[i]);
+	}
+
+	free(buffer);
+	exit(EXIT_SUCCESS);
+}
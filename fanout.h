@@ -0,0 +1,10 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+//upper bound for a single tee()/splice() round, the pipe
+//capacity is what really limits how much moves at once
+#define FANOUT_CHUNK (1 << 20)
+
+void relay_fanout(int in_fd, int* out_fds, int out_count);
+
+#endif
@@ -0,0 +1,296 @@
+#include "fd_table.h"
+#include "input_parser.h"
+#include "line_reader.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern int last_status;
+extern line_reader_t line_reader;
+
+static char* kind_text[] = {"<", ">", ">>", "<&", ">&"};
+
+void init_fd_table(fd_table_t* table)
+{
+	for(int i = 0; i < FD_TABLE_SIZE; i++)
+	{
+		table->entries[i].target = NULL;
+		table->entries[i].kind = REDIRECT_IN;
+		table->entries[i].inherit = 0;
+	}
+}
+
+/**
+ * Reads a redirection operator from the tokenizer, "2>" names its
+ * descriptor and a bare ">" or "<" means standard output or input
+ * @param redirection set to the descriptor and kind, may be NULL
+ * @return 1 if token is a redirection, 0 if not
+**/
+int parse_redirection(char* token, redirection_t* redirection)
+{
+	if(!is_any_operator(token))
+	{
+		return 0;
+	}
+
+	char* op = token;
+	int fd = -1;
+
+	if(isdigit((unsigned char) *op))
+	{
+		fd = *op++ - '0';
+	}
+
+	for(int kind = REDIRECT_IN; kind <= REDIRECT_DUP_OUT; kind++)
+	{
+		if(strcmp(op, kind_text[kind]) == 0)
+		{
+			if(redirection != NULL)
+			{
+				redirection->kind = kind;
+				redirection->fd = fd != -1 ? fd : (*op == '<' ? 0 : 1);
+			}
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Reads the descriptor number of N>&M or <&M, which may be
+ * any open descriptor such as a coprocess pipe
+ * @return the descriptor, -1 if text isn't a number of an open one
+**/
+int parse_fd(char* text)
+{
+	if(*text == '\0' || strlen(text) > 6)
+	{
+		return -1;
+	}
+
+	for(char* c = text; *c != '\0'; c++)
+	{
+		if(!isdigit((unsigned char) *c))
+		{
+			return -1;
+		}
+	}
+
+	int fd = atoi(text);
+
+	return fcntl(fd, F_GETFD) != -1 ? fd : -1;
+}
+
+/**
+ * Points a descriptor at the target of a redirection, a file is opened
+ * straight onto the descriptor and N>&M or N>&- copy or close one
+ * @param target file name, or a descriptor number or - for <& and >&
+ * @param cloexec 1 to keep the descriptor out of commands the shell runs
+ * @return 0 on success, -1 with the error printed
+**/
+int apply_redirection(redirection_t* redirection, char* target, int cloexec)
+{
+	int fd = redirection->fd;
+
+	if(redirection->kind == REDIRECT_DUP_IN || redirection->kind == REDIRECT_DUP_OUT)
+	{
+		if(strcmp(target, "-") == 0)
+		{
+			close(fd);
+			return 0;
+		}
+
+		int source = parse_fd(target);
+
+		if(source == -1)
+		{
+			fprintf(stderr, "%s: bad file descriptor\n", target);
+			return -1;
+		}
+
+		if(source != fd && dup3(source, fd, cloexec ? O_CLOEXEC : 0) == -1)
+		{
+			perror("Could not duplicate file descriptor");
+			return -1;
+		}
+		return 0;
+	}
+
+	int flags = O_RDONLY;
+
+	if(redirection->kind == REDIRECT_OUT)
+	{
+		flags = O_WRONLY | O_CREAT | O_TRUNC;
+	}
+	else if(redirection->kind == REDIRECT_APPEND)
+	{
+		flags = O_WRONLY | O_CREAT | O_APPEND;
+	}
+
+	int opened = open(target, flags | O_CLOEXEC, 0644);
+
+	if(opened < 0)
+	{
+		fprintf(stderr, "%s: %s\n", target, strerror(errno));
+		return -1;
+	}
+
+	if(opened == fd)
+	{
+		if(!cloexec)
+		{
+			fcntl(fd, F_SETFD, 0);
+		}
+		return 0;
+	}
+
+	if(dup3(opened, fd, cloexec ? O_CLOEXEC : 0) == -1)
+	{
+		perror("Could not redirect file descriptor");
+		close(opened);
+		return -1;
+	}
+
+	close(opened);
+	return 0;
+}
+
+/**
+ * Applies the redirections change_input() and change_output() leave
+ * alone, ">>", "2>", "N>&M" and the like, in the child before exec
+ * @param tokens the command as typed, NULL terminated
+**/
+void apply_child_redirections(char** tokens)
+{
+	for(int i = 0; tokens[i] != NULL; i++)
+	{
+		redirection_t redirection;
+
+		if(is_operator(tokens[i], "<") || is_operator(tokens[i], ">") || !parse_redirection(tokens[i], &redirection))
+		{
+			continue;
+		}
+
+		if(tokens[i + 1] == NULL || apply_redirection(&redirection, tokens[i + 1], 0) == -1)
+		{
+			exit(EXIT_FAILURE);
+		}
+		i++;
+	}
+}
+
+/**
+ * Remembers what exec did to a descriptor for the listing
+**/
+static void record_fd(fd_table_t* table, redirection_t* redirection, char* target, int inherit)
+{
+	fd_entry_t* entry = &table->entries[redirection->fd];
+
+	free(entry->target);
+	entry->target = NULL;
+
+	if(strcmp(target, "-") == 0 && redirection->kind >= REDIRECT_DUP_IN)
+	{
+		return;
+	}
+
+	entry->target = strdup(target);
+	entry->kind = redirection->kind;
+	entry->inherit = inherit;
+}
+
+static void print_fd_table(fd_table_t* table)
+{
+	for(int fd = 0; fd < FD_TABLE_SIZE; fd++)
+	{
+		fd_entry_t* entry = &table->entries[fd];
+		int flags = fcntl(fd, F_GETFD);
+
+		if(entry->target == NULL || flags == -1)
+		{
+			continue;
+		}
+
+		printf("%d%s%s%s\n", fd, kind_text[entry->kind], entry->target, (flags & FD_CLOEXEC) ? "\tcloexec" : "");
+	}
+	fflush(stdout);
+}
+
+/**
+ * The "exec" builtin, only redirections are supported and they stay
+ * in place for every later command instead of lasting for one
+ * "exec >log 2>&1" sends the shell's output to log
+ * "exec 3<file" and "exec 4>>file" open extra descriptors
+ * "exec 3>&-" closes one, plain "exec" lists what exec has set up
+ * Descriptors above 2 are close-on-exec so commands don't inherit them,
+ * use them with cmd >&3, "exec -i ..." lets commands inherit them
+**/
+void exec_builtin(char** tokens, fd_table_t* table)
+{
+	int inherit = 0;
+	int i = 1;
+
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		print_fd_table(table);
+		return;
+	}
+
+	if(strcmp(tokens[1], "-i") == 0)
+	{
+		inherit = 1;
+		i++;
+	}
+
+	//check the whole line first so a bad word changes nothing
+	for(int j = i; tokens[j] != NULL; j += 2)
+	{
+		if(!parse_redirection(tokens[j], NULL) || tokens[j + 1] == NULL || is_any_operator(tokens[j + 1]))
+		{
+			fprintf(stderr, "usage: exec [-i] REDIRECTION..., as in exec >log 2>&1 or exec 3<file\n");
+			last_status = 2;
+			return;
+		}
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	for(; tokens[i] != NULL; i += 2)
+	{
+		redirection_t redirection;
+
+		parse_redirection(tokens[i], &redirection);
+
+		int fd = redirection.fd;
+
+		//the shell's own descriptors, such as the job log pipes, stay off limits
+		if(fd > 2 && table->entries[fd].target == NULL && fcntl(fd, F_GETFD) != -1)
+		{
+			fprintf(stderr, "exec: descriptor %d is in use by the shell\n", fd);
+			last_status = 1;
+			return;
+		}
+
+		if(apply_redirection(&redirection, tokens[i + 1], fd > 2 && !inherit) == -1)
+		{
+			last_status = 1;
+			return;
+		}
+
+		record_fd(table, &redirection, tokens[i + 1], inherit);
+
+		if(fd == 0)
+		{
+			reset_line_reader(&line_reader);
+		}
+
+		forget_fd_reader(fd);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef FD_TABLE_H
+#define FD_TABLE_H
+
+//descriptors a redirection can name, one digit as in sh
+#define FD_TABLE_SIZE 10
+
+#define REDIRECT_IN 0
+#define REDIRECT_OUT 1
+#define REDIRECT_APPEND 2
+#define REDIRECT_DUP_IN 3
+#define REDIRECT_DUP_OUT 4
+
+typedef struct redirection_t
+{
+	int fd;
+	int kind;
+
+}redirection_t;
+
+/**
+ * A descriptor the shell itself holds open because of exec, target
+ * is the file name or "&N" for a copy of another descriptor
+**/
+typedef struct fd_entry_t
+{
+	char* target;
+	int kind;
+	int inherit;
+
+}fd_entry_t;
+
+/**
+ * The shell's own descriptors set up by exec, indexed by descriptor
+**/
+typedef struct fd_table_t
+{
+	fd_entry_t entries[FD_TABLE_SIZE];
+
+}fd_table_t;
+
+void init_fd_table(fd_table_t* table);
+
+int parse_redirection(char* token, redirection_t* redirection);
+
+int parse_fd(char* text);
+
+int apply_redirection(redirection_t* redirection, char* target, int cloexec);
+
+void apply_child_redirections(char** tokens);
+
+void exec_builtin(char** tokens, fd_table_t* table);
+
+#endif
@@ -0,0 +1,496 @@
+#include "functions.h"
+#include "input_parser.h"
+#include "variables.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+extern var_table_t var_table;
+extern int last_status;
+
+void init_function_table(function_table_t* table)
+{
+	table->functions = NULL;
+	table->count = 0;
+	table->capacity = 0;
+	table->aliases = NULL;
+	table->alias_count = 0;
+	table->alias_capacity = 0;
+	table->depth = 0;
+	table->returning = 0;
+}
+
+/**
+ * Checks a function or alias name, unlike variables these may
+ * also use - . and : as wrapper scripts often do
+**/
+static int is_command_name(char* name, int length)
+{
+	if(length <= 0 || isdigit((unsigned char) name[0]))
+	{
+		return 0;
+	}
+
+	for(int i = 0; i < length; i++)
+	{
+		if(!(isalnum((unsigned char) name[i]) || strchr("_-.:", name[i]) != NULL))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void release_body(function_body_t* body)
+{
+	if(--body->refs == 0)
+	{
+		free_program(body->program);
+		free(body->words);
+		free(body);
+	}
+}
+
+static function_body_t* new_body(program_t* program, char** words, int word_count)
+{
+	function_body_t* body = malloc(sizeof(function_body_t));
+
+	if(body == NULL)
+	{
+		perror("Could not allocate memory for function");
+		exit(EXIT_FAILURE);
+	}
+
+	body->program = program;
+	body->words = words;
+	body->word_count = word_count;
+	body->refs = 1;
+
+	return body;
+}
+
+static void append_function(function_table_t* table, char* name, function_body_t* body)
+{
+	if(table->count == table->capacity)
+	{
+		table->capacity = table->capacity == 0 ? 16 : table->capacity * 2;
+		table->functions = realloc(table->functions, sizeof(function_t) * table->capacity);
+
+		if(table->functions == NULL)
+		{
+			perror("Could not grow function table");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	table->functions[table->count].name = strdup(name);
+	table->functions[table->count].body = body;
+	table->count++;
+}
+
+function_t* find_function(function_table_t* table, char* name)
+{
+	for(int i = 0; i < table->count; i++)
+	{
+		if(strcmp(table->functions[i].name, name) == 0)
+		{
+			return &table->functions[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Defines or replaces a function when its definition runs. The body
+ * is copied out of the defining line and compiled here once, calls
+ * only run the compiled program
+ * @param words body tokens between { and }, the compiler already checked them
+**/
+void define_function(function_table_t* table, char* name, char** words, int word_count)
+{
+	if(!is_command_name(name, strlen(name)))
+	{
+		fprintf(stderr, "'%s' is not a valid function name\n", name);
+		last_status = 1;
+		return;
+	}
+
+	char** tokens = copy_tokens(words, word_count);
+	int result;
+
+	program_t* program = compile_program(tokens, word_count, &result);
+
+	if(program == NULL)
+	{
+		free_tokens(tokens);
+		last_status = 2;
+		return;
+	}
+
+	function_body_t* body = new_body(program, NULL, 0);
+
+	function_t* function = find_function(table, name);
+
+	if(function != NULL)
+	{
+		release_body(function->body);
+		function->body = body;
+		last_status = 0;
+		return;
+	}
+
+	append_function(table, name, body);
+
+	last_status = 0;
+}
+
+/**
+ * Adds a function whose body is only compiled when it is first called,
+ * for definitions restored from the rc snapshot that were checked when
+ * the snapshot was made. The name must not be defined yet
+ * @param words body tokens, the array passes to the table but the text
+ * must stay valid as long as the function exists
+**/
+void declare_function(function_table_t* table, char* name, char** words, int word_count)
+{
+	append_function(table, name, new_body(NULL, words, word_count));
+}
+
+/**
+ * Compiles a body that declare_function() left for its first call
+ * @return 0 once compiled, -1 if the body doesn't compile
+**/
+static int compile_body(function_body_t* body)
+{
+	int result;
+	char** tokens = copy_tokens(body->words, body->word_count);
+
+	body->program = compile_program(tokens, body->word_count, &result);
+
+	if(body->program == NULL)
+	{
+		free_tokens(tokens);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Runs a function in the shell itself with argv[1] onwards as its
+ * positional parameters, the caller's are restored afterwards
+ * @param argv the command, argv[0] is the function name
+ * @return exit status of the function
+**/
+int call_function(function_table_t* table, function_t* function, char** argv, int argc)
+{
+	if(table->depth == FUNCTION_MAX_DEPTH)
+	{
+		fprintf(stderr, "%s: maximum function nesting of %d reached\n", argv[0], FUNCTION_MAX_DEPTH);
+		last_status = 1;
+		return last_status;
+	}
+
+	function_body_t* body = function->body;
+
+	if(body->program == NULL && compile_body(body) == -1)
+	{
+		last_status = 2;
+		return last_status;
+	}
+
+	char** saved_positional = var_table.positional;
+	int saved_count = var_table.positional_count;
+
+	body->refs++;
+	var_table.positional = argv + 1;
+	var_table.positional_count = argc - 1;
+	table->depth++;
+
+	run_program(body->program);
+
+	table->depth--;
+	table->returning = 0;
+	var_table.positional = saved_positional;
+	var_table.positional_count = saved_count;
+	release_body(body);
+
+	return last_status;
+}
+
+static alias_t* find_alias(function_table_t* table, char* name)
+{
+	for(int i = 0; i < table->alias_count; i++)
+	{
+		if(strcmp(table->aliases[i].name, name) == 0)
+		{
+			return &table->aliases[i];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Replaces the command word with its alias as long as it names one,
+ * an alias isn't expanded again inside its own expansion
+ * @param expanded set to a new word array, free it but not its words
+ * @return number of words in expanded, -1 if words[0] is no alias
+**/
+int expand_aliases(function_table_t* table, char** words, int word_count, char*** expanded)
+{
+	char* used[ALIAS_MAX_DEPTH];
+	int depth = 0;
+	char** current = words;
+	char** owned = NULL;
+
+	while(depth < ALIAS_MAX_DEPTH)
+	{
+		alias_t* alias = find_alias(table, current[0]);
+
+		if(alias == NULL)
+		{
+			break;
+		}
+
+		int seen = 0;
+
+		for(int i = 0; i < depth; i++)
+		{
+			seen |= used[i] == alias->name;
+		}
+
+		if(seen)
+		{
+			break;
+		}
+
+		used[depth++] = alias->name;
+
+		int count = alias->token_count + word_count - 1;
+		char** next = malloc(sizeof(char*) * (count + 1));
+
+		if(next == NULL)
+		{
+			perror("Could not allocate memory for alias");
+			exit(EXIT_FAILURE);
+		}
+
+		memcpy(next, alias->tokens, sizeof(char*) * alias->token_count);
+		memcpy(next + alias->token_count, current + 1, sizeof(char*) * (word_count - 1));
+		next[count] = NULL;
+
+		free(owned);
+		owned = next;
+		current = next;
+		word_count = count;
+	}
+
+	if(owned == NULL)
+	{
+		return -1;
+	}
+
+	*expanded = owned;
+	return word_count;
+}
+
+static void print_alias(alias_t* alias)
+{
+	printf("alias %s='%s'\n", alias->name, alias->text);
+}
+
+static alias_t* append_alias(function_table_t* table, char* name)
+{
+	if(table->alias_count == table->alias_capacity)
+	{
+		table->alias_capacity = table->alias_capacity == 0 ? 16 : table->alias_capacity * 2;
+		table->aliases = realloc(table->aliases, sizeof(alias_t) * table->alias_capacity);
+
+		if(table->aliases == NULL)
+		{
+			perror("Could not grow alias table");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	alias_t* alias = &table->aliases[table->alias_count++];
+	alias->name = strdup(name);
+
+	return alias;
+}
+
+/**
+ * Adds an alias that is already tokenized, for aliases restored from
+ * the rc snapshot. The name must not be an alias yet
+ * @param tokens the table frees the array with free_tokens(), the text
+ * must stay valid as long as the alias exists
+**/
+void declare_alias(function_table_t* table, char* name, char* text, char** tokens, int token_count)
+{
+	alias_t* alias = append_alias(table, name);
+
+	alias->text = strdup(text);
+	alias->tokens = tokens;
+	alias->token_count = token_count;
+}
+
+/**
+ * Tokenizes an alias body and stores it under name
+ * @return 0 on success, 1 if the body can't be an alias
+**/
+static int define_alias(function_table_t* table, char* name, char* text)
+{
+	int count;
+	int incomplete;
+
+	char** tokens = tokenize(text, &count, &incomplete);
+
+	if(tokens == NULL || count == 0)
+	{
+		fprintf(stderr, "alias: %s: %s\n", name, incomplete ? "unterminated quote" : "empty alias");
+		free_tokens(tokens);
+		return 1;
+	}
+
+	for(int i = 0; i < count; i++)
+	{
+		if(is_operator(tokens[i], ";"))
+		{
+			fprintf(stderr, "alias: %s: use a function for more than one command\n", name);
+			free_tokens(tokens);
+			return 1;
+		}
+	}
+
+	alias_t* alias = find_alias(table, name);
+
+	if(alias == NULL)
+	{
+		alias = append_alias(table, name);
+	}
+	else
+	{
+		free(alias->text);
+		free_tokens(alias->tokens);
+	}
+
+	alias->text = strdup(text);
+	alias->tokens = tokens;
+	alias->token_count = count;
+
+	return 0;
+}
+
+/**
+ * The "alias" builtin, "alias" lists every alias, "alias NAME=VALUE"
+ * defines one and "alias NAME" prints it
+**/
+void alias_builtin(char** tokens, function_table_t* table)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		for(int i = 0; i < table->alias_count; i++)
+		{
+			print_alias(&table->aliases[i]);
+		}
+		fflush(stdout);
+		return;
+	}
+
+	for(int i = 1; tokens[i] != NULL; i++)
+	{
+		char* equals = strchr(tokens[i], '=');
+
+		if(equals == NULL)
+		{
+			alias_t* alias = find_alias(table, tokens[i]);
+
+			if(alias == NULL)
+			{
+				fprintf(stderr, "alias: %s: not found\n", tokens[i]);
+				last_status = 1;
+				continue;
+			}
+
+			print_alias(alias);
+			continue;
+		}
+
+		if(!is_command_name(tokens[i], equals - tokens[i]))
+		{
+			fprintf(stderr, "alias: '%.*s' is not a valid alias name\n", (int) (equals - tokens[i]), tokens[i]);
+			last_status = 1;
+			continue;
+		}
+
+		*equals = '\0';
+
+		if(define_alias(table, tokens[i], equals + 1) != 0)
+		{
+			last_status = 1;
+		}
+
+		*equals = '=';
+	}
+
+	fflush(stdout);
+}
+
+/**
+ * The "unalias" builtin, "unalias NAME..." or "unalias -a" for all
+**/
+void unalias_builtin(char** tokens, function_table_t* table)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		fprintf(stderr, "usage: unalias [-a] NAME...\n");
+		last_status = 2;
+		return;
+	}
+
+	int all = strcmp(tokens[1], "-a") == 0;
+
+	for(int i = table->alias_count - 1; i >= 0; i--)
+	{
+		alias_t* alias = &table->aliases[i];
+		int remove = all;
+
+		for(int j = 1; !remove && tokens[j] != NULL; j++)
+		{
+			remove = strcmp(tokens[j], alias->name) == 0;
+		}
+
+		if(remove)
+		{
+			free(alias->name);
+			free(alias->text);
+			free_tokens(alias->tokens);
+			*alias = table->aliases[--table->alias_count];
+		}
+	}
+}
+
+/**
+ * The "return" builtin, "return [N]" leaves the running function
+ * with status N or the status of the last command
+**/
+void return_builtin(char** tokens, function_table_t* table)
+{
+	if(table->depth == 0)
+	{
+		fprintf(stderr, "return: can only be used in a function\n");
+		last_status = 1;
+		return;
+	}
+
+	if(tokens[1] != NULL)
+	{
+		last_status = atoi(tokens[1]);
+	}
+
+	table->returning = 1;
+}
@@ -0,0 +1,84 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+#include "control_flow.h"
+
+//calls nested deeper than this fail instead of running out of stack
+#define FUNCTION_MAX_DEPTH 256
+
+//an alias may expand to another alias this many times
+#define ALIAS_MAX_DEPTH 16
+
+/**
+ * A compiled function body, a call keeps a reference so the body
+ * survives the function being redefined while it runs. A body
+ * restored from the rc snapshot keeps its words and program stays
+ * NULL until the first call
+**/
+typedef struct function_body_t
+{
+	program_t* program;
+	char** words;
+	int word_count;
+	int refs;
+
+}function_body_t;
+
+typedef struct function_t
+{
+	char* name;
+	function_body_t* body;
+
+}function_t;
+
+/**
+ * An alias is tokenized once when it is defined, using it
+ * splices the tokens in front of the command's own words
+**/
+typedef struct alias_t
+{
+	char* name;
+	char* text;
+	char** tokens;
+	int token_count;
+
+}alias_t;
+
+typedef struct function_table_t
+{
+	function_t* functions;
+	int count;
+	int capacity;
+
+	alias_t* aliases;
+	int alias_count;
+	int alias_capacity;
+
+	//calls currently running
+	int depth;
+
+	//set by return, stops the running function's program
+	int returning;
+
+}function_table_t;
+
+void init_function_table(function_table_t* table);
+
+void define_function(function_table_t* table, char* name, char** words, int word_count);
+
+void declare_function(function_table_t* table, char* name, char** words, int word_count);
+
+void declare_alias(function_table_t* table, char* name, char* text, char** tokens, int token_count);
+
+function_t* find_function(function_table_t* table, char* name);
+
+int call_function(function_table_t* table, function_t* function, char** argv, int argc);
+
+int expand_aliases(function_table_t* table, char** words, int word_count, char*** expanded);
+
+void alias_builtin(char** tokens, function_table_t* table);
+
+void unalias_builtin(char** tokens, function_table_t* table);
+
+void return_builtin(char** tokens, function_table_t* table);
+
+#endif
@@ -1,8 +1,9 @@
 #include "input_parser.h"
+#include "variables.h"
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
 
 
 /**
@@ -12,31 +13,19 @@
 **/
 char* remove_whitespace(char input[])
 {
-	int start = 0;
-
-	int end = strlen(input)-1;
-
-
 	//trim whitespace on the front end
-	while(isspace((unsigned char) input[start]) && input[start] != '\0')
-	{
-	        start++;
-	}
+	char* start = skip_blanks_fast(input, 1);
 
 	//case where the input is empty after removing whitespace
-	if(input[start] == '\0')
+	if(*start == '\0')
 	{
 		return NULL;
 	}
 
-
 	//trim whitespace on the back end
-	while(end > start && isspace((unsigned char) input[end]))
-	{
-	        end--;
-	}
+	char* end = trim_end(start, start + strlen(start));
 
-	int trimmed_len = end - start + 1;
+	int trimmed_len = end - start;
 
 
 	//set up our pointer to be returned
@@ -49,7 +38,7 @@ char* remove_whitespace(char input[])
         exit(EXIT_FAILURE);
     }
 
-    memcpy(new_input,&input[start],trimmed_len);
+    memcpy(new_input,start,trimmed_len);
 
     new_input[trimmed_len] = '\0';
 
@@ -83,88 +72,451 @@ INPUT_PARSER* init_input_parser(char* input)
 
 	int length = strlen(input)+1;
 
-	input_parser->str = (char*) malloc(length);
+	//the padding lets the scan index read whole blocks past the NUL
+	input_parser->str = (char*) malloc(length + SCAN_PADDING);
+
+	if(input_parser->str == NULL)
+	{
+		perror("Could not allocate memory for parser");
+		free(input_parser);
+		return NULL;
+	}
 
 	//copy over our input to struct attribute 
 	//and set position
 	memcpy(input_parser->str,input,length);
+	memset(input_parser->str + length, 0, SCAN_PADDING);
 
 	input_parser->position = input_parser->str;
+	input_parser->queued = NULL;
+	input_parser->incomplete = 0;
+
+	build_scan_index(&input_parser->index, input_parser->str, length - 1);
 
 	return input_parser;
 }
 
+#define FD_OPERATORS(fd) fd "<\0" fd "<&\0" fd ">\0" fd ">>\0" fd ">&\0"
+
+/*
+ * Operator tokens are handed out from this buffer instead of the input,
+ * so a quoted "|" stays a plain word and is_operator() tells them apart.
+ * A single digit right before a redirection names the descriptor, those
+ * get an operator of their own such as "2>" from the blocks at the end
+ */
+static char operator_text[] = "|\0||\0|>\0|&\0&\0&&\0<\0<<\0>\0>>\0;\0<&\0>&\0"
+	FD_OPERATORS("0") FD_OPERATORS("1") FD_OPERATORS("2") FD_OPERATORS("3") FD_OPERATORS("4")
+	FD_OPERATORS("5") FD_OPERATORS("6") FD_OPERATORS("7") FD_OPERATORS("8") FD_OPERATORS("9");
+
+#define OPERATOR_PIPE 0
+#define OPERATOR_OR 2
+#define OPERATOR_FANOUT 5
+#define OPERATOR_PIPE_ERR 8
+#define OPERATOR_BACKGROUND 11
+#define OPERATOR_AND 13
+#define OPERATOR_IN 16
+#define OPERATOR_HEREDOC 18
+#define OPERATOR_OUT 21
+#define OPERATOR_APPEND 23
+#define OPERATOR_SEPARATOR 26
+#define OPERATOR_DUP_IN 28
+#define OPERATOR_DUP_OUT 31
+#define OPERATOR_FD_BASE 34
+
+//bytes taken by the redirections of one descriptor in operator_text
+#define FD_OPERATOR_SIZE 18
+
 /**
- * Gets the next token from the input parser
- * @param initialized input parser
- * @return parsed tokens, NULL if string is empty 
- * or input parser is NULL
+ * Checks for an unquoted operator or separator
+ * @param token from tokenize()
+ * @param op operator text such as "|" or ";"
+ * @return 1 if token is that operator, 0 if not or if it was quoted
 **/
-char* get_token(INPUT_PARSER* parser)
+int is_operator(const char* token, const char* op)
 {
-	if(parser == NULL)
+	return is_any_operator(token) && strcmp(token, op) == 0;
+}
+
+/**
+ * @return 1 if token is an unquoted operator or separator of any kind
+**/
+int is_any_operator(const char* token)
+{
+	return token >= operator_text && token < operator_text + sizeof(operator_text);
+}
+
+/**
+ * @return where an operator token sits in the operator text, which
+ * lets a token array saved outside the shell point at it again
+**/
+int operator_index(const char* token)
+{
+	return token - operator_text;
+}
+
+/**
+ * @return the operator token at index, NULL unless an operator
+ * starts there
+**/
+char* operator_at(int index)
+{
+	if(index < 0 || index >= (int) sizeof(operator_text) - 1 || (index > 0 && operator_text[index - 1] != '\0'))
 	{
-		perror("Parser that is passed in must be initialized");
 		return NULL;
 	}
+	return operator_text + index;
+}
 
-	char *start = parser->position;
+//lexer character classes
+#define LEX_OTHER 0
+#define LEX_BREAK 1
+#define LEX_NEWLINE 2
+#define LEX_SINGLE 3
+#define LEX_DOUBLE 4
+#define LEX_BACKSLASH 5
+#define LEX_DOLLAR 6
+#define LEX_NUL 7
+#define LEX_CLASSES 8
+
+//lexer states inside a word
+#define S_WORD 0
+#define S_SINGLE 1
+#define S_DOUBLE 2
+#define S_ESCAPE 3
+#define S_DOUBLE_ESCAPE 4
+#define LEX_STATES 5
+
+//what a transition does with the character it reads
+#define A_KEEP 0
+#define A_DROP 1
+#define A_LITERAL 2
+#define A_BACKSLASH 3
+#define A_END 4
+#define A_MORE 5
+
+#define LEX(action, state) ((action) << 3 | (state))
+
+static const unsigned char lex_class[256] =
+{
+	['\0'] = LEX_NUL,
+	[' '] = LEX_BREAK,
+	['\t'] = LEX_BREAK,
+	['\v'] = LEX_BREAK,
+	['\f'] = LEX_BREAK,
+	['\r'] = LEX_BREAK,
+	['|'] = LEX_BREAK,
+	['&'] = LEX_BREAK,
+	['<'] = LEX_BREAK,
+	['>'] = LEX_BREAK,
+	[';'] = LEX_BREAK,
+	['\n'] = LEX_NEWLINE,
+	['\''] = LEX_SINGLE,
+	['"'] = LEX_DOUBLE,
+	['\\'] = LEX_BACKSLASH,
+	['$'] = LEX_DOLLAR,
+};
 
-	// make sure we're not at the end
-    if (*start == '\0') 
-    { 
-        return NULL;
-    }
+/**
+ * One row per state, one column per class. Quotes and escaping
+ * backslashes are dropped, a quoted or escaped $ is kept as
+ * LITERAL_DOLLAR so expansion leaves it alone, and a backslash
+ * followed by a newline continues the line
+**/
+static const unsigned char lex_table[LEX_STATES][LEX_CLASSES] =
+{
+	[S_WORD] =
+	{
+		[LEX_OTHER] = LEX(A_KEEP, S_WORD),
+		[LEX_BREAK] = LEX(A_END, S_WORD),
+		[LEX_NEWLINE] = LEX(A_END, S_WORD),
+		[LEX_SINGLE] = LEX(A_DROP, S_SINGLE),
+		[LEX_DOUBLE] = LEX(A_DROP, S_DOUBLE),
+		[LEX_BACKSLASH] = LEX(A_DROP, S_ESCAPE),
+		[LEX_DOLLAR] = LEX(A_KEEP, S_WORD),
+		[LEX_NUL] = LEX(A_END, S_WORD),
+	},
+	[S_SINGLE] =
+	{
+		[LEX_OTHER] = LEX(A_KEEP, S_SINGLE),
+		[LEX_BREAK] = LEX(A_KEEP, S_SINGLE),
+		[LEX_NEWLINE] = LEX(A_KEEP, S_SINGLE),
+		[LEX_SINGLE] = LEX(A_DROP, S_WORD),
+		[LEX_DOUBLE] = LEX(A_KEEP, S_SINGLE),
+		[LEX_BACKSLASH] = LEX(A_KEEP, S_SINGLE),
+		[LEX_DOLLAR] = LEX(A_LITERAL, S_SINGLE),
+		[LEX_NUL] = LEX(A_MORE, S_SINGLE),
+	},
+	[S_DOUBLE] =
+	{
+		[LEX_OTHER] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_BREAK] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_NEWLINE] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_SINGLE] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_DOUBLE] = LEX(A_DROP, S_WORD),
+		[LEX_BACKSLASH] = LEX(A_DROP, S_DOUBLE_ESCAPE),
+		[LEX_DOLLAR] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_NUL] = LEX(A_MORE, S_DOUBLE),
+	},
+	[S_ESCAPE] =
+	{
+		[LEX_OTHER] = LEX(A_KEEP, S_WORD),
+		[LEX_BREAK] = LEX(A_KEEP, S_WORD),
+		[LEX_NEWLINE] = LEX(A_DROP, S_WORD),
+		[LEX_SINGLE] = LEX(A_KEEP, S_WORD),
+		[LEX_DOUBLE] = LEX(A_KEEP, S_WORD),
+		[LEX_BACKSLASH] = LEX(A_KEEP, S_WORD),
+		[LEX_DOLLAR] = LEX(A_LITERAL, S_WORD),
+		[LEX_NUL] = LEX(A_MORE, S_ESCAPE),
+	},
+	//inside double quotes a backslash only escapes " \ $ and newline
+	[S_DOUBLE_ESCAPE] =
+	{
+		[LEX_OTHER] = LEX(A_BACKSLASH, S_DOUBLE),
+		[LEX_BREAK] = LEX(A_BACKSLASH, S_DOUBLE),
+		[LEX_NEWLINE] = LEX(A_DROP, S_DOUBLE),
+		[LEX_SINGLE] = LEX(A_BACKSLASH, S_DOUBLE),
+		[LEX_DOUBLE] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_BACKSLASH] = LEX(A_KEEP, S_DOUBLE),
+		[LEX_DOLLAR] = LEX(A_LITERAL, S_DOUBLE),
+		[LEX_NUL] = LEX(A_MORE, S_DOUBLE_ESCAPE),
+	},
+};
+
+/**
+ * Moves the parser past any whitespace except newlines,
+ * which are command separators
+ * @param initialized input parser
+**/
+static void skip_blanks(INPUT_PARSER* parser)
+{
+	parser->position = skip_blanks_indexed(&parser->index, parser->position);
+}
 
-    parser->position = start;
+/**
+ * Reads the operator or separator at the parser position
+ * @param initialized input parser
+ * @return the operator from operator_text
+**/
+static char* lex_operator(INPUT_PARSER* parser)
+{
+	char* start = parser->position;
+	int offset;
 
-    char *end = start;
+	parser->position++;
 
-    // Check for delimiters and handle them as separate tokens
-    if (strchr("|&<>", *end) != NULL) 
-    {
-        end++;
-
-        //handle two delimiters in a row such as >>
-        if (*end == *start) 
-        { 
-            end++;
-        }
-    } 
-    else 
-    {
-        // Move to the next delimiter or whitespace
-        while (*end && !isspace((unsigned char)*end) && !strchr("|&<>", *end)) 
-        {
-            end++;
-        }
-    }
+	switch(*start)
+	{
+		case '|': offset = OPERATOR_PIPE; break;
+		case '&': offset = OPERATOR_BACKGROUND; break;
+		case '<': offset = OPERATOR_IN; break;
+		case '>': offset = OPERATOR_OUT; break;
 
-    int len = end - start;
+		//a newline is handed back as ";" so callers only check one
+		default: return operator_text + OPERATOR_SEPARATOR;
+	}
 
-    char *token = malloc(len + 1);
+	//handle two delimiters in a row such as >>,
+	//the fan-out pipe |> and |& which pipes stderr too
+	if(*parser->position == *start)
+	{
+		parser->position++;
+
+		switch(*start)
+		{
+			case '|': return operator_text + OPERATOR_OR;
+			case '&': return operator_text + OPERATOR_AND;
+			case '<': return operator_text + OPERATOR_HEREDOC;
+			default: return operator_text + OPERATOR_APPEND;
+		}
+	}
 
-    //null check for malloc error
-    if (token == NULL) 
-    {
-        perror("Failed to allocate memory for token");
-        return NULL;
-    }
+	if(*start == '|' && *parser->position == '>')
+	{
+		parser->position++;
+		return operator_text + OPERATOR_FANOUT;
+	}
 
-    //copy over our new token, null terminate, then set parser position
-    strncpy(token, start, len);
-    token[len] = '\0'; 
+	if(*start == '|' && *parser->position == '&')
+	{
+		parser->position++;
+		return operator_text + OPERATOR_PIPE_ERR;
+	}
 
-    parser->position = end; 
+	//<& and >& duplicate or close a descriptor
+	if((*start == '<' || *start == '>') && *parser->position == '&')
+	{
+		parser->position++;
+		return operator_text + (*start == '<' ? OPERATOR_DUP_IN : OPERATOR_DUP_OUT);
+	}
 
- 	//skip over any white space for the next call
-    while (isspace((unsigned char)*parser->position)) 
-    {
-        parser->position++;
-    }
+	return operator_text + offset;
+}
 
-    return token;
+/**
+ * @return the operator for op applied to descriptor fd, such as
+ * "2>" for 2 and ">", NULL if op isn't a redirection
+**/
+static char* fd_operator(int fd, char* op)
+{
+	char* block = operator_text + OPERATOR_FD_BASE + fd * FD_OPERATOR_SIZE;
 
+	for(char* text = block; text < block + FD_OPERATOR_SIZE; text += strlen(text) + 1)
+	{
+		if(strcmp(text + 1, op) == 0)
+		{
+			return text;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Lexes one word, dropping quotes and escapes. The word is
+ * terminated in place, and only the part after the first dropped
+ * character has to be moved down
+ * @param initialized input parser positioned on the word
+ * @param quoted set to 1 if the word had quotes, so "" still counts
+ * @return start of the word, NULL if the input ends inside quotes
+ * or after a backslash
+**/
+static char* lex_word(INPUT_PARSER* parser, int* quoted)
+{
+	char* start = parser->position;
+	char* in = start;
+	char* out = start;
+	int state = S_WORD;
+
+	*quoted = 0;
+
+	while(1)
+	{
+		//plain characters don't need the table, skip the whole run
+		if(state == S_WORD)
+		{
+			char* run_end = find_word_end(&parser->index, in);
+
+			if(out != in)
+			{
+				memmove(out, in, run_end - in);
+			}
+
+			out += run_end - in;
+			in = run_end;
+		}
+
+		unsigned char entry = lex_table[state][lex_class[(unsigned char) *in]];
+		state = entry & 7;
+
+		switch(entry >> 3)
+		{
+			case A_KEEP:
+				*out++ = *in++;
+				break;
+
+			case A_DROP:
+				*quoted |= state == S_SINGLE || state == S_DOUBLE;
+				in++;
+				break;
+
+			case A_LITERAL:
+				*out++ = LITERAL_DOLLAR;
+				in++;
+				break;
+
+			//there is room, the backslash before this character was dropped
+			case A_BACKSLASH:
+				*out++ = '\\';
+				*out++ = *in++;
+				break;
+
+			case A_MORE:
+				parser->incomplete = 1;
+				return NULL;
+
+			case A_END:
+				parser->position = in;
+
+				//the character after the word is consumed before it can be overwritten
+				if(char_class[(unsigned char) *in] & CLASS_BLANK)
+				{
+					parser->position++;
+				}
+				else if(*in != '\0')
+				{
+					parser->queued = lex_operator(parser);
+
+					//an unquoted digit touching a redirection is its descriptor
+					if(out - start == 1 && isdigit((unsigned char) *start) && !*quoted && (*in == '<' || *in == '>'))
+					{
+						char* op = fd_operator(*start - '0', parser->queued);
+
+						if(op != NULL)
+						{
+							parser->queued = NULL;
+							skip_blanks(parser);
+							return op;
+						}
+					}
+				}
+
+				*out = '\0';
+
+				return start;
+		}
+	}
+}
+
+/**
+ * Gets the next token from the input parser. Words point into the
+ * parser's copy of the input and operators into a static buffer,
+ * neither is freed by the caller
+ * @param initialized input parser
+ * @return parsed tokens, NULL at the end of input, if the input ends
+ * inside quotes (parser->incomplete is set) or if parser is NULL
+**/
+char* get_token(INPUT_PARSER* parser)
+{
+	if(parser == NULL)
+	{
+		perror("Parser that is passed in must be initialized");
+		return NULL;
+	}
+
+	while(1)
+	{
+		char* token = parser->queued;
+
+		if(token != NULL)
+		{
+			parser->queued = NULL;
+			skip_blanks(parser);
+			return token;
+		}
+
+		skip_blanks(parser);
+
+		if(*parser->position == '\0')
+		{
+			return NULL;
+		}
+
+		if(char_class[(unsigned char) *parser->position] & (CLASS_OPERATOR | CLASS_SEPARATOR | CLASS_NEWLINE))
+		{
+			token = lex_operator(parser);
+			skip_blanks(parser);
+			return token;
+		}
+
+		int quoted;
+
+		token = lex_word(parser, &quoted);
+
+		//a backslash newline on its own only continues the line
+		if(token == NULL || *token != '\0' || quoted)
+		{
+			return token;
+		}
+	}
 }
 
 /**
@@ -179,6 +531,7 @@ void free_input_parser(INPUT_PARSER* parser)
 		return;
 	}
 
+	free_scan_index(&parser->index);
 	free(parser->str);
 	free(parser);
 
@@ -186,15 +539,153 @@ void free_input_parser(INPUT_PARSER* parser)
 }
 
 /**
- * Function deallocates any remaining tokens after we have processed 
- * the commands
+ * Releases a token array from tokenize(), the tokens and their
+ * text are a single allocation
  * @param tokens array
 **/ 
 void free_tokens(char** tokens)
 {
-	for(int i = 0; tokens[i] != NULL; i++)
+	free(tokens);
+}
+
+/**
+ * Splits a whole input string into tokens using the input parser
+ * @param input string to tokenize
+ * @param count set to the number of tokens found
+ * @param incomplete set to 1 if the input ends inside quotes or
+ * after a backslash and needs another line, 0 otherwise
+ * @return NULL terminated token array, release it with free_tokens(),
+ * NULL if the parser could not be created or the input is incomplete
+**/
+char** tokenize(char* input, int* count, int* incomplete)
+{
+	*count = 0;
+	*incomplete = 0;
+
+	INPUT_PARSER* parser = init_input_parser(input);
+
+	if(parser == NULL)
+	{
+		return NULL;
+	}
+
+	int capacity = 16;
+
+	char** tokens = malloc(sizeof(char*) * capacity);
+
+	if(tokens == NULL)
+	{
+		perror("Failed to allocate memory for tokens");
+		exit(EXIT_FAILURE);
+	}
+
+	char* token = get_token(parser);
+
+	while(token != NULL)
+	{
+		//leave room for the NULL terminator
+		if(*count + 1 == capacity)
+		{
+			capacity *= 2;
+			tokens = realloc(tokens, sizeof(char*) * capacity);
+
+			if(tokens == NULL)
+			{
+				perror("Failed to grow token array");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		tokens[(*count)++] = token;
+		token = get_token(parser);
+	}
+
+	if(parser->incomplete)
+	{
+		*incomplete = 1;
+		*count = 0;
+		free(tokens);
+		free_input_parser(parser);
+		return NULL;
+	}
+
+	//pack the array and the lexed text together so one free releases both
+	size_t text_length = strlen(input) + 1;
+	size_t array_size = sizeof(char*) * (*count + 1);
+
+	char** packed = malloc(array_size + text_length);
+
+	if(packed == NULL)
+	{
+		perror("Failed to allocate memory for tokens");
+		exit(EXIT_FAILURE);
+	}
+
+	char* text = (char*) packed + array_size;
+
+	memcpy(text, parser->str, text_length);
+
+	for(int i = 0; i < *count; i++)
+	{
+		int in_text = tokens[i] >= parser->str && tokens[i] < parser->str + text_length;
+
+		packed[i] = in_text ? text + (tokens[i] - parser->str) : tokens[i];
+	}
+
+	packed[*count] = NULL;
+
+	free(tokens);
+	free_input_parser(parser);
+
+	return packed;
+}
+
+/**
+ * Copies part of a token array into a new one that owns its text,
+ * operators keep pointing at the static operator text
+ * @param tokens to copy
+ * @param count number of tokens
+ * @return NULL terminated token array, release it with free_tokens()
+**/
+char** copy_tokens(char** tokens, int count)
+{
+	size_t array_size = sizeof(char*) * (count + 1);
+	size_t text_length = 0;
+
+	for(int i = 0; i < count; i++)
+	{
+		if(!is_any_operator(tokens[i]))
+		{
+			text_length += strlen(tokens[i]) + 1;
+		}
+	}
+
+	char** copy = malloc(array_size + text_length);
+
+	if(copy == NULL)
+	{
+		perror("Failed to allocate memory for tokens");
+		exit(EXIT_FAILURE);
+	}
+
+	char* text = (char*) copy + array_size;
+
+	for(int i = 0; i < count; i++)
 	{
-		free(tokens[i]);
-		tokens[i] = NULL;
+		if(is_any_operator(tokens[i]))
+		{
+			copy[i] = tokens[i];
+			continue;
+		}
+
+		size_t length = strlen(tokens[i]) + 1;
+
+		memcpy(text, tokens[i], length);
+		copy[i] = text;
+		text += length;
 	}
-}
\ No newline at end of file
+
+	copy[count] = NULL;
+
+	return copy;
+}
@@ -1,10 +1,18 @@
 #ifndef INPUT_PARSER_H
 #define INPUT_PARSER_H
+#include "char_scan.h"
 
 typedef struct input_parser
 {
 	char* str;
 	char* position;
+	scan_index_t index;
+
+	//operator found right after a word, returned by the next call
+	char* queued;
+
+	//input ended inside quotes or after a backslash
+	int incomplete;
 
 }INPUT_PARSER;
 
@@ -16,6 +24,18 @@ char* get_token(INPUT_PARSER* parser);
 
 void free_input_parser(INPUT_PARSER* parser);
 
+int is_operator(const char* token, const char* op);
+
+int is_any_operator(const char* token);
+
+int operator_index(const char* token);
+
+char* operator_at(int index);
+
 void free_tokens(char** tokens);
 
+char** tokenize(char* input, int* count, int* incomplete);
+
+char** copy_tokens(char** tokens, int count);
+
 #endif 
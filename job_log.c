@@ -0,0 +1,528 @@
+#include "job_log.h"
+#include "launch_opts.h"
+#include "utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+extern int last_status;
+
+/**
+ * Sets up capturing as off, with the default per job capacity
+**/
+void init_job_log_config(job_log_config_t* config)
+{
+	config->enabled = 0;
+	config->capacity = JOB_LOG_DEFAULT_SIZE;
+	config->spill_dir = NULL;
+}
+
+/**
+ * Creates the pipe a background job writes its output into, both ends
+ * are close-on-exec and only the shell's read end is non-blocking
+ * @param fds set to the read and write ends
+ * @return 0 if the job should be captured, -1 if capturing is off
+**/
+int open_job_log_pipe(job_log_config_t* config, int fds[2])
+{
+	if(!config->enabled)
+	{
+		return -1;
+	}
+
+	if(pipe2(fds, O_CLOEXEC) == -1)
+	{
+		perror("Could not create job log pipe");
+		return -1;
+	}
+
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+
+	set_pipe_size(fds[1], JOB_LOG_PIPE_SIZE);
+
+	return 0;
+}
+
+/**
+ * Runs in the child, points stdout and stderr at the capture pipe,
+ * redirections and pipeline pipes are set up afterwards and win
+ * @param write_fd write end from open_job_log_pipe(), -1 does nothing
+**/
+void attach_job_log(int write_fd)
+{
+	if(write_fd == -1)
+	{
+		return;
+	}
+
+	if(dup2(write_fd, STDOUT_FILENO) == -1 || dup2(write_fd, STDERR_FILENO) == -1)
+	{
+		perror("Cannot capture job output");
+		exit(EXIT_FAILURE);
+	}
+
+	close(write_fd);
+}
+
+/**
+ * Makes the log for a job that was just started
+ * @param read_fd read end of the job's capture pipe, owned by the log
+ * @param pid first process of the job, names the spill file
+ * @return the log, memory for the ring is only taken as output arrives
+**/
+job_log_t* new_job_log(job_log_config_t* config, int read_fd, pid_t pid)
+{
+	job_log_t* log = malloc(sizeof(job_log_t));
+
+	if(log == NULL)
+	{
+		perror("Could not allocate memory for job log");
+		exit(EXIT_FAILURE);
+	}
+
+	log->fd = read_fd;
+	log->ring = NULL;
+	log->size = 0;
+	log->capacity = config->capacity;
+	log->head = 0;
+	log->spill_path = NULL;
+	log->spill_fd = -1;
+
+	if(config->spill_dir != NULL)
+	{
+		int length = snprintf(NULL, 0, "%s/cshell-%d-%d.log", config->spill_dir, getpid(), pid);
+
+		log->spill_path = malloc(length + 1);
+
+		if(log->spill_path == NULL)
+		{
+			perror("Could not allocate memory for job log");
+			exit(EXIT_FAILURE);
+		}
+
+		sprintf(log->spill_path, "%s/cshell-%d-%d.log", config->spill_dir, getpid(), pid);
+	}
+
+	return log;
+}
+
+/**
+ * Frees a job's log, a spill file is left behind for the user
+**/
+void free_job_log(job_log_t* log)
+{
+	if(log == NULL)
+	{
+		return;
+	}
+
+	if(log->fd != -1)
+	{
+		close(log->fd);
+	}
+
+	if(log->spill_fd != -1)
+	{
+		close(log->spill_fd);
+	}
+
+	free(log->spill_path);
+	free(log->ring);
+	free(log);
+}
+
+/**
+ * Writes the captured bytes numbered from up to to, which must still be in the ring
+**/
+static void write_ring(job_log_t* log, int fd, uint64_t from, uint64_t to)
+{
+	while(from < to)
+	{
+		size_t offset = from % log->size;
+		size_t length = log->size - offset;
+
+		if(length > to - from)
+		{
+			length = to - from;
+		}
+
+		write_all(fd, log->ring + offset, length);
+		from += length;
+	}
+}
+
+/**
+ * Opens the spill file the first time the ring is about to overwrite output
+ * @return 1 if overwritten output can be spilled, 0 if it is dropped
+**/
+static int open_spill(job_log_t* log)
+{
+	if(log->spill_fd == -1 && log->spill_path != NULL)
+	{
+		log->spill_fd = open(log->spill_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+		if(log->spill_fd == -1)
+		{
+			perror(log->spill_path);
+			free(log->spill_path);
+			log->spill_path = NULL;
+		}
+	}
+
+	return log->spill_fd != -1;
+}
+
+/**
+ * Adds output to the ring, growing it until it reaches capacity,
+ * once it is full the oldest bytes are spilled or dropped
+**/
+static void job_log_append(job_log_t* log, char* data, size_t length)
+{
+	//until the ring first fills the output sits at the front in order,
+	//so a plain realloc keeps it intact
+	if(log->head + length > log->size && log->size < log->capacity)
+	{
+		size_t size = log->size == 0 ? 16384 : log->size * 2;
+
+		if(size < log->head + length)
+		{
+			size = log->head + length;
+		}
+
+		if(size > log->capacity)
+		{
+			size = log->capacity;
+		}
+
+		char* ring = realloc(log->ring, size);
+
+		if(ring == NULL)
+		{
+			perror("Could not grow job log");
+			exit(EXIT_FAILURE);
+		}
+
+		log->ring = ring;
+		log->size = size;
+	}
+
+	uint64_t oldest = log->head > log->size ? log->head - log->size : 0;
+	uint64_t end = log->head + length;
+	uint64_t new_oldest = end > log->size ? end - log->size : 0;
+
+	if(new_oldest > oldest && open_spill(log))
+	{
+		write_ring(log, log->spill_fd, oldest, new_oldest < log->head ? new_oldest : log->head);
+
+		if(new_oldest > log->head)
+		{
+			write_all(log->spill_fd, data, new_oldest - log->head);
+		}
+	}
+
+	//only the tail of a chunk bigger than the ring survives
+	if(length > log->size)
+	{
+		data += length - log->size;
+		log->head += length - log->size;
+		length = log->size;
+	}
+
+	while(length > 0)
+	{
+		size_t offset = log->head % log->size;
+		size_t chunk = log->size - offset;
+
+		if(chunk > length)
+		{
+			chunk = length;
+		}
+
+		memcpy(log->ring + offset, data, chunk);
+		data += chunk;
+		length -= chunk;
+		log->head += chunk;
+	}
+}
+
+/**
+ * Reads whatever a job has written so far without blocking
+**/
+static void drain_job_log(job_log_t* log)
+{
+	char buffer[65536];
+
+	while(log->fd != -1)
+	{
+		ssize_t bytes_read = read(log->fd, buffer, sizeof(buffer));
+
+		if(bytes_read > 0)
+		{
+			job_log_append(log, buffer, bytes_read);
+			continue;
+		}
+
+		if(bytes_read < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(bytes_read < 0 && errno == EAGAIN)
+		{
+			return;
+		}
+
+		//end of output, every process of the job closed the pipe
+		close(log->fd);
+		log->fd = -1;
+	}
+}
+
+/**
+ * Drains the capture pipe of every job in the table
+**/
+void drain_job_logs(bg_proc_manager_t* bg_proc_manager)
+{
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		if(job != NULL && job->log != NULL)
+		{
+			drain_job_log(job->log);
+		}
+	}
+}
+
+/**
+ * Fills in one pollfd per capture pipe that is still open
+ * @param fds room for MAX_BG_PROC entries
+ * @return number of entries filled in
+**/
+int job_log_pollfds(bg_proc_manager_t* bg_proc_manager, struct pollfd* fds)
+{
+	int count = 0;
+
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		if(job != NULL && job->log != NULL && job->log->fd != -1)
+		{
+			fds[count].fd = job->log->fd;
+			fds[count].events = POLLIN;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+/**
+ * The shell's idle loop, keeps draining job output until fd has
+ * input. With set -b finished jobs are reported as they come, SIGCHLD
+ * is only let through inside ppoll() so none is missed between the
+ * check and the wait, and they are printed at most every
+ * NOTIFY_INTERVAL_NS. Returns right away when there is nothing to do
+ * @param fd the descriptor the shell is about to read
+**/
+void wait_for_input(int fd, bg_proc_manager_t* bg_proc_manager, notify_queue_t* queue)
+{
+	struct pollfd fds[MAX_BG_PROC + 1];
+	sigset_t prev_mask;
+
+	block_sig_chld(&prev_mask);
+
+	while(1)
+	{
+		struct timespec delay;
+		struct timespec* timeout = NULL;
+
+		//notices that came too soon after the last ones wait out the interval
+		if(queue->immediate && has_job_notices(queue))
+		{
+			if(job_notices_due(queue, &delay))
+			{
+				printf("\n");
+				print_job_notices(queue, bg_proc_manager);
+				print_prompt();
+			}
+			else
+			{
+				timeout = &delay;
+			}
+		}
+
+		int count = job_log_pollfds(bg_proc_manager, fds + 1);
+
+		if(count == 0 && !queue->immediate)
+		{
+			break;
+		}
+
+		fds[0].fd = fd;
+		fds[0].events = POLLIN;
+
+		if(ppoll(fds, count + 1, timeout, &prev_mask) < 0)
+		{
+			if(errno != EINTR)
+			{
+				break;
+			}
+
+			fds[0].revents = 0;
+		}
+
+		drain_job_logs(bg_proc_manager);
+
+		if(fds[0].revents != 0)
+		{
+			break;
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+}
+
+/**
+ * Writes everything captured for a job to stdout, starting
+ * with its spill file if the ring has wrapped
+**/
+void print_job_log(process_t* job, bg_proc_manager_t* bg_proc_manager)
+{
+	job_log_t* log = job->log;
+
+	drain_job_logs(bg_proc_manager);
+	fflush(stdout);
+
+	uint64_t oldest = log->head > log->size ? log->head - log->size : 0;
+
+	if(oldest > 0 && log->spill_fd != -1)
+	{
+		int spill = open(log->spill_path, O_RDONLY | O_CLOEXEC);
+		char buffer[65536];
+		ssize_t bytes_read;
+
+		if(spill == -1)
+		{
+			perror(log->spill_path);
+		}
+
+		while(spill != -1 && (bytes_read = read(spill, buffer, sizeof(buffer))) > 0)
+		{
+			write_all(STDOUT_FILENO, buffer, bytes_read);
+		}
+
+		if(spill != -1)
+		{
+			close(spill);
+		}
+	}
+	else if(oldest > 0)
+	{
+		fprintf(stderr, "[%llu bytes dropped]\n", (unsigned long long) oldest);
+	}
+
+	if(log->size > 0)
+	{
+		write_ring(log, STDOUT_FILENO, oldest, log->head);
+	}
+}
+
+/**
+ * The "joblog" builtin
+ * joblog               shows the capture settings
+ * joblog on [SIZE]     captures later background jobs, SIZE bytes per job
+ * joblog off           stops capturing later jobs
+ * joblog spill DIR     overwritten output goes to DIR/cshell-SHELLPID-PID.log
+ * joblog spill off     overwritten output is dropped
+ * joblog JOB           prints what a %N, N or pid job has written
+**/
+void joblog_builtin(char** tokens, job_log_config_t* config, bg_proc_manager_t* bg_proc_manager)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		if(!config->enabled)
+		{
+			printf("joblog: off\n");
+		}
+		else
+		{
+			printf("joblog: on, %zu bytes per job, %s%s\n", config->capacity,
+				config->spill_dir ? "spilling to " : "oldest output dropped",
+				config->spill_dir ? config->spill_dir : "");
+		}
+	}
+
+	else if(strcmp(tokens[1], "on") == 0)
+	{
+		long size = tokens[2] != NULL ? parse_size(tokens[2]) : (long) config->capacity;
+
+		if(size < JOB_LOG_MIN_SIZE)
+		{
+			fprintf(stderr, "joblog: size must be at least %d bytes\n", JOB_LOG_MIN_SIZE);
+			last_status = 2;
+			return;
+		}
+
+		config->enabled = 1;
+		config->capacity = size;
+	}
+
+	else if(strcmp(tokens[1], "off") == 0)
+	{
+		config->enabled = 0;
+	}
+
+	else if(strcmp(tokens[1], "spill") == 0 && tokens[2] == NULL)
+	{
+		fprintf(stderr, "usage: joblog spill DIR | joblog spill off\n");
+		last_status = 2;
+		return;
+	}
+
+	else if(strcmp(tokens[1], "spill") == 0)
+	{
+		free(config->spill_dir);
+		config->spill_dir = NULL;
+
+		if(strcmp(tokens[2], "off") != 0)
+		{
+			if(access(tokens[2], W_OK) == -1)
+			{
+				perror(tokens[2]);
+				last_status = 1;
+				return;
+			}
+
+			config->spill_dir = strdup(tokens[2]);
+		}
+	}
+
+	else
+	{
+		process_t* job = find_job(tokens[1], bg_proc_manager);
+
+		if(job == NULL)
+		{
+			fprintf(stderr, "joblog: no such job: %s\n", tokens[1]);
+			last_status = 1;
+		}
+		else if(job->log == NULL)
+		{
+			fprintf(stderr, "joblog: output of %s was not captured\n", tokens[1]);
+			last_status = 1;
+		}
+		else
+		{
+			print_job_log(job, bg_proc_manager);
+		}
+	}
+
+	fflush(stdout);
+}
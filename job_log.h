@@ -0,0 +1,70 @@
+#ifndef JOB_LOG_H
+#define JOB_LOG_H
+#include "shell.h"
+#include "notify.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <poll.h>
+
+#define JOB_LOG_DEFAULT_SIZE (1 << 20)
+#define JOB_LOG_MIN_SIZE 4096
+
+//the capture pipe absorbs this much while the shell is busy elsewhere
+#define JOB_LOG_PIPE_SIZE (256 * 1024)
+
+/**
+ * Settings for capturing background jobs, changed with the joblog builtin
+**/
+typedef struct job_log_config_t
+{
+	int enabled;
+	size_t capacity;
+
+	//NULL drops the oldest output once a ring wraps
+	char* spill_dir;
+
+}job_log_config_t;
+
+/**
+ * Captured stdout and stderr of one background job, the ring only
+ * grows until it reaches its capacity and then wraps
+**/
+typedef struct job_log_t
+{
+	//read end of the capture pipe, -1 once every writer is gone
+	int fd;
+
+	char* ring;
+	size_t size;
+	size_t capacity;
+
+	//bytes captured so far, the ring holds the last size of them
+	uint64_t head;
+
+	//overwritten output is appended here when spilling is on
+	char* spill_path;
+	int spill_fd;
+
+}job_log_t;
+
+void init_job_log_config(job_log_config_t* config);
+
+int open_job_log_pipe(job_log_config_t* config, int fds[2]);
+
+void attach_job_log(int write_fd);
+
+job_log_t* new_job_log(job_log_config_t* config, int read_fd, pid_t pid);
+
+void free_job_log(job_log_t* log);
+
+void drain_job_logs(bg_proc_manager_t* bg_proc_manager);
+
+int job_log_pollfds(bg_proc_manager_t* bg_proc_manager, struct pollfd* fds);
+
+void wait_for_input(int fd, bg_proc_manager_t* bg_proc_manager, notify_queue_t* queue);
+
+void print_job_log(process_t* job, bg_proc_manager_t* bg_proc_manager);
+
+void joblog_builtin(char** tokens, job_log_config_t* config, bg_proc_manager_t* bg_proc_manager);
+
+#endif
@@ -0,0 +1,502 @@
+#include "job_wait.h"
+#include "stats.h"
+#include "job_log.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sys/timerfd.h>
+
+extern int last_status;
+extern volatile sig_atomic_t interrupted;
+
+/**
+ * Opens a pidfd, it turns readable once the process exits
+ * @return the descriptor, -1 if the process is already gone
+**/
+int open_pidfd(pid_t pid)
+{
+	return syscall(SYS_pidfd_open, pid, 0);
+}
+
+/**
+ * Finds a job that finished, or checks they all did
+ * @param wait_any 1 to look for any finished job, 0 for all of them
+ * @return a finished job when wait_any is set, otherwise the last
+ * job once all of them are done, NULL if still waiting
+**/
+static process_t* check_jobs(process_t** jobs, int job_count, int wait_any)
+{
+	for(int i = 0; i < job_count; i++)
+	{
+		if(wait_any && jobs[i]->done)
+		{
+			return jobs[i];
+		}
+
+		if(!wait_any && !jobs[i]->done)
+		{
+			return NULL;
+		}
+	}
+
+	return wait_any || job_count == 0 ? NULL : jobs[job_count-1];
+}
+
+/**
+ * Waits for jobs with a single poll() over one pidfd per process,
+ * a pidfd turns readable when its process exits and the process is
+ * then reaped here. SIGCHLD stays blocked so the handler can't reap
+ * anything first, statuses the handler already collected are kept in
+ * the job table so jobs that are already done return right away
+ * @param jobs to wait for
+ * @param job_count number of jobs
+ * @param wait_any return as soon as any one job is done
+ * @param timeout_ms give up after this long, -1 waits forever
+ * @param finished set to the job that finished for wait_any, may be NULL
+ * @return WAIT_DONE, WAIT_TIMEOUT or WAIT_INTERRUPTED by Ctrl-C
+**/
+int wait_for_jobs(bg_proc_manager_t* bg_proc_manager, process_t** jobs, int job_count, int wait_any, int timeout_ms, process_t** finished)
+{
+	sigset_t prev_mask;
+	int fd_count = 0;
+	int unwatched = 0;
+	int result = WAIT_DONE;
+	int capacity = job_count * MAX_JOB_PROCS;
+
+	//pidfds come first, captured job output is polled after them
+	struct pollfd* fds = malloc(sizeof(struct pollfd) * (capacity + MAX_BG_PROC + 1));
+	pid_t* fd_pids = malloc(sizeof(pid_t) * (capacity + 1));
+
+	if(fds == NULL || fd_pids == NULL)
+	{
+		perror("Could not allocate memory for wait");
+		exit(EXIT_FAILURE);
+	}
+
+	block_sig_chld(&prev_mask);
+
+	for(int i = 0; i < job_count; i++)
+	{
+		for(int j = 0; j < jobs[i]->pid_count; j++)
+		{
+			if(jobs[i]->reaped[j])
+			{
+				continue;
+			}
+
+			pid_t pid = jobs[i]->pids[j];
+			int pidfd = open_pidfd(pid);
+
+			if(pidfd == -1)
+			{
+				//already gone without us seeing it, count it as reaped,
+				//out of descriptors it is left to the periodic reap below
+				if(errno == ESRCH)
+				{
+					reap_bg_proc(pid, 0, bg_proc_manager);
+				}
+				else
+				{
+					unwatched++;
+				}
+				continue;
+			}
+
+			fds[fd_count].fd = pidfd;
+			fds[fd_count].events = POLLIN;
+			fd_pids[fd_count] = pid;
+			fd_count++;
+		}
+	}
+
+	uint64_t deadline = timeout_ms < 0 ? 0 : now_ns() + (uint64_t) timeout_ms * 1000000ULL;
+	process_t* done_job;
+
+	while((done_job = check_jobs(jobs, job_count, wait_any)) == NULL && (fd_count > 0 || unwatched > 0))
+	{
+		int poll_timeout = -1;
+
+		if(timeout_ms >= 0)
+		{
+			uint64_t now = now_ns();
+			poll_timeout = now >= deadline ? 0 : (int) ((deadline - now + 999999) / 1000000);
+		}
+
+		if(unwatched > 0 && (poll_timeout < 0 || poll_timeout > UNWATCHED_POLL_MS))
+		{
+			poll_timeout = UNWATCHED_POLL_MS;
+		}
+
+		int log_count = job_log_pollfds(bg_proc_manager, fds + fd_count);
+
+		int ready = poll(fds, fd_count + log_count, poll_timeout);
+
+		if(ready < 0)
+		{
+			if(errno == EINTR && !interrupted)
+			{
+				continue;
+			}
+
+			result = WAIT_INTERRUPTED;
+			break;
+		}
+
+		if(ready == 0 && (unwatched == 0 || (timeout_ms >= 0 && now_ns() >= deadline)))
+		{
+			result = WAIT_TIMEOUT;
+			break;
+		}
+
+		if(log_count > 0)
+		{
+			drain_job_logs(bg_proc_manager);
+		}
+
+		//collect everything that exited in one batch, a readable pidfd
+		//then belongs to a process that was just reaped
+		reap_children();
+
+		int kept = 0;
+
+		for(int i = 0; i < fd_count; i++)
+		{
+			if(fds[i].revents != 0)
+			{
+				close(fds[i].fd);
+				continue;
+			}
+
+			fds[kept] = fds[i];
+			fd_pids[kept] = fd_pids[i];
+			kept++;
+		}
+
+		fd_count = kept;
+	}
+
+	for(int i = 0; i < fd_count; i++)
+	{
+		close(fds[i].fd);
+	}
+
+	free(fds);
+	free(fd_pids);
+
+	sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+
+	if(finished != NULL)
+	{
+		*finished = done_job;
+	}
+
+	return result;
+}
+
+/**
+ * The "wait" builtin
+ * wait              waits for every job, status 0
+ * wait JOB...       waits for each %N, N or pid, status of the last one
+ * wait -n [JOB...]  waits for the first job to finish, its status
+ * wait -t SECS      gives up after SECS with status 124
+ * Collected jobs are removed from the job table
+**/
+void wait_builtin(char** tokens, bg_proc_manager_t* bg_proc_manager)
+{
+	int wait_any = 0;
+	int timeout_ms = -1;
+	int job_count = 0;
+	int i = 1;
+	process_t* jobs[MAX_BG_PROC];
+
+	for(; tokens[i] != NULL && tokens[i][0] == '-'; i++)
+	{
+		if(strcmp(tokens[i], "-n") == 0)
+		{
+			wait_any = 1;
+		}
+		else if(strcmp(tokens[i], "-t") == 0 && tokens[i+1] != NULL)
+		{
+			char* end;
+			double seconds = strtod(tokens[++i], &end);
+
+			if(*end != '\0' || seconds < 0)
+			{
+				fprintf(stderr, "wait: invalid timeout %s\n", tokens[i]);
+				last_status = 2;
+				return;
+			}
+			timeout_ms = (int) (seconds * 1000);
+		}
+		else
+		{
+			fprintf(stderr, "usage: wait [-n] [-t SECS] [%%N | pid ...]\n");
+			last_status = 2;
+			return;
+		}
+	}
+
+	int explicit_jobs = tokens[i] != NULL;
+
+	//status of the last job named if it was already reported, -1 otherwise
+	int reported_status = -1;
+
+	for(; tokens[i] != NULL; i++)
+	{
+		process_t* job = find_job(tokens[i], bg_proc_manager);
+
+		if(job == NULL)
+		{
+			reported_status = collect_finished_job(tokens[i], bg_proc_manager);
+
+			if(reported_status == -1)
+			{
+				fprintf(stderr, "wait: %s: no such job\n", tokens[i]);
+				last_status = 127;
+				return;
+			}
+
+			//it is done already, which is all wait -n asks for
+			if(wait_any)
+			{
+				last_status = reported_status;
+				return;
+			}
+			continue;
+		}
+
+		reported_status = -1;
+
+		int duplicate = 0;
+
+		for(int j = 0; j < job_count; j++)
+		{
+			duplicate |= jobs[j] == job;
+		}
+
+		if(!duplicate && job_count < MAX_BG_PROC)
+		{
+			jobs[job_count++] = job;
+		}
+	}
+
+	if(!explicit_jobs)
+	{
+		for(int j = 0; j < MAX_BG_PROC; j++)
+		{
+			if(bg_proc_manager->bg_processes[j] != NULL)
+			{
+				jobs[job_count++] = bg_proc_manager->bg_processes[j];
+			}
+		}
+	}
+
+	if(job_count == 0)
+	{
+		last_status = reported_status != -1 ? reported_status : (wait_any ? 127 : 0);
+		return;
+	}
+
+	process_t* finished;
+
+	int result = wait_for_jobs(bg_proc_manager, jobs, job_count, wait_any, timeout_ms, &finished);
+
+	if(result == WAIT_TIMEOUT)
+	{
+		last_status = WAIT_TIMEOUT_STATUS;
+		return;
+	}
+
+	if(result == WAIT_INTERRUPTED)
+	{
+		last_status = 130;
+		return;
+	}
+
+	if(wait_any)
+	{
+		last_status = finished->status;
+		free_bg_job(finished, bg_proc_manager);
+		return;
+	}
+
+	if(!explicit_jobs)
+	{
+		last_status = 0;
+	}
+	else
+	{
+		last_status = reported_status != -1 ? reported_status : jobs[job_count-1]->status;
+	}
+
+	for(int j = 0; j < job_count; j++)
+	{
+		free_bg_job(jobs[j], bg_proc_manager);
+	}
+}
+
+/**
+ * Arms a one shot timerfd
+ * @param ns how long from now
+**/
+static void arm_timer(int timer_fd, uint64_t ns)
+{
+	struct itimerspec spec;
+
+	memset(&spec, 0, sizeof(spec));
+	spec.it_value.tv_sec = ns / 1000000000ULL;
+	spec.it_value.tv_nsec = ns % 1000000000ULL;
+
+	//a zero it_value would disarm the timer instead of firing now
+	if(ns == 0)
+	{
+		spec.it_value.tv_nsec = 1;
+	}
+
+	if(timerfd_settime(timer_fd, 0, &spec, NULL) == -1)
+	{
+		perror("Could not arm timeout");
+	}
+}
+
+/**
+ * Sends a signal to every process of a job that is still running
+**/
+static void signal_unreaped(pid_t* pids, int* statuses, int pid_count, int sig)
+{
+	for(int i = 0; i < pid_count; i++)
+	{
+		if(statuses[i] == -1)
+		{
+			kill(pids[i], sig);
+		}
+	}
+}
+
+/**
+ * Waits for every process of a foreground job, called with SIGCHLD
+ * blocked. Without a deadline this is a plain waitpid() per process.
+ * With "timeout" a timerfd is polled together with one pidfd per
+ * process, when it fires the whole job gets SIGTERM and, if a kill
+ * after was given, SIGKILL once that runs out as well
+ * @param pids processes of the job
+ * @param pid_count number of processes
+ * @param statuses filled with each waitpid() status
+ * @param reaped_times filled with when each process was reaped
+ * @param opts launch modifiers holding the deadline
+ * @return 1 if the deadline passed, 0 otherwise
+**/
+int wait_foreground(pid_t* pids, int pid_count, int* statuses, uint64_t* reaped_times, launch_opts_t* opts)
+{
+	if(opts->timeout_ns == 0)
+	{
+		for(int i = 0; i < pid_count; i++)
+		{
+			waitpid(pids[i], &statuses[i], 0);
+			reaped_times[i] = now_ns();
+		}
+		return 0;
+	}
+
+	struct pollfd fds[pid_count + 1];
+	int running = pid_count;
+	int timed_out = 0;
+
+	fds[pid_count].fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	fds[pid_count].events = POLLIN;
+
+	if(fds[pid_count].fd == -1)
+	{
+		perror("Could not create timeout timer");
+	}
+	else
+	{
+		arm_timer(fds[pid_count].fd, opts->timeout_ns);
+	}
+
+	for(int i = 0; i < pid_count; i++)
+	{
+		statuses[i] = -1;
+		fds[i].fd = open_pidfd(pids[i]);
+		fds[i].events = POLLIN;
+	}
+
+	while(running > 0)
+	{
+		if(poll(fds, pid_count + 1, -1) < 0)
+		{
+			//Ctrl-C reaches the job through the terminal, keep waiting
+			continue;
+		}
+
+		if(fds[pid_count].revents & POLLIN)
+		{
+			uint64_t expirations;
+
+			read(fds[pid_count].fd, &expirations, sizeof(expirations));
+
+			if(!timed_out)
+			{
+				timed_out = 1;
+				signal_unreaped(pids, statuses, pid_count, SIGTERM);
+
+				if(opts->kill_after_ns != 0)
+				{
+					arm_timer(fds[pid_count].fd, opts->kill_after_ns);
+				}
+			}
+			else
+			{
+				signal_unreaped(pids, statuses, pid_count, SIGKILL);
+			}
+		}
+
+		for(int i = 0; i < pid_count; i++)
+		{
+			//a process without a pidfd is just waited on directly
+			if(statuses[i] != -1 || (fds[i].fd != -1 && fds[i].revents == 0))
+			{
+				continue;
+			}
+
+			pid_t reaped = waitpid(pids[i], &statuses[i], fds[i].fd == -1 ? 0 : WNOHANG);
+
+			if(reaped == -1 && errno == ECHILD)
+			{
+				statuses[i] = 0;
+			}
+
+			if(reaped != 0)
+			{
+				reaped_times[i] = now_ns();
+				running--;
+
+				if(fds[i].fd != -1)
+				{
+					close(fds[i].fd);
+				}
+
+				//poll() skips negative descriptors
+				fds[i].fd = -1;
+				fds[i].events = 0;
+			}
+			else
+			{
+				statuses[i] = -1;
+			}
+		}
+	}
+
+	if(fds[pid_count].fd != -1)
+	{
+		close(fds[pid_count].fd);
+	}
+
+	return timed_out;
+}
@@ -0,0 +1,25 @@
+#ifndef JOB_WAIT_H
+#define JOB_WAIT_H
+#include "shell.h"
+#include "launch_opts.h"
+#include <stdint.h>
+
+#define WAIT_DONE 0
+#define WAIT_TIMEOUT 1
+#define WAIT_INTERRUPTED 2
+
+//exit status of wait -t when the deadline passes, same as timeout(1)
+#define WAIT_TIMEOUT_STATUS 124
+
+//how often wait reaps processes it could not open a pidfd for
+#define UNWATCHED_POLL_MS 10
+
+int open_pidfd(pid_t pid);
+
+int wait_for_jobs(bg_proc_manager_t* bg_proc_manager, process_t** jobs, int job_count, int wait_any, int timeout_ms, process_t** finished);
+
+void wait_builtin(char** tokens, bg_proc_manager_t* bg_proc_manager);
+
+int wait_foreground(pid_t* pids, int pid_count, int* statuses, uint64_t* reaped_times, launch_opts_t* opts);
+
+#endif
@@ -0,0 +1,639 @@
+#include "launch_opts.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+
+typedef struct ulimit_flag_t
+{
+	char flag;
+	int resource;
+	int scale;
+	char* description;
+
+}ulimit_flag_t;
+
+//sizes are given in KB like the ulimit builtin of other shells
+static ulimit_flag_t ulimit_flags[] = {
+	{'c', RLIMIT_CORE, 1024, "core file size (KB)"},
+	{'f', RLIMIT_FSIZE, 1024, "file size (KB)"},
+	{'n', RLIMIT_NOFILE, 1, "open files"},
+	{'s', RLIMIT_STACK, 1024, "stack size (KB)"},
+	{'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+	{'u', RLIMIT_NPROC, 1, "max user processes"},
+	{'v', RLIMIT_AS, 1024, "virtual memory (KB)"},
+	{'\0', 0, 0, NULL}
+};
+
+/**
+ * Sets up an empty set of modifiers
+**/
+void init_launch_opts(launch_opts_t* opts)
+{
+	opts->has_affinity = 0;
+	opts->spread = 0;
+	CPU_ZERO(&opts->cpus);
+	opts->has_nice = 0;
+	opts->nice = 0;
+	opts->limit_count = 0;
+	opts->has_pipe_size = 0;
+	opts->pipe_size = 0;
+	opts->has_timeout = 0;
+	opts->timeout_ns = 0;
+	opts->kill_after_ns = 0;
+}
+
+/**
+ * @return 1 if the token starts a launch modifier
+**/
+int is_launch_modifier(char* token)
+{
+	return strcmp(token, "affinity") == 0 || strcmp(token, "nice") == 0 || strcmp(token, "ulimit") == 0 || strcmp(token, "pipesize") == 0 || strcmp(token, "timeout") == 0;
+}
+
+/**
+ * @return 1 if the child has to apply any of opts itself between
+ * fork and exec, a timeout is enforced by the shell instead
+**/
+int launch_opts_in_child(launch_opts_t* opts)
+{
+	return opts->has_affinity || opts->has_nice || opts->limit_count > 0;
+}
+
+/**
+ * Parses a cpu list such as 0-3,6,8-9
+ * @return 0 on success, -1 if the list is malformed
+**/
+static int parse_cpu_list(char* list, cpu_set_t* cpus)
+{
+	CPU_ZERO(cpus);
+
+	char* pos = list;
+
+	while(*pos)
+	{
+		char* end;
+		long first = strtol(pos, &end, 10);
+		long last = first;
+
+		if(end == pos || first < 0)
+		{
+			return -1;
+		}
+
+		if(*end == '-')
+		{
+			pos = end + 1;
+			last = strtol(pos, &end, 10);
+
+			if(end == pos || last < first)
+			{
+				return -1;
+			}
+		}
+
+		if(last >= CPU_SETSIZE)
+		{
+			return -1;
+		}
+
+		for(long cpu = first; cpu <= last; cpu++)
+		{
+			CPU_SET(cpu, cpus);
+		}
+
+		if(*end == ',')
+		{
+			end++;
+		}
+		else if(*end != '\0')
+		{
+			return -1;
+		}
+
+		pos = end;
+	}
+
+	return CPU_COUNT(cpus) > 0 ? 0 : -1;
+}
+
+static int is_number(char* token)
+{
+	if(*token == '-' || *token == '+')
+	{
+		token++;
+	}
+
+	if(*token == '\0')
+	{
+		return 0;
+	}
+
+	for(; *token; token++)
+	{
+		if(!isdigit((unsigned char) *token))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Parses a byte count with an optional K, M or G suffix
+ * @return the size, -1 if malformed or too large for a long
+**/
+long parse_size(char* token)
+{
+	char* end;
+	int shift = 0;
+	long size = strtol(token, &end, 10);
+
+	if(end == token || size < 0)
+	{
+		return -1;
+	}
+
+	switch(*end)
+	{
+		case 'k': case 'K': shift = 10; end++; break;
+		case 'm': case 'M': shift = 20; end++; break;
+		case 'g': case 'G': shift = 30; end++; break;
+	}
+
+	//shifting a value this large would overflow
+	if(*end != '\0' || size > LONG_MAX >> shift)
+	{
+		return -1;
+	}
+
+	return size << shift;
+}
+
+/**
+ * Parses a duration like timeout(1) does, a number of seconds
+ * that may have a fraction and an s, m, h or d suffix
+ * @return the duration in nanoseconds, -1 if malformed
+**/
+static int64_t parse_duration(char* token)
+{
+	char* end;
+	double seconds = strtod(token, &end);
+
+	if(end == token || seconds < 0)
+	{
+		return -1;
+	}
+
+	switch(*end)
+	{
+		case 's': end++; break;
+		case 'm': seconds *= 60; end++; break;
+		case 'h': seconds *= 3600; end++; break;
+		case 'd': seconds *= 86400; end++; break;
+	}
+
+	return *end == '\0' ? (int64_t) (seconds * 1e9) : -1;
+}
+
+/**
+ * Adds or replaces a resource limit
+**/
+static void set_limit(launch_opts_t* opts, int resource, rlim_t value)
+{
+	for(int i = 0; i < opts->limit_count; i++)
+	{
+		if(opts->limits[i].resource == resource)
+		{
+			opts->limits[i].value = value;
+			return;
+		}
+	}
+
+	if(opts->limit_count < MAX_LAUNCH_LIMITS)
+	{
+		opts->limits[opts->limit_count].resource = resource;
+		opts->limits[opts->limit_count].value = value;
+		opts->limit_count++;
+	}
+}
+
+/**
+ * Parses the modifiers at the front of a command:
+ * affinity [-p] CPULIST, nice [-n] N, ulimit -v|-n|-t|... VALUE,
+ * pipesize SIZE, timeout [-k KILL_AFTER] DURATION [-k KILL_AFTER]
+ * -p spreads a pipeline over the list, one cpu per stage
+ * @param tokens command tokens
+ * @param token_count number of tokens
+ * @param opts filled with what was parsed
+ * @return number of tokens used by modifiers, -1 on a bad modifier
+**/
+int parse_launch_opts(char** tokens, int token_count, launch_opts_t* opts)
+{
+	int i = 0;
+
+	while(i < token_count && is_launch_modifier(tokens[i]))
+	{
+		if(strcmp(tokens[i], "affinity") == 0)
+		{
+			i++;
+
+			if(i < token_count && strcmp(tokens[i], "-p") == 0)
+			{
+				opts->spread = 1;
+				i++;
+			}
+
+			//affinity all leaves the set empty, which clears a default
+			if(i < token_count && strcmp(tokens[i], "all") == 0)
+			{
+				CPU_ZERO(&opts->cpus);
+				opts->spread = 0;
+			}
+			else if(i == token_count || parse_cpu_list(tokens[i], &opts->cpus) == -1)
+			{
+				fprintf(stderr, "affinity: expected a cpu list such as 0-3,6 or all\n");
+				return -1;
+			}
+
+			opts->has_affinity = 1;
+			i++;
+		}
+		else if(strcmp(tokens[i], "nice") == 0)
+		{
+			i++;
+
+			//nice with no adjustment lowers priority by 10 like nice(1)
+			opts->has_nice = 1;
+			opts->nice = 10;
+
+			if(i < token_count && strcmp(tokens[i], "-n") == 0)
+			{
+				i++;
+
+				if(i == token_count || !is_number(tokens[i]))
+				{
+					fprintf(stderr, "nice: expected a number after -n\n");
+					return -1;
+				}
+
+				opts->nice = atoi(tokens[i]);
+				i++;
+			}
+			//-N is an adjustment of N and --N one of -N, as nice(1) reads them
+			else if(i < token_count && tokens[i][0] == '-' && is_number(tokens[i] + 1))
+			{
+				opts->nice = atoi(tokens[i] + 1);
+				i++;
+			}
+			else if(i < token_count && is_number(tokens[i]))
+			{
+				opts->nice = atoi(tokens[i]);
+				i++;
+			}
+		}
+		else if(strcmp(tokens[i], "timeout") == 0)
+		{
+			int64_t duration = -1;
+
+			i++;
+
+			//-k may come before the duration like timeout(1) or after it
+			while(i < token_count)
+			{
+				if(strcmp(tokens[i], "-k") == 0)
+				{
+					int64_t kill_after = i + 1 < token_count ? parse_duration(tokens[i+1]) : -1;
+
+					if(kill_after == -1)
+					{
+						fprintf(stderr, "timeout: -k expects a duration such as 5 or 1.5s\n");
+						return -1;
+					}
+
+					opts->kill_after_ns = kill_after;
+					i += 2;
+				}
+				else if(duration == -1)
+				{
+					duration = parse_duration(tokens[i]);
+
+					if(duration == -1)
+					{
+						break;
+					}
+					i++;
+				}
+				else
+				{
+					break;
+				}
+			}
+
+			if(duration == -1)
+			{
+				fprintf(stderr, "timeout: expected a duration such as 30, 1.5s or 2m\n");
+				return -1;
+			}
+
+			opts->has_timeout = 1;
+			opts->timeout_ns = duration;
+		}
+		else if(strcmp(tokens[i], "pipesize") == 0)
+		{
+			i++;
+
+			long size = i < token_count ? parse_size(tokens[i]) : -1;
+
+			if(size == -1)
+			{
+				fprintf(stderr, "pipesize: expected a size such as 65536, 256K or 1M\n");
+				return -1;
+			}
+
+			//anything past the system limit gets capped when the pipe is made
+			opts->has_pipe_size = 1;
+			opts->pipe_size = size > INT_MAX ? INT_MAX : size;
+			i++;
+		}
+		else
+		{
+			i++;
+
+			while(i < token_count && tokens[i][0] == '-' && tokens[i][1] != '\0' && tokens[i][2] == '\0')
+			{
+				ulimit_flag_t* flag = ulimit_flags;
+
+				while(flag->flag != '\0' && flag->flag != tokens[i][1])
+				{
+					flag++;
+				}
+
+				if(flag->flag == '\0' || i + 1 == token_count)
+				{
+					fprintf(stderr, "ulimit: usage ulimit -c|-f|-n|-s|-t|-u|-v VALUE\n");
+					return -1;
+				}
+
+				char* value = tokens[i + 1];
+
+				if(strcmp(value, "unlimited") == 0)
+				{
+					set_limit(opts, flag->resource, RLIM_INFINITY);
+				}
+				else if(is_number(value) && value[0] != '-')
+				{
+					set_limit(opts, flag->resource, (rlim_t) strtoull(value, NULL, 10) * flag->scale);
+				}
+				else
+				{
+					fprintf(stderr, "ulimit: invalid value %s\n", value);
+					return -1;
+				}
+
+				i += 2;
+			}
+		}
+	}
+
+	return i;
+}
+
+/**
+ * Copies every modifier set in from over into, affinity all and
+ * nice 0 clear what into had
+**/
+void merge_launch_opts(launch_opts_t* into, launch_opts_t* from)
+{
+	if(from->has_affinity)
+	{
+		into->has_affinity = CPU_COUNT(&from->cpus) > 0;
+		into->spread = from->spread;
+		into->cpus = from->cpus;
+	}
+
+	if(from->has_nice)
+	{
+		into->has_nice = from->nice != 0;
+		into->nice = from->nice;
+	}
+
+	for(int i = 0; i < from->limit_count; i++)
+	{
+		set_limit(into, from->limits[i].resource, from->limits[i].value);
+	}
+
+	//pipesize 0 is copied too so it can clear a shell wide default
+	if(from->has_pipe_size)
+	{
+		into->has_pipe_size = 1;
+		into->pipe_size = from->pipe_size;
+	}
+
+	//timeout 0 is copied too so it can clear a shell wide default
+	if(from->has_timeout)
+	{
+		into->has_timeout = 1;
+		into->timeout_ns = from->timeout_ns;
+		into->kill_after_ns = from->kill_after_ns;
+	}
+}
+
+/**
+ * Applies modifiers in a child right before execvp(), exits
+ * the child if any of them can't be applied
+ * @param stage index in the pipeline, picks the cpu when spreading
+**/
+void apply_launch_opts(launch_opts_t* opts, int stage)
+{
+	if(opts->has_affinity)
+	{
+		cpu_set_t cpus = opts->cpus;
+
+		if(opts->spread)
+		{
+			int nth = stage % CPU_COUNT(&opts->cpus);
+
+			CPU_ZERO(&cpus);
+
+			for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			{
+				if(CPU_ISSET(cpu, &opts->cpus) && nth-- == 0)
+				{
+					CPU_SET(cpu, &cpus);
+					break;
+				}
+			}
+		}
+
+		if(sched_setaffinity(0, sizeof(cpu_set_t), &cpus) == -1)
+		{
+			perror("Could not set cpu affinity");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if(opts->has_nice)
+	{
+		errno = 0;
+
+		if(nice(opts->nice) == -1 && errno != 0)
+		{
+			perror("Could not set nice level");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for(int i = 0; i < opts->limit_count; i++)
+	{
+		struct rlimit limit;
+
+		getrlimit(opts->limits[i].resource, &limit);
+		limit.rlim_cur = opts->limits[i].value;
+
+		if(setrlimit(opts->limits[i].resource, &limit) == -1)
+		{
+			perror("Could not set resource limit");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+/**
+ * Prints the defaults for one modifier
+ * @param modifier affinity, nice or ulimit
+**/
+void print_launch_opts(launch_opts_t* opts, char* modifier)
+{
+	if(strcmp(modifier, "affinity") == 0)
+	{
+		if(!opts->has_affinity)
+		{
+			printf("affinity: not set\n");
+			fflush(stdout);
+			return;
+		}
+
+		printf("affinity:%s", opts->spread ? " -p" : "");
+
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if(CPU_ISSET(cpu, &opts->cpus))
+			{
+				printf(" %d", cpu);
+			}
+		}
+		printf("\n");
+	}
+	else if(strcmp(modifier, "nice") == 0)
+	{
+		printf("nice: %d\n", opts->has_nice ? opts->nice : 0);
+	}
+	else if(strcmp(modifier, "timeout") == 0)
+	{
+		if(opts->timeout_ns == 0)
+		{
+			printf("timeout: none\n");
+		}
+		else
+		{
+			printf("timeout: %.3fs, kill after %.3fs\n", opts->timeout_ns / 1e9, opts->kill_after_ns / 1e9);
+		}
+	}
+	else if(strcmp(modifier, "pipesize") == 0)
+	{
+		if(opts->pipe_size == 0)
+		{
+			printf("pipesize: system default (max %d)\n", pipe_max_size());
+		}
+		else
+		{
+			printf("pipesize: %d (max %d)\n", opts->pipe_size, pipe_max_size());
+		}
+	}
+	else
+	{
+		for(ulimit_flag_t* flag = ulimit_flags; flag->flag != '\0'; flag++)
+		{
+			struct rlimit limit;
+			rlim_t value;
+
+			getrlimit(flag->resource, &limit);
+			value = limit.rlim_cur;
+
+			for(int i = 0; i < opts->limit_count; i++)
+			{
+				if(opts->limits[i].resource == flag->resource)
+				{
+					value = opts->limits[i].value;
+				}
+			}
+
+			if(value == RLIM_INFINITY)
+			{
+				printf("-%c %-22s unlimited\n", flag->flag, flag->description);
+			}
+			else
+			{
+				printf("-%c %-22s %llu\n", flag->flag, flag->description, (unsigned long long) (value / flag->scale));
+			}
+		}
+	}
+	fflush(stdout);
+}
+
+/**
+ * Reads /proc/sys/fs/pipe-max-size once and caches it,
+ * unprivileged processes can't grow a pipe past it
+ * @return the limit in bytes
+**/
+int pipe_max_size()
+{
+	static int max_size = 0;
+
+	if(max_size == 0)
+	{
+		FILE* file = fopen("/proc/sys/fs/pipe-max-size", "r");
+
+		if(file == NULL || fscanf(file, "%d", &max_size) != 1)
+		{
+			//the kernel default
+			max_size = 1048576;
+		}
+
+		if(file != NULL)
+		{
+			fclose(file);
+		}
+	}
+
+	return max_size;
+}
+
+/**
+ * Resizes a pipe with F_SETPIPE_SZ, sizes above the system
+ * limit are capped, a failure only leaves the default size
+ * @param fd either end of the pipe
+ * @param size requested capacity in bytes, 0 does nothing
+**/
+void set_pipe_size(int fd, int size)
+{
+	if(size == 0)
+	{
+		return;
+	}
+
+	if(size > pipe_max_size())
+	{
+		size = pipe_max_size();
+	}
+
+	if(fcntl(fd, F_SETPIPE_SZ, size) == -1)
+	{
+		perror("Could not set pipe size");
+	}
+}
@@ -0,0 +1,62 @@
+#ifndef LAUNCH_OPTS_H
+#define LAUNCH_OPTS_H
+#include <sched.h>
+#include <sys/resource.h>
+#include <stdint.h>
+
+#define MAX_LAUNCH_LIMITS 8
+
+typedef struct launch_limit_t
+{
+	int resource;
+	rlim_t value;
+
+}launch_limit_t;
+
+/**
+ * Modifiers applied by a child between fork() and execvp()
+**/
+typedef struct launch_opts_t
+{
+	int has_affinity;
+	int spread;
+	cpu_set_t cpus;
+
+	int has_nice;
+	int nice;
+
+	launch_limit_t limits[MAX_LAUNCH_LIMITS];
+	int limit_count;
+
+	//set by the shell on the pipe a stage writes into, 0 keeps the default
+	int has_pipe_size;
+	int pipe_size;
+
+	//enforced by the shell while it waits, 0 means no deadline
+	int has_timeout;
+	uint64_t timeout_ns;
+	uint64_t kill_after_ns;
+
+}launch_opts_t;
+
+void init_launch_opts(launch_opts_t* opts);
+
+int is_launch_modifier(char* token);
+
+int launch_opts_in_child(launch_opts_t* opts);
+
+int parse_launch_opts(char** tokens, int token_count, launch_opts_t* opts);
+
+void merge_launch_opts(launch_opts_t* into, launch_opts_t* from);
+
+void apply_launch_opts(launch_opts_t* opts, int stage);
+
+void print_launch_opts(launch_opts_t* opts, char* modifier);
+
+long parse_size(char* token);
+
+int pipe_max_size();
+
+void set_pipe_size(int fd, int size);
+
+#endif
@@ -0,0 +1,535 @@
+#include "line_reader.h"
+#include "variables.h"
+#include "input_parser.h"
+#include "fd_table.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+//how IFS characters split a line, space ones also merge with each other
+#define IFS_NONE 0
+#define IFS_SPACE 1
+#define IFS_OTHER 2
+
+extern var_table_t var_table;
+extern int last_status;
+extern volatile sig_atomic_t interrupted;
+
+//readers kept for "read <&N", one per descriptor
+static line_reader_t* fd_readers[FD_READERS];
+
+void init_line_reader(line_reader_t* reader, int fd)
+{
+	reader->fd = fd;
+	reader->buf = NULL;
+	reader->start = 0;
+	reader->length = 0;
+	reader->capacity = 0;
+	reader->seekable = -1;
+	reader->offset = 0;
+	reader->line = NULL;
+	reader->escaped = NULL;
+	reader->line_length = 0;
+	reader->line_capacity = 0;
+	reader->escapes = 0;
+}
+
+/**
+ * Drops whatever was read ahead, called whenever the fd is pointed
+ * somewhere else so old data is never handed out for the new input
+**/
+void reset_line_reader(line_reader_t* reader)
+{
+	reader->start = 0;
+	reader->length = 0;
+	reader->seekable = -1;
+}
+
+void free_line_reader(line_reader_t* reader)
+{
+	free(reader->buf);
+	free(reader->line);
+	free(reader->escaped);
+	init_line_reader(reader, reader->fd);
+}
+
+/**
+ * @return the reader kept for "read <&N" on fd, made on first use.
+ * The oldest one is dropped when all FD_READERS are taken
+**/
+line_reader_t* fd_reader(int fd)
+{
+	for(int i = 0; i < FD_READERS; i++)
+	{
+		if(fd_readers[i] != NULL && fd_readers[i]->fd == fd)
+		{
+			return fd_readers[i];
+		}
+	}
+
+	int slot = 0;
+
+	while(slot < FD_READERS - 1 && fd_readers[slot] != NULL)
+	{
+		slot++;
+	}
+
+	if(fd_readers[slot] != NULL)
+	{
+		free_line_reader(fd_readers[slot]);
+		free(fd_readers[slot]);
+	}
+
+	fd_readers[slot] = malloc(sizeof(line_reader_t));
+
+	if(fd_readers[slot] == NULL)
+	{
+		perror("Could not allocate memory for reader");
+		exit(EXIT_FAILURE);
+	}
+
+	init_line_reader(fd_readers[slot], fd);
+
+	return fd_readers[slot];
+}
+
+/**
+ * Drops the reader of a descriptor the shell closed or reopened,
+ * so a later descriptor with the same number starts clean
+**/
+void forget_fd_reader(int fd)
+{
+	for(int i = 0; i < FD_READERS; i++)
+	{
+		if(fd_readers[i] != NULL && fd_readers[i]->fd == fd)
+		{
+			free_line_reader(fd_readers[i]);
+			free(fd_readers[i]);
+			fd_readers[i] = NULL;
+		}
+	}
+}
+
+/**
+ * Keeps buffered data of a regular file only if the offset is still
+ * where the last read left it, a command in between may have moved it.
+ * Pipes and terminals are found out once and never seeked again
+**/
+static void check_offset(line_reader_t* reader)
+{
+	if(reader->seekable == 0)
+	{
+		return;
+	}
+
+	off_t position = lseek(reader->fd, 0, SEEK_CUR);
+
+	if(position == -1)
+	{
+		if(reader->seekable == 1)
+		{
+			reader->start = 0;
+			reader->length = 0;
+		}
+		reader->seekable = 0;
+		return;
+	}
+
+	if(reader->seekable != 1 || position != reader->offset + (off_t) reader->start)
+	{
+		reader->start = 0;
+		reader->length = 0;
+		reader->offset = position;
+	}
+
+	reader->seekable = 1;
+}
+
+/**
+ * Moves unread data to the front of the buffer and reads another block
+ * @return bytes read, 0 at end of input, -1 on error
+**/
+static ssize_t fill(line_reader_t* reader)
+{
+	if(reader->start > 0)
+	{
+		memmove(reader->buf, reader->buf + reader->start, reader->length - reader->start);
+		reader->length -= reader->start;
+		reader->offset += reader->start;
+		reader->start = 0;
+	}
+
+	if(reader->length + READ_BLOCK > reader->capacity)
+	{
+		reader->capacity = reader->length + READ_BLOCK;
+		reader->buf = realloc(reader->buf, reader->capacity);
+
+		if(reader->buf == NULL)
+		{
+			perror("Could not grow read buffer");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ssize_t bytes_read;
+
+	do
+	{
+		bytes_read = read(reader->fd, reader->buf + reader->length, READ_BLOCK);
+	}
+	while(bytes_read == -1 && errno == EINTR && !interrupted);
+
+	if(bytes_read > 0)
+	{
+		reader->length += bytes_read;
+	}
+
+	return bytes_read;
+}
+
+/**
+ * Adds bytes to the line, the escaped marks are only kept
+ * once the line has its first escaped byte
+**/
+static void append_line(line_reader_t* reader, char* data, size_t count, int escaped)
+{
+	if(reader->line_length + count + 1 > reader->line_capacity)
+	{
+		reader->line_capacity = (reader->line_length + count + 1) * 2;
+		reader->line = realloc(reader->line, reader->line_capacity);
+		reader->escaped = realloc(reader->escaped, reader->line_capacity);
+
+		if(reader->line == NULL || reader->escaped == NULL)
+		{
+			perror("Could not grow read line");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(reader->line + reader->line_length, data, count);
+
+	if(escaped && reader->escapes == 0)
+	{
+		memset(reader->escaped, 0, reader->line_length);
+	}
+
+	if(escaped || reader->escapes > 0)
+	{
+		memset(reader->escaped + reader->line_length, escaped, count);
+	}
+
+	reader->escapes += escaped;
+	reader->line_length += count;
+}
+
+/**
+ * Reads up to the next delimiter into reader->line. Runs without a
+ * backslash are copied whole, found with memchr rather than byte by byte
+ * @param delim byte that ends the line, it isn't kept
+ * @param raw 1 for -r, backslashes are then ordinary bytes
+ * @return 1 if the delimiter was found, 0 if input ended first,
+ * -1 on a read error
+**/
+static int next_line(line_reader_t* reader, char delim, int raw)
+{
+	int pending_backslash = 0;
+
+	reader->line_length = 0;
+	reader->escapes = 0;
+
+	check_offset(reader);
+
+	while(1)
+	{
+		if(reader->start == reader->length)
+		{
+			ssize_t bytes_read = fill(reader);
+
+			if(bytes_read <= 0)
+			{
+				if(bytes_read == -1)
+				{
+					perror("read");
+				}
+
+				append_line(reader, "", 0, 0);
+				reader->line[reader->line_length] = '\0';
+				return bytes_read == 0 ? 0 : -1;
+			}
+		}
+
+		char* data = reader->buf + reader->start;
+		size_t available = reader->length - reader->start;
+
+		//backslash newline continues the line, any other byte is kept as is
+		if(pending_backslash)
+		{
+			if(*data != '\n')
+			{
+				append_line(reader, data, 1, 1);
+			}
+
+			pending_backslash = 0;
+			reader->start++;
+			continue;
+		}
+
+		char* end = memchr(data, delim, available);
+		size_t count = end != NULL ? (size_t) (end - data) : available;
+		char* backslash = raw ? NULL : memchr(data, '\\', count);
+
+		if(backslash != NULL)
+		{
+			count = backslash - data;
+		}
+
+		append_line(reader, data, count, 0);
+		reader->start += count;
+
+		if(backslash != NULL)
+		{
+			pending_backslash = 1;
+			reader->start++;
+			continue;
+		}
+
+		if(end != NULL)
+		{
+			reader->start++;
+			break;
+		}
+	}
+
+	reader->line[reader->line_length] = '\0';
+
+	//give back what was read past the line so the offset is where the line ended
+	if(reader->seekable == 1)
+	{
+		lseek(reader->fd, reader->offset + reader->start, SEEK_SET);
+	}
+
+	return 1;
+}
+
+static int split_class(line_reader_t* reader, unsigned char* split, size_t i)
+{
+	if(reader->escapes > 0 && reader->escaped[i])
+	{
+		return IFS_NONE;
+	}
+	return split[(unsigned char) reader->line[i]];
+}
+
+static void assign_field(line_reader_t* reader, char* name, size_t start, size_t end)
+{
+	char saved = reader->line[end];
+
+	reader->line[end] = '\0';
+	set_var(&var_table, name, reader->line + start);
+	reader->line[end] = saved;
+}
+
+/**
+ * Splits the line on IFS into the names, the last name gets the rest
+ * of the line and names left over are set empty. IFS space characters
+ * are trimmed at both ends and a run of them is a single separator
+**/
+static void assign_fields(line_reader_t* reader, char** names, int name_count)
+{
+	char* ifs = get_var(&var_table, "IFS");
+	unsigned char split[256] = {0};
+
+	if(ifs == NULL)
+	{
+		ifs = " \t\n";
+	}
+
+	for(char* c = ifs; *c != '\0'; c++)
+	{
+		split[(unsigned char) *c] = strchr(" \t\n", *c) != NULL ? IFS_SPACE : IFS_OTHER;
+	}
+
+	size_t length = reader->line_length;
+	size_t i = 0;
+
+	while(i < length && split_class(reader, split, i) == IFS_SPACE)
+	{
+		i++;
+	}
+
+	for(int n = 0; n < name_count - 1; n++)
+	{
+		size_t start = i;
+
+		while(i < length && split_class(reader, split, i) == IFS_NONE)
+		{
+			i++;
+		}
+
+		assign_field(reader, names[n], start, i);
+
+		while(i < length && split_class(reader, split, i) == IFS_SPACE)
+		{
+			i++;
+		}
+
+		if(i < length && split_class(reader, split, i) == IFS_OTHER)
+		{
+			i++;
+
+			while(i < length && split_class(reader, split, i) == IFS_SPACE)
+			{
+				i++;
+			}
+		}
+	}
+
+	size_t end = length;
+
+	while(end > i && split_class(reader, split, end - 1) == IFS_SPACE)
+	{
+		end--;
+	}
+
+	assign_field(reader, names[name_count - 1], i, end);
+}
+
+static void read_usage()
+{
+	fprintf(stderr, "usage: read [-r] [-d DELIM] [NAME...] [< FILE | <&N]\n");
+	last_status = 2;
+}
+
+/**
+ * The "read" builtin, reads a line from standard input and splits
+ * it on IFS into the names, or stores it whole in REPLY
+ * "read -r" keeps backslashes, "read -d DELIM" stops at the first
+ * character of DELIM instead of a newline, an empty DELIM means NUL
+ * Status is 1 once input ends, a last line without a delimiter
+ * is still assigned
+**/
+void read_builtin(char** tokens, line_reader_t* reader)
+{
+	int raw = 0;
+	char delim = '\n';
+	int i = 1;
+
+	for(; tokens[i] != NULL && tokens[i][0] == '-' && tokens[i][1] != '\0'; i++)
+	{
+		for(int j = 1; tokens[i][j] != '\0'; j++)
+		{
+			if(tokens[i][j] == 'r')
+			{
+				raw = 1;
+				continue;
+			}
+
+			if(tokens[i][j] != 'd')
+			{
+				read_usage();
+				return;
+			}
+
+			char* value = tokens[i][j + 1] != '\0' ? &tokens[i][j + 1] : tokens[++i];
+
+			if(value == NULL)
+			{
+				read_usage();
+				return;
+			}
+
+			delim = value[0];
+			break;
+		}
+	}
+
+	char** names = &tokens[i];
+	int name_count = 0;
+	redirection_t redirection;
+
+	while(names[name_count] != NULL && !parse_redirection(names[name_count], &redirection))
+	{
+		if(!is_valid_name(names[name_count], strlen(names[name_count])))
+		{
+			fprintf(stderr, "read: '%s' is not a valid variable name\n", names[name_count]);
+			last_status = 2;
+			return;
+		}
+		name_count++;
+	}
+
+	char* input = names[name_count] != NULL ? names[name_count + 1] : NULL;
+
+	if(names[name_count] != NULL && (input == NULL || names[name_count + 2] != NULL || redirection.fd != 0 ||
+		(redirection.kind != REDIRECT_IN && redirection.kind != REDIRECT_DUP_IN)))
+	{
+		read_usage();
+		return;
+	}
+
+	line_reader_t file_reader;
+	int owned_fd = -1;
+
+	//"read x < FILE" goes through a reader of its own and "read x <&N"
+	//through the one kept for N, a regular file is left right after the line
+	if(input != NULL)
+	{
+		int fd;
+
+		if(redirection.kind == REDIRECT_IN)
+		{
+			fd = owned_fd = open(input, O_RDONLY | O_CLOEXEC);
+		}
+		else
+		{
+			fd = parse_fd(input);
+			errno = EBADF;
+		}
+
+		if(fd < 0)
+		{
+			fprintf(stderr, "read: %s: %s\n", input, strerror(errno));
+			last_status = 1;
+			return;
+		}
+
+		//<&N keeps a reader per descriptor so what was read ahead
+		//from a pipe is still there for the next read
+		if(owned_fd == -1)
+		{
+			reader = fd == reader->fd ? reader : fd_reader(fd);
+		}
+		else
+		{
+			init_line_reader(&file_reader, fd);
+			reader = &file_reader;
+		}
+	}
+
+	int found = next_line(reader, delim, raw);
+
+	if(found == 1 || reader->line_length > 0)
+	{
+		if(name_count == 0)
+		{
+			set_var(&var_table, "REPLY", reader->line);
+		}
+		else
+		{
+			assign_fields(reader, names, name_count);
+		}
+	}
+
+	last_status = found == 1 ? 0 : 1;
+
+	if(owned_fd != -1)
+	{
+		close(owned_fd);
+		free_line_reader(&file_reader);
+	}
+}
@@ -0,0 +1,53 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+#include <sys/types.h>
+
+//bytes asked for per read(), a single read covers many lines
+#define READ_BLOCK 65536
+
+//descriptors other than standard input that keep a reader
+#define FD_READERS 16
+
+/**
+ * Buffered input for the read builtin. A regular file is read a
+ * block at a time and its offset is moved back to the end of the
+ * line returned, so commands run between reads start where read
+ * stopped. A pipe or terminal can't be rewound, bytes read past
+ * the line stay in the buffer for the next read
+**/
+typedef struct line_reader_t
+{
+	int fd;
+
+	char* buf;
+	size_t start;
+	size_t length;
+	size_t capacity;
+
+	//1 once the fd is known to seek, then buf holds the file from offset
+	int seekable;
+	off_t offset;
+
+	//the line with escapes removed, escaped marks bytes that
+	//came after a backslash and so are never split on
+	char* line;
+	char* escaped;
+	size_t line_length;
+	size_t line_capacity;
+	int escapes;
+
+}line_reader_t;
+
+void init_line_reader(line_reader_t* reader, int fd);
+
+void reset_line_reader(line_reader_t* reader);
+
+void free_line_reader(line_reader_t* reader);
+
+line_reader_t* fd_reader(int fd);
+
+void forget_fd_reader(int fd);
+
+void read_builtin(char** tokens, line_reader_t* reader);
+
+#endif
@@ -0,0 +1,217 @@
+#include "notify.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void init_notify_queue(notify_queue_t* queue)
+{
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	atomic_init(&queue->dropped, 0);
+	queue->immediate = 0;
+	queue->last_flush_ns = 0;
+}
+
+/**
+ * Queues a finished job to be reported, called from the SIGCHLD
+ * handler so it only copies into the ring
+**/
+void push_job_notice(notify_queue_t* queue, process_t* job)
+{
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+
+	if(head - tail == NOTIFY_RING_SIZE)
+	{
+		atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+		return;
+	}
+
+	job_notice_t* notice = &queue->ring[head & (NOTIFY_RING_SIZE - 1)];
+
+	notice->job = job->index + 1;
+	notice->pid = job->pid;
+	notice->status = job->status;
+
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+int has_job_notices(notify_queue_t* queue)
+{
+	return atomic_load_explicit(&queue->head, memory_order_acquire) != atomic_load_explicit(&queue->tail, memory_order_relaxed)
+		|| atomic_load_explicit(&queue->dropped, memory_order_relaxed) != 0;
+}
+
+/**
+ * Tells whether pending notices may be printed yet, a burst of jobs
+ * finishing is then reported in a few lines rather than one per
+ * SIGCHLD
+ * @param delay set to how long until they may be when they are
+ * pending but not due yet
+ * @return 1 if notices are pending and due
+**/
+int job_notices_due(notify_queue_t* queue, struct timespec* delay)
+{
+	if(!has_job_notices(queue))
+	{
+		return 0;
+	}
+
+	uint64_t elapsed = now_ns() - queue->last_flush_ns;
+
+	if(elapsed >= NOTIFY_INTERVAL_NS)
+	{
+		return 1;
+	}
+
+	delay->tv_sec = 0;
+	delay->tv_nsec = NOTIFY_INTERVAL_NS - elapsed;
+	return 0;
+}
+
+static int compare_notices(const void* a, const void* b)
+{
+	const job_notice_t* left = a;
+	const job_notice_t* right = b;
+
+	if(left->status != right->status)
+	{
+		return left->status - right->status;
+	}
+
+	return left->job - right->job;
+}
+
+/**
+ * Prints job numbers as ranges, 1 2 3 5 becomes [1-3,5]
+ * @param notices sorted by job number
+**/
+static void print_job_ranges(job_notice_t* notices, int count)
+{
+	printf("[");
+
+	for(int i = 0; i < count; i++)
+	{
+		int last = i;
+
+		while(last + 1 < count && notices[last + 1].job == notices[last].job + 1)
+		{
+			last++;
+		}
+
+		printf(i == 0 ? "%d" : ",%d", notices[i].job);
+
+		if(last > i)
+		{
+			printf("-%d", notices[last].job);
+		}
+
+		i = last;
+	}
+
+	printf("]");
+}
+
+/**
+ * Reports the jobs that finished since the last call. A few jobs get
+ * a line each like jobs prints them, more are coalesced into one line
+ * grouping the job numbers by exit status. Jobs already collected
+ * by wait or fg are skipped. A reported job leaves the table, unless
+ * its output was captured for joblog, then wait or fg collects it
+**/
+void print_job_notices(notify_queue_t* queue, bg_proc_manager_t* bg_proc_manager)
+{
+	job_notice_t notices[NOTIFY_RING_SIZE];
+	int count = 0;
+
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+
+	for(; tail != head; tail++)
+	{
+		job_notice_t notice = queue->ring[tail & (NOTIFY_RING_SIZE - 1)];
+		process_t* job = bg_proc_manager->bg_processes[notice.job - 1];
+
+		if(job != NULL && job->pid == notice.pid)
+		{
+			notices[count++] = notice;
+		}
+	}
+
+	atomic_store_explicit(&queue->tail, tail, memory_order_release);
+
+	unsigned int dropped = atomic_exchange_explicit(&queue->dropped, 0, memory_order_relaxed);
+
+	if(count < NOTIFY_COALESCE)
+	{
+		for(int i = 0; i < count; i++)
+		{
+			process_t* job = bg_proc_manager->bg_processes[notices[i].job - 1];
+
+			if(notices[i].status == 0)
+			{
+				printf("[%d]\tDone\t%s\n", notices[i].job, job->command);
+			}
+			else
+			{
+				printf("[%d]\tExit %d\t%s\n", notices[i].job, notices[i].status, job->command);
+			}
+		}
+	}
+	else
+	{
+		qsort(notices, count, sizeof(job_notice_t), compare_notices);
+
+		printf("%d jobs finished:", count);
+
+		for(int start = 0; start < count;)
+		{
+			int end = start;
+
+			while(end < count && notices[end].status == notices[start].status)
+			{
+				end++;
+			}
+
+			if(notices[start].status == 0)
+			{
+				printf(" Done ");
+			}
+			else
+			{
+				printf(" Exit %d ", notices[start].status);
+			}
+
+			print_job_ranges(notices + start, end - start);
+			start = end;
+		}
+
+		printf("\n");
+	}
+
+	if(dropped > 0)
+	{
+		printf("%u more jobs finished, see jobs\n", dropped);
+	}
+
+	sigset_t prev_mask;
+
+	//the SIGCHLD handler walks the table
+	block_sig_chld(&prev_mask);
+
+	for(int i = 0; i < count; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[notices[i].job - 1];
+
+		if(job != NULL && job->pid == notices[i].pid && job->log == NULL)
+		{
+			forget_bg_job(job, bg_proc_manager);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &prev_mask, NULL);
+
+	fflush(stdout);
+	queue->last_flush_ns = now_ns();
+}
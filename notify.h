@@ -0,0 +1,63 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+#include "shell.h"
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
+
+//power of two so the free running counters wrap cleanly, room
+//for every job in the table to finish between two prompts
+#define NOTIFY_RING_SIZE 1024
+
+//with set -b the terminal is written at most this often
+#define NOTIFY_INTERVAL_NS 50000000ULL
+
+//this many jobs finishing together are reported on one line
+#define NOTIFY_COALESCE 4
+
+/**
+ * A background job that finished, pid tells a job apart from a
+ * later one that reused its number
+**/
+typedef struct job_notice_t
+{
+	int job;
+	pid_t pid;
+	int status;
+
+}job_notice_t;
+
+/**
+ * Single producer ring, the SIGCHLD handler pushes and the shell
+ * drains before it prints a prompt. Each side only writes its own
+ * counter so no lock is needed
+**/
+typedef struct notify_queue_t
+{
+	job_notice_t ring[NOTIFY_RING_SIZE];
+
+	atomic_uint head;
+	atomic_uint tail;
+
+	//notices lost to a full ring
+	atomic_uint dropped;
+
+	//set -b, report while waiting at the prompt instead of before the next one
+	int immediate;
+
+	//when notices were last printed, now_ns() time
+	uint64_t last_flush_ns;
+
+}notify_queue_t;
+
+void init_notify_queue(notify_queue_t* queue);
+
+void push_job_notice(notify_queue_t* queue, process_t* job);
+
+int has_job_notices(notify_queue_t* queue);
+
+int job_notices_due(notify_queue_t* queue, struct timespec* delay);
+
+void print_job_notices(notify_queue_t* queue, bg_proc_manager_t* bg_proc_manager);
+
+#endif
@@ -0,0 +1,171 @@
+#include "pipe_stats.h"
+#include "stats.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+void init_pipe_stats_config(pipe_stats_config_t* config)
+{
+	config->enabled = 0;
+	config->total_bytes = 0;
+	config->total_read_wait_ns = 0;
+	config->total_write_wait_ns = 0;
+}
+
+/**
+ * Maps the figures of a pipeline's pipes so its relays can write them
+ * @param commands the stages, their names label the table
+ * @return the mapping, NULL if it could not be made
+**/
+pipe_stats_t* new_pipe_stats(char*** commands, int command_count)
+{
+	int link_count = command_count - 1;
+	size_t size = sizeof(pipe_stats_t) + sizeof(pipe_link_t) * link_count;
+
+	pipe_stats_t* stats = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(stats == MAP_FAILED)
+	{
+		perror("Could not map pipe stats");
+		return NULL;
+	}
+
+	//the mapping starts zeroed
+	stats->size = size;
+	stats->link_count = link_count;
+
+	for(int i = 0; i < link_count; i++)
+	{
+		snprintf(stats->links[i].from, PIPE_STATS_NAME, "%s", commands[i][0]);
+		snprintf(stats->links[i].to, PIPE_STATS_NAME, "%s", commands[i + 1][0]);
+	}
+
+	return stats;
+}
+
+void free_pipe_stats(pipe_stats_t* stats)
+{
+	if(stats != NULL)
+	{
+		munmap(stats, stats->size);
+	}
+}
+
+/**
+ * Moves a stage's output into the next stage's pipe with splice(), in
+ * a process of its own. Before each splice it waits for data and then
+ * for room separately, so the time is split between the two stages
+ * @param in_fd read end of the writing stage's pipe
+ * @param out_fd write end of the reading stage's pipe
+ * @param link shared figures, updated after every splice
+**/
+void relay_pipe_link(int in_fd, int out_fd, pipe_link_t* link)
+{
+	struct pollfd in = {in_fd, POLLIN, 0};
+	struct pollfd out = {out_fd, POLLOUT, 0};
+
+	//a reading stage that exits must end the relay, not kill it
+	signal(SIGPIPE, SIG_IGN);
+
+	link->start_ns = now_ns();
+
+	while(1)
+	{
+		uint64_t wait_start = now_ns();
+
+		if(poll(&in, 1, -1) == -1)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		uint64_t readable = now_ns();
+		link->read_wait_ns += readable - wait_start;
+
+		//hang up with nothing left to read is end of input
+		if(!(in.revents & POLLIN))
+		{
+			break;
+		}
+
+		while(poll(&out, 1, -1) == -1 && errno == EINTR);
+
+		link->write_wait_ns += now_ns() - readable;
+
+		if(out.revents & (POLLERR | POLLHUP))
+		{
+			break;
+		}
+
+		ssize_t moved = splice(in_fd, NULL, out_fd, NULL, PIPE_RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if(moved == 0)
+		{
+			break;
+		}
+
+		if(moved < 0)
+		{
+			if(errno == EAGAIN || errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		link->bytes += moved;
+	}
+
+	link->end_ns = now_ns();
+
+	exit(EXIT_SUCCESS);
+}
+
+/**
+ * Adds a finished pipeline to the totals the server reports
+**/
+void add_pipe_totals(pipe_stats_config_t* config, pipe_stats_t* stats)
+{
+	for(int i = 0; i < stats->link_count; i++)
+	{
+		config->total_bytes += stats->links[i].bytes;
+		config->total_read_wait_ns += stats->links[i].read_wait_ns;
+		config->total_write_wait_ns += stats->links[i].write_wait_ns;
+	}
+}
+
+/**
+ * Prints one row per pipe. %wait-in is the relay waiting on the
+ * stage before it, %wait-out waiting on the stage after it, so a
+ * high %wait-out points at a slow reader and %wait-in at a slow writer
+**/
+void print_pipe_stats(pipe_stats_t* stats, FILE* out)
+{
+	fprintf(out, "%-4s %-32s %14s %10s %9s %9s\n", "pipe", "stages", "bytes", "MB/s", "%wait-in", "%wait-out");
+
+	for(int i = 0; i < stats->link_count; i++)
+	{
+		pipe_link_t* link = &stats->links[i];
+		char stages[2 * PIPE_STATS_NAME + 4];
+
+		//a relay still running is measured up to now
+		uint64_t end = link->end_ns != 0 ? link->end_ns : now_ns();
+		double seconds = link->start_ns != 0 && end > link->start_ns ? (end - link->start_ns) / 1e9 : 0;
+
+		snprintf(stages, sizeof(stages), "%s -> %s", link->from, link->to);
+
+		fprintf(out, "%-4d %-32s %14llu %10.1f %9.1f %9.1f\n", i, stages, (unsigned long long) link->bytes,
+			seconds > 0 ? link->bytes / (1024.0 * 1024) / seconds : 0,
+			seconds > 0 ? link->read_wait_ns / 1e7 / seconds : 0,
+			seconds > 0 ? link->write_wait_ns / 1e7 / seconds : 0);
+	}
+	fflush(out);
+}
@@ -0,0 +1,72 @@
+#ifndef PIPE_STATS_H
+#define PIPE_STATS_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+//upper bound for one splice() of a relay, the pipe capacity limits it further
+#define PIPE_RELAY_CHUNK (1 << 20)
+
+//command names kept for the table, longer ones are cut
+#define PIPE_STATS_NAME 24
+
+/**
+ * One pipe between two stages of an instrumented pipeline. Its relay
+ * process fills this in, in memory shared with the shell
+**/
+typedef struct pipe_link_t
+{
+	char from[PIPE_STATS_NAME];
+	char to[PIPE_STATS_NAME];
+
+	uint64_t bytes;
+
+	//waiting for the writing stage to produce
+	uint64_t read_wait_ns;
+
+	//waiting for the reading stage to make room
+	uint64_t write_wait_ns;
+
+	uint64_t start_ns;
+	uint64_t end_ns;
+
+}pipe_link_t;
+
+/**
+ * Shared mapping of every pipe of one pipeline
+**/
+typedef struct pipe_stats_t
+{
+	size_t size;
+	int link_count;
+	pipe_link_t links[];
+
+}pipe_stats_t;
+
+/**
+ * set -o pipestats, and the figures of every instrumented pipe so far
+ * for the rusage reply the server sends back
+**/
+typedef struct pipe_stats_config_t
+{
+	int enabled;
+
+	uint64_t total_bytes;
+	uint64_t total_read_wait_ns;
+	uint64_t total_write_wait_ns;
+
+}pipe_stats_config_t;
+
+void init_pipe_stats_config(pipe_stats_config_t* config);
+
+pipe_stats_t* new_pipe_stats(char*** commands, int command_count);
+
+void free_pipe_stats(pipe_stats_t* stats);
+
+void relay_pipe_link(int in_fd, int out_fd, pipe_link_t* link);
+
+void add_pipe_totals(pipe_stats_config_t* config, pipe_stats_t* stats);
+
+void print_pipe_stats(pipe_stats_t* stats, FILE* out);
+
+#endif
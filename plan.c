@@ -0,0 +1,97 @@
+#include "plan.h"
+#include "input_parser.h"
+#include "variables.h"
+#include "launch_opts.h"
+#include "fd_table.h"
+#include <string.h>
+
+/**
+ * Classifies a simple command in one pass over its words so the
+ * executor doesn't scan them again for every run. Lines the fast
+ * executors don't cover, such as assignments, launch modifiers, a
+ * command name that is expanded or an operator out of place, are
+ * PLAN_GENERAL and go through execute_tokens() as before
+ * @param words the command as compiled, & included
+ * @param plan filled in
+**/
+void plan_command(char** words, int word_count, command_plan_t* plan)
+{
+	plan->kind = PLAN_GENERAL;
+	plan->background = 0;
+	plan->builtin = NULL;
+	plan->arg_count = 0;
+	plan->input_word = -1;
+	plan->output_word = -1;
+	plan->child_redirections = 0;
+
+	if(word_count == 0 || is_any_operator(words[0]) || has_expansion(words[0]))
+	{
+		return;
+	}
+
+	//builtins run whatever follows them, as execute_tokens() does
+	plan->builtin = find_builtin(words[0]);
+
+	if(plan->builtin != NULL)
+	{
+		plan->kind = PLAN_BUILTIN;
+		return;
+	}
+
+	if(is_assignment(words[0]) || is_launch_modifier(words[0]))
+	{
+		return;
+	}
+
+	int kind = PLAN_SIMPLE;
+
+	if(is_operator(words[word_count - 1], "&"))
+	{
+		plan->background = 1;
+		word_count--;
+	}
+
+	for(int i = 0; i < word_count; i++)
+	{
+		char* word = words[i];
+
+		if(!is_any_operator(word))
+		{
+			plan->arg_count++;
+			continue;
+		}
+
+		if(is_operator(word, "|") || is_operator(word, "|>") || is_operator(word, "|&"))
+		{
+			kind = PLAN_PIPELINE;
+			continue;
+		}
+
+		//a redirection needs a file or descriptor word after it
+		if(!parse_redirection(word, NULL) || i + 1 == word_count || is_any_operator(words[i + 1]))
+		{
+			return;
+		}
+
+		if(is_operator(word, "<"))
+		{
+			plan->input_word = i + 1;
+		}
+		else if(is_operator(word, ">"))
+		{
+			plan->output_word = i + 1;
+		}
+		else
+		{
+			plan->child_redirections = 1;
+		}
+
+		if(kind == PLAN_SIMPLE)
+		{
+			kind = PLAN_REDIRECT;
+		}
+		i++;
+	}
+
+	plan->kind = kind;
+}
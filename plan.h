@@ -0,0 +1,41 @@
+#ifndef PLAN_H
+#define PLAN_H
+#include "shell.h"
+
+//what a command line turned out to be, each has its own executor
+#define PLAN_GENERAL 0
+#define PLAN_BUILTIN 1
+#define PLAN_SIMPLE 2
+#define PLAN_REDIRECT 3
+#define PLAN_PIPELINE 4
+
+/**
+ * How to run one simple command, worked out once when it is compiled.
+ * Expanding variables never changes the number of words or where the
+ * operators are, so the word indexes stay valid for the expanded argv
+**/
+typedef struct command_plan_t
+{
+	int kind;
+
+	//a trailing & that the executor drops
+	int background;
+
+	//the builtin named by a first word that is never expanded, NULL otherwise
+	builtin_fn_t builtin;
+
+	//words of the command once redirections and & are taken out
+	int arg_count;
+
+	//word indexes of the files of < and >, -1 when there are none
+	int input_word;
+	int output_word;
+
+	//redirections such as >> or 2>&1 that the child applies itself
+	int child_redirections;
+
+}command_plan_t;
+
+void plan_command(char** words, int word_count, command_plan_t* plan);
+
+#endif
@@ -0,0 +1,619 @@
+#include "proc_monitor.h"
+#include "pipe_stats.h"
+#include "job_log.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+extern int last_status;
+extern volatile sig_atomic_t interrupted;
+
+/**
+ * Sets up an empty monitor, nothing is opened until the first refresh
+**/
+void init_proc_monitor(proc_monitor_t* monitor)
+{
+	monitor->entries = NULL;
+	monitor->count = 0;
+	monitor->capacity = 0;
+	monitor->index = NULL;
+	monitor->index_size = 0;
+	monitor->generation = 0;
+	monitor->last_sample = 0;
+	monitor->interval = 0;
+	monitor->ticks_per_sec = sysconf(_SC_CLK_TCK);
+	monitor->page_size = sysconf(_SC_PAGESIZE);
+}
+
+static void proc_path(char* path, size_t size, pid_t pid, int file)
+{
+	switch(file)
+	{
+		case MONITOR_STAT: snprintf(path, size, "/proc/%d/stat", pid); break;
+		case MONITOR_STATM: snprintf(path, size, "/proc/%d/statm", pid); break;
+		case MONITOR_IO: snprintf(path, size, "/proc/%d/io", pid); break;
+		default: snprintf(path, size, "/proc/%d/task/%d/children", pid, pid); break;
+	}
+}
+
+/**
+ * Reads one of a process's /proc files, from the cached descriptor when
+ * there is one, otherwise it is opened just for this read. That happens
+ * when the descriptor limit was hit while the entry was created
+ * @return bytes read with a terminating NUL added, -1 if the process is gone
+**/
+static int read_proc_file(proc_entry_t* entry, int file, char* buf, size_t size)
+{
+	int fd = entry->fds[file];
+	ssize_t bytes_read;
+
+	if(fd != -1)
+	{
+		bytes_read = pread(fd, buf, size - 1, 0);
+	}
+	else
+	{
+		char path[64];
+
+		proc_path(path, sizeof(path), entry->pid, file);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+
+		if(fd == -1)
+		{
+			return -1;
+		}
+
+		bytes_read = read(fd, buf, size - 1);
+		close(fd);
+	}
+
+	if(bytes_read < 0)
+	{
+		return -1;
+	}
+
+	buf[bytes_read] = '\0';
+
+	return bytes_read;
+}
+
+static void close_entry(proc_entry_t* entry)
+{
+	for(int i = 0; i < MONITOR_FILES; i++)
+	{
+		if(entry->fds[i] != -1)
+		{
+			close(entry->fds[i]);
+		}
+	}
+}
+
+/**
+ * Rebuilds the pid table at twice the entry count, rounded up to a power of two
+**/
+static void rebuild_index(proc_monitor_t* monitor)
+{
+	int size = 64;
+
+	while(size < monitor->count * 2)
+	{
+		size *= 2;
+	}
+
+	if(size != monitor->index_size)
+	{
+		free(monitor->index);
+		monitor->index = malloc(sizeof(int) * size);
+		monitor->index_size = size;
+
+		if(monitor->index == NULL)
+		{
+			perror("Could not allocate memory for monitor");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memset(monitor->index, -1, sizeof(int) * size);
+
+	for(int i = 0; i < monitor->count; i++)
+	{
+		int slot = monitor->entries[i].pid & (size - 1);
+
+		while(monitor->index[slot] != -1)
+		{
+			slot = (slot + 1) & (size - 1);
+		}
+
+		monitor->index[slot] = i;
+	}
+}
+
+/**
+ * Finds a process's entry, opening its /proc files the first time it shows up
+ * @return the entry's position, -1 if the process is already gone
+**/
+static int lookup_entry(proc_monitor_t* monitor, pid_t pid)
+{
+	if(monitor->index_size > 0)
+	{
+		int slot = pid & (monitor->index_size - 1);
+
+		while(monitor->index[slot] != -1)
+		{
+			if(monitor->entries[monitor->index[slot]].pid == pid)
+			{
+				return monitor->index[slot];
+			}
+
+			slot = (slot + 1) & (monitor->index_size - 1);
+		}
+	}
+
+	proc_entry_t entry;
+	char path[64];
+
+	entry.pid = pid;
+	entry.ticks = 0;
+	entry.generation = 0;
+
+	for(int i = 0; i < MONITOR_FILES; i++)
+	{
+		proc_path(path, sizeof(path), pid, i);
+		entry.fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+
+		if(entry.fds[i] == -1 && i == MONITOR_STAT && errno != EMFILE && errno != ENFILE)
+		{
+			return -1;
+		}
+	}
+
+	if(monitor->count == monitor->capacity)
+	{
+		monitor->capacity = monitor->capacity == 0 ? 64 : monitor->capacity * 2;
+		monitor->entries = realloc(monitor->entries, sizeof(proc_entry_t) * monitor->capacity);
+
+		if(monitor->entries == NULL)
+		{
+			perror("Could not allocate memory for monitor");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	monitor->entries[monitor->count++] = entry;
+
+	if(monitor->count * 2 > monitor->index_size)
+	{
+		rebuild_index(monitor);
+	}
+	else
+	{
+		int slot = pid & (monitor->index_size - 1);
+
+		while(monitor->index[slot] != -1)
+		{
+			slot = (slot + 1) & (monitor->index_size - 1);
+		}
+
+		monitor->index[slot] = monitor->count - 1;
+	}
+
+	return monitor->count - 1;
+}
+
+/**
+ * Adds one process to its job's totals and pushes its children
+ * @param stack pids still to visit, grown as needed
+ * @return 0 if it was sampled, -1 if it is gone
+**/
+static int sample_process(proc_monitor_t* monitor, pid_t pid, job_usage_t* usage, pid_t** stack, int* stack_count, int* stack_capacity)
+{
+	static char buf[65536];
+
+	int index = lookup_entry(monitor, pid);
+
+	if(index == -1)
+	{
+		return -1;
+	}
+
+	proc_entry_t* entry = &monitor->entries[index];
+
+	//a pid can only be counted once per refresh
+	if(entry->generation == monitor->generation)
+	{
+		return 0;
+	}
+
+	if(read_proc_file(entry, MONITOR_STAT, buf, sizeof(buf)) <= 0)
+	{
+		return -1;
+	}
+
+	//the command name is in parens and may hold spaces, fields start after it
+	char* fields = strrchr(buf, ')');
+	unsigned long utime = 0;
+	unsigned long stime = 0;
+	long threads = 0;
+
+	if(fields == NULL || sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %ld", &utime, &stime, &threads) != 3)
+	{
+		return -1;
+	}
+
+	uint64_t ticks = utime + stime;
+
+	//a process that appeared since the last refresh used all of its time in the interval
+	usage->cpu += ticks - (entry->generation == monitor->generation - 1 ? entry->ticks : 0);
+	entry->ticks = ticks;
+	entry->generation = monitor->generation;
+
+	usage->procs++;
+	usage->threads += threads;
+
+	unsigned long resident;
+
+	if(read_proc_file(entry, MONITOR_STATM, buf, sizeof(buf)) > 0 && sscanf(buf, "%*u %lu", &resident) == 1)
+	{
+		usage->rss += (uint64_t) resident * monitor->page_size;
+	}
+
+	if(read_proc_file(entry, MONITOR_IO, buf, sizeof(buf)) > 0)
+	{
+		unsigned long long rchar = 0;
+		unsigned long long wchar = 0;
+
+		sscanf(buf, "rchar: %llu wchar: %llu", &rchar, &wchar);
+		usage->read_bytes += rchar;
+		usage->write_bytes += wchar;
+	}
+
+	if(read_proc_file(entry, MONITOR_CHILDREN, buf, sizeof(buf)) > 0)
+	{
+		char* pos = buf;
+		char* end;
+
+		for(long child = strtol(pos, &end, 10); end != pos; child = strtol(pos, &end, 10))
+		{
+			if(*stack_count == *stack_capacity)
+			{
+				*stack_capacity *= 2;
+				*stack = realloc(*stack, sizeof(pid_t) * *stack_capacity);
+
+				if(*stack == NULL)
+				{
+					perror("Could not allocate memory for monitor");
+					exit(EXIT_FAILURE);
+				}
+			}
+
+			(*stack)[(*stack_count)++] = child;
+			pos = end;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Samples every background job, walking each job's process tree through
+ * the children files under /proc, CPU% is measured since the last refresh
+ * and processes that are gone have their descriptors closed
+ * @param usage one entry per job table slot
+**/
+void refresh_job_usage(proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager, job_usage_t* usage)
+{
+	int stack_capacity = 64;
+	pid_t* stack = malloc(sizeof(pid_t) * stack_capacity);
+
+	if(stack == NULL)
+	{
+		perror("Could not allocate memory for monitor");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t now = now_ns();
+
+	monitor->interval = monitor->last_sample != 0 ? now - monitor->last_sample : 0;
+	monitor->last_sample = now;
+	monitor->generation++;
+
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[i];
+		int stack_count = 0;
+
+		memset(&usage[i], 0, sizeof(job_usage_t));
+
+		if(job == NULL)
+		{
+			continue;
+		}
+
+		for(int j = 0; j < job->pid_count; j++)
+		{
+			if(!job->reaped[j])
+			{
+				stack[stack_count++] = job->pids[j];
+			}
+		}
+
+		while(stack_count > 0)
+		{
+			pid_t pid = stack[--stack_count];
+
+			sample_process(monitor, pid, &usage[i], &stack, &stack_count, &stack_capacity);
+		}
+
+		//cpu holds clock ticks until here
+		usage[i].cpu = monitor->interval == 0 ? 0 :
+			usage[i].cpu * 100.0 / monitor->ticks_per_sec / (monitor->interval / 1e9);
+	}
+
+	free(stack);
+
+	//drop processes that were not seen, their pids may be reused
+	int kept = 0;
+
+	for(int i = 0; i < monitor->count; i++)
+	{
+		if(monitor->entries[i].generation != monitor->generation)
+		{
+			close_entry(&monitor->entries[i]);
+			continue;
+		}
+
+		monitor->entries[kept++] = monitor->entries[i];
+	}
+
+	if(kept != monitor->count)
+	{
+		monitor->count = kept;
+		rebuild_index(monitor);
+	}
+}
+
+/**
+ * Formats a byte count with a K, M or G suffix
+**/
+static void format_bytes(char* buf, size_t size, uint64_t bytes)
+{
+	if(bytes < 1024)
+	{
+		snprintf(buf, size, "%llu", (unsigned long long) bytes);
+	}
+	else if(bytes < 1024 * 1024)
+	{
+		snprintf(buf, size, "%.1fK", bytes / 1024.0);
+	}
+	else if(bytes < 1024ULL * 1024 * 1024)
+	{
+		snprintf(buf, size, "%.1fM", bytes / (1024.0 * 1024));
+	}
+	else
+	{
+		snprintf(buf, size, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+	}
+}
+
+/**
+ * Refreshes, taking a short baseline first if there is no recent
+ * sample to measure CPU% against, or waiting if the last one is too recent
+**/
+static void sample_jobs(proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager, job_usage_t* usage)
+{
+	uint64_t age_ms = (now_ns() - monitor->last_sample) / 1000000;
+
+	if(monitor->last_sample == 0 || age_ms > MONITOR_STALE_MS)
+	{
+		refresh_job_usage(monitor, bg_proc_manager, usage);
+		age_ms = 0;
+	}
+
+	//clock ticks are too coarse to measure a shorter interval
+	if(age_ms < MONITOR_BASELINE_MS)
+	{
+		poll(NULL, 0, MONITOR_BASELINE_MS - age_ms);
+	}
+
+	refresh_job_usage(monitor, bg_proc_manager, usage);
+}
+
+static void print_usage_header()
+{
+	printf("No.\tPID\tPROCS\tTHR\tCPU%%\tRSS\tREAD\tWRITE\tStatus\tCommand\n");
+}
+
+static void print_usage_row(process_t* job, job_usage_t* usage)
+{
+	char rss[16];
+	char read_bytes[16];
+	char write_bytes[16];
+
+	format_bytes(rss, sizeof(rss), usage->rss);
+	format_bytes(read_bytes, sizeof(read_bytes), usage->read_bytes);
+	format_bytes(write_bytes, sizeof(write_bytes), usage->write_bytes);
+
+	printf("[%d]\t%d\t%d\t%d\t%.1f\t%s\t%s\t%s\t%s\t%s\n", job->index + 1, job->pid,
+		usage->procs, usage->threads, usage->cpu, rss, read_bytes, write_bytes,
+		job->done ? "Done" : "Running", job->command);
+}
+
+/**
+ * "jobs -l", the jobs list with live usage of each job's process tree
+**/
+void print_job_usage(proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager)
+{
+	job_usage_t usage[MAX_BG_PROC];
+
+	if(bg_proc_manager->size == 0)
+	{
+		printf("%s\n", "no jobs running in background");
+		fflush(stdout);
+		return;
+	}
+
+	sample_jobs(monitor, bg_proc_manager, usage);
+
+	print_usage_header();
+
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		if(bg_proc_manager->bg_processes[i] != NULL)
+		{
+			print_usage_row(bg_proc_manager->bg_processes[i], &usage[i]);
+		}
+	}
+
+	//jobs started with set -o pipestats show their pipes below the list
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		if(job != NULL && job->pipe_stats != NULL)
+		{
+			printf("\n[%d] %s\n", job->index + 1, job->command);
+			print_pipe_stats(job->pipe_stats, stdout);
+		}
+	}
+
+	fflush(stdout);
+}
+
+//qsort has no context argument, jtop sets these before sorting
+static job_usage_t* sort_usage;
+static int sort_key;
+
+static int compare_usage(const void* a, const void* b)
+{
+	job_usage_t* first = &sort_usage[*(const int*) a];
+	job_usage_t* second = &sort_usage[*(const int*) b];
+	double x;
+	double y;
+
+	switch(sort_key)
+	{
+		case 'r': x = first->rss; y = second->rss; break;
+		case 'i': x = first->read_bytes + first->write_bytes; y = second->read_bytes + second->write_bytes; break;
+		default: x = first->cpu; y = second->cpu; break;
+	}
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+/**
+ * The "jtop" builtin, a refreshing view of jobs -l sorted by usage
+ * jtop [-d SECS] [-n COUNT] [-s cpu|rss|io]
+ * Refreshes every SECS (default 1) until Ctrl-C or COUNT refreshes,
+ * captured job output keeps being drained in between
+**/
+void jtop_builtin(char** tokens, proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager)
+{
+	double delay = 1;
+	int count = -1;
+	job_usage_t usage[MAX_BG_PROC];
+	int order[MAX_BG_PROC];
+
+	sort_key = 'c';
+	last_status = 0;
+
+	for(int i = 1; tokens[i] != NULL; i++)
+	{
+		if(strcmp(tokens[i], "-d") == 0 && tokens[i+1] != NULL)
+		{
+			delay = atof(tokens[++i]);
+		}
+		else if(strcmp(tokens[i], "-n") == 0 && tokens[i+1] != NULL)
+		{
+			count = atoi(tokens[++i]);
+		}
+		else if(strcmp(tokens[i], "-s") == 0 && tokens[i+1] != NULL &&
+			(strcmp(tokens[i+1], "cpu") == 0 || strcmp(tokens[i+1], "rss") == 0 || strcmp(tokens[i+1], "io") == 0))
+		{
+			sort_key = tokens[++i][0];
+		}
+		else
+		{
+			fprintf(stderr, "usage: jtop [-d SECS] [-n COUNT] [-s cpu|rss|io]\n");
+			last_status = 2;
+			return;
+		}
+	}
+
+	if(delay <= 0)
+	{
+		delay = 1;
+	}
+
+	int tty = isatty(STDOUT_FILENO);
+
+	for(int refresh = 0; (count < 0 || refresh < count) && !interrupted; refresh++)
+	{
+		if(refresh == 0)
+		{
+			sample_jobs(monitor, bg_proc_manager, usage);
+		}
+		else
+		{
+			refresh_job_usage(monitor, bg_proc_manager, usage);
+		}
+
+		int rows = 0;
+		double total_cpu = 0;
+		uint64_t total_rss = 0;
+		char rss[16];
+
+		for(int i = 0; i < MAX_BG_PROC; i++)
+		{
+			if(bg_proc_manager->bg_processes[i] != NULL)
+			{
+				order[rows++] = i;
+				total_cpu += usage[i].cpu;
+				total_rss += usage[i].rss;
+			}
+		}
+
+		sort_usage = usage;
+		qsort(order, rows, sizeof(int), compare_usage);
+
+		format_bytes(rss, sizeof(rss), total_rss);
+
+		if(tty)
+		{
+			printf("\033[H\033[2J");
+		}
+
+		printf("%d jobs, %.1f%% cpu, %s resident, every %.1fs\n\n", rows, total_cpu, rss, delay);
+		print_usage_header();
+
+		for(int i = 0; i < rows; i++)
+		{
+			print_usage_row(bg_proc_manager->bg_processes[order[i]], &usage[order[i]]);
+		}
+
+		fflush(stdout);
+
+		if(count >= 0 && refresh + 1 >= count)
+		{
+			break;
+		}
+
+		//sleep while still draining captured output
+		uint64_t deadline = now_ns() + (uint64_t) (delay * 1e9);
+		uint64_t now;
+
+		while(!interrupted && (now = now_ns()) < deadline)
+		{
+			struct pollfd fds[MAX_BG_PROC];
+			int log_count = job_log_pollfds(bg_proc_manager, fds);
+
+			poll(fds, log_count, (deadline - now + 999999) / 1000000);
+			drain_job_logs(bg_proc_manager);
+		}
+	}
+}
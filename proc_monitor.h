@@ -0,0 +1,76 @@
+#ifndef PROC_MONITOR_H
+#define PROC_MONITOR_H
+#include "shell.h"
+#include <stdint.h>
+
+#define MONITOR_STAT 0
+#define MONITOR_STATM 1
+#define MONITOR_IO 2
+#define MONITOR_CHILDREN 3
+#define MONITOR_FILES 4
+
+//first look at the jobs is measured over this long
+#define MONITOR_BASELINE_MS 200
+
+//an older sample is not used for CPU%, a new baseline is taken
+#define MONITOR_STALE_MS 5000
+
+/**
+ * A process seen in a job's tree, its /proc files stay open
+ * between refreshes and are re-read with pread()
+**/
+typedef struct proc_entry_t
+{
+	pid_t pid;
+	int fds[MONITOR_FILES];
+
+	//utime + stime at the previous sample
+	uint64_t ticks;
+
+	//refresh this entry was last sampled in
+	unsigned int generation;
+
+}proc_entry_t;
+
+/**
+ * Live usage of one job, summed over every process in its tree
+**/
+typedef struct job_usage_t
+{
+	int procs;
+	int threads;
+	double cpu;
+	uint64_t rss;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+
+}job_usage_t;
+
+typedef struct proc_monitor_t
+{
+	proc_entry_t* entries;
+	int count;
+	int capacity;
+
+	//open addressing table from pid to entry, rebuilt after each refresh
+	int* index;
+	int index_size;
+
+	unsigned int generation;
+	uint64_t last_sample;
+	uint64_t interval;
+
+	long ticks_per_sec;
+	long page_size;
+
+}proc_monitor_t;
+
+void init_proc_monitor(proc_monitor_t* monitor);
+
+void refresh_job_usage(proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager, job_usage_t* usage);
+
+void print_job_usage(proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager);
+
+void jtop_builtin(char** tokens, proc_monitor_t* monitor, bg_proc_manager_t* bg_proc_manager);
+
+#endif
@@ -0,0 +1,753 @@
+#include "rc.h"
+#include "shell.h"
+#include "variables.h"
+#include "functions.h"
+#include "control_flow.h"
+#include "input_parser.h"
+#include "stats.h"
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern var_table_t var_table;
+extern function_table_t function_table;
+extern char** environ;
+
+//a record is its kind, a uint32_t word count and the words, each
+//word is a type byte and either its text with the NUL or, for an
+//operator, a byte with its index in the tokenizer's operator text
+#define RECORD_VARIABLE 'v'
+#define RECORD_ALIAS 'a'
+#define RECORD_FUNCTION 'f'
+#define RECORD_SET 's'
+
+#define WORD_TEXT 'w'
+#define WORD_OPERATOR 'o'
+
+static char snapshot_magic[8] = "CSHSNAP";
+
+//environment entries that change between otherwise identical starts,
+//they are left out of the key so an rc that expands one isn't cached
+static char* volatile_env[] = {"PWD=", "OLDPWD=", "SHLVL=", "_=", NULL};
+
+typedef struct snapshot_buf_t
+{
+	char* data;
+	size_t length;
+	size_t capacity;
+
+}snapshot_buf_t;
+
+/**
+ * @return $CSHELLRC, or ~/.cshellrc when it isn't set, NULL if
+ * CSHELLRC is empty or there is no home directory. Free it
+**/
+static char* rc_path()
+{
+	char* path = getenv("CSHELLRC");
+
+	if(path != NULL)
+	{
+		return *path != '\0' ? strdup(path) : NULL;
+	}
+
+	char* home = getenv("HOME");
+
+	if(home == NULL || *home == '\0')
+	{
+		return NULL;
+	}
+
+	size_t length = strlen(home) + sizeof("/.cshellrc");
+	char* rc = malloc(length);
+
+	if(rc == NULL)
+	{
+		perror("Could not allocate memory for rc path");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(rc, length, "%s/.cshellrc", home);
+	return rc;
+}
+
+static char* snapshot_path(char* rc, char* suffix)
+{
+	size_t length = strlen(rc) + strlen(suffix) + 1;
+	char* path = malloc(length);
+
+	if(path == NULL)
+	{
+		perror("Could not allocate memory for snapshot path");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(path, length, "%s%s", rc, suffix);
+	return path;
+}
+
+static uint64_t fnv_add(uint64_t hash, char* text)
+{
+	//the NUL ends each string so "A=bc" "d" and "A=b" "cd" differ
+	for(char* c = text; ; c++)
+	{
+		hash = (hash ^ (unsigned char) *c) * 1099511628211ULL;
+
+		if(*c == '\0')
+		{
+			return hash;
+		}
+	}
+}
+
+/**
+ * FNV-1a over the environment, an rc file that expands $HOME or
+ * $PATH gives other definitions under another environment
+**/
+static uint64_t env_hash()
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for(char** entry = environ; *entry != NULL; entry++)
+	{
+		int skip = 0;
+
+		for(int i = 0; volatile_env[i] != NULL && !skip; i++)
+		{
+			skip = strncmp(*entry, volatile_env[i], strlen(volatile_env[i])) == 0;
+		}
+
+		if(skip)
+		{
+			continue;
+		}
+
+		hash = fnv_add(hash, *entry);
+	}
+	return hash;
+}
+
+/**
+ * Operators are saved by index, a build whose operators differ
+ * gets a different hash and ignores the snapshot
+**/
+static uint64_t operators_hash()
+{
+	uint64_t hash = 14695981039346656037ULL;
+	char* op;
+
+	for(int index = 0; (op = operator_at(index)) != NULL; index += strlen(op) + 1)
+	{
+		hash = fnv_add(hash, op);
+	}
+	return hash;
+}
+
+static void put(snapshot_buf_t* buf, const void* bytes, size_t length)
+{
+	if(buf->length + length > buf->capacity)
+	{
+		buf->capacity = (buf->length + length) * 2;
+		buf->data = realloc(buf->data, buf->capacity);
+
+		if(buf->data == NULL)
+		{
+			perror("Could not grow snapshot");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(buf->data + buf->length, bytes, length);
+	buf->length += length;
+}
+
+static void put_record(snapshot_buf_t* buf, char kind, char** words, uint32_t count)
+{
+	put(buf, &kind, 1);
+	put(buf, &count, sizeof(count));
+
+	for(uint32_t i = 0; i < count; i++)
+	{
+		if(is_any_operator(words[i]))
+		{
+			int index = operator_index(words[i]);
+			char op[] = {WORD_OPERATOR, index & 0xff, index >> 8};
+
+			put(buf, op, sizeof(op));
+			continue;
+		}
+
+		char type = WORD_TEXT;
+
+		put(buf, &type, 1);
+		put(buf, words[i], strlen(words[i]) + 1);
+	}
+}
+
+/**
+ * @return 1 if word expands $NAME or ${NAME} for a name in
+ * volatile_env, whose value the snapshot key doesn't cover
+**/
+static int expands_volatile(char* word)
+{
+	for(char* dollar = strchr(word, '$'); dollar != NULL; dollar = strchr(dollar + 1, '$'))
+	{
+		char* name = dollar[1] == '{' ? dollar + 2 : dollar + 1;
+		size_t length = 0;
+
+		while(isalnum((unsigned char) name[length]) || name[length] == '_')
+		{
+			length++;
+		}
+
+		for(int i = 0; volatile_env[i] != NULL && length > 0; i++)
+		{
+			if(strlen(volatile_env[i]) == length + 1 && strncmp(name, volatile_env[i], length) == 0)
+			{
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/**
+ * An rc file is cached only when running it can't do more than the
+ * snapshot restores: define functions and aliases, assign variables
+ * and set options. Anything that runs a command or prints is run
+ * again on every start
+ * @return NULL if program can be cached, else the command that can't
+**/
+static char* uncacheable_command(program_t* program)
+{
+	for(int pc = 0; pc < program->length; pc++)
+	{
+		instruction_t* instruction = &program->code[pc];
+
+		if(instruction->op == OP_FUNCTION)
+		{
+			continue;
+		}
+
+		if(instruction->op != OP_EXEC)
+		{
+			return "if/while/for";
+		}
+
+		char** words = instruction->words;
+		int count = instruction->word_count;
+		int pure = 1;
+
+		for(int i = 0; i < count && pure; i++)
+		{
+			pure = !is_any_operator(words[i]);
+		}
+
+		if(!pure || count == 0)
+		{
+			return words[0];
+		}
+
+		if(strcmp(words[0], "alias") == 0 || strcmp(words[0], "set") == 0)
+		{
+			//alias NAME and a bare set or alias print instead of defining
+			pure = count > 1 && !(words[0][0] == 's' && instruction->expand);
+
+			for(int i = 1; i < count && pure && words[0][0] == 'a'; i++)
+			{
+				pure = strchr(words[i], '=') != NULL;
+			}
+		}
+		else if(strcmp(words[0], "unalias") != 0)
+		{
+			for(int i = 0; i < count && pure; i++)
+			{
+				pure = is_assignment(words[i]);
+			}
+		}
+
+		//a value taken from $PWD and the like would be frozen into the snapshot
+		for(int i = 0; i < count && pure && instruction->expand; i++)
+		{
+			pure = !expands_volatile(words[i]);
+		}
+
+		if(!pure)
+		{
+			return words[0];
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Writes what evaluating the rc file left in the tables, the file
+ * is written aside and renamed so a concurrent start never maps half
+ * of one. A home directory that can't be written just means no cache
+ * @return 0 once written, -1 if not
+**/
+static int save_snapshot(char* rc, struct stat* rc_stat, uint64_t hash, program_t* program)
+{
+	snapshot_buf_t buf = {NULL, 0, 0};
+	rc_snapshot_header_t header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+	header.version = RC_SNAPSHOT_VERSION;
+	header.rc_mtime_sec = rc_stat->st_mtim.tv_sec;
+	header.rc_mtime_nsec = rc_stat->st_mtim.tv_nsec;
+	header.rc_size = rc_stat->st_size;
+	header.rc_inode = rc_stat->st_ino;
+	header.env_hash = hash;
+	header.operators_hash = operators_hash();
+
+	put(&buf, &header, sizeof(header));
+
+	for(int i = 0; i < var_table.size; i++)
+	{
+		char* words[] = {var_table.vars[i].name, var_table.vars[i].value};
+
+		put_record(&buf, RECORD_VARIABLE, words, 2);
+		header.record_count++;
+	}
+
+	for(int i = 0; i < function_table.alias_count; i++)
+	{
+		alias_t* alias = &function_table.aliases[i];
+		char* words[alias->token_count + 2];
+
+		memcpy(words, alias->tokens, sizeof(char*) * alias->token_count);
+		words[alias->token_count] = alias->name;
+		words[alias->token_count + 1] = alias->text;
+
+		put_record(&buf, RECORD_ALIAS, words, alias->token_count + 2);
+		header.record_count++;
+	}
+
+	for(int i = 0; i < function_table.count; i++)
+	{
+		function_body_t* body = function_table.functions[i].body;
+		char** tokens = body->program != NULL ? body->program->tokens : body->words;
+		int count = body->program != NULL ? body->program->token_count : body->word_count;
+		char* words[count + 1];
+
+		memcpy(words, tokens, sizeof(char*) * count);
+		words[count] = function_table.functions[i].name;
+
+		put_record(&buf, RECORD_FUNCTION, words, count + 1);
+		header.record_count++;
+	}
+
+	//options are kept as the set commands and run again on load
+	for(int pc = 0; pc < program->length; pc++)
+	{
+		instruction_t* instruction = &program->code[pc];
+
+		if(instruction->op == OP_EXEC && strcmp(instruction->words[0], "set") == 0)
+		{
+			put_record(&buf, RECORD_SET, instruction->words, instruction->word_count);
+			header.record_count++;
+		}
+	}
+
+	header.data_length = buf.length - sizeof(header);
+	memcpy(buf.data, &header, sizeof(header));
+
+	char* path = snapshot_path(rc, ".snap");
+	char* temp = snapshot_path(rc, ".snap.tmp");
+	int result = -1;
+	int fd = open(temp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+	if(fd != -1)
+	{
+		ssize_t written = write(fd, buf.data, buf.length);
+
+		close(fd);
+
+		if(written == (ssize_t) buf.length && rename(temp, path) == 0)
+		{
+			result = 0;
+		}
+		else
+		{
+			unlink(temp);
+		}
+	}
+
+	free(path);
+	free(temp);
+	free(buf.data);
+	return result;
+}
+
+/**
+ * Reads one record, words are pointed at in the mapping and operators
+ * are swapped back for the tokenizer's own operator tokens
+ * @param words set to a NULL terminated array to free, or NULL
+ * to only check the record
+ * @return the record's end, NULL if the record is damaged
+**/
+static char* read_record(char* at, char* end, char* kind, char*** words, uint32_t* count)
+{
+	if(end - at < 1 + (long) sizeof(uint32_t))
+	{
+		return NULL;
+	}
+
+	*kind = *at++;
+	memcpy(count, at, sizeof(uint32_t));
+	at += sizeof(uint32_t);
+
+	//every word takes two bytes at least
+	if(*count == 0 || *count > (uint32_t) (end - at) / 2)
+	{
+		return NULL;
+	}
+
+	char** record = NULL;
+
+	if(words != NULL)
+	{
+		record = malloc(sizeof(char*) * (*count + 1));
+
+		if(record == NULL)
+		{
+			perror("Could not allocate memory for snapshot record");
+			exit(EXIT_FAILURE);
+		}
+		record[*count] = NULL;
+		*words = record;
+	}
+
+	for(uint32_t i = 0; i < *count; i++)
+	{
+		char* word = NULL;
+		char* next = NULL;
+
+		if(end - at >= 3 && *at == WORD_OPERATOR)
+		{
+			word = operator_at((unsigned char) at[1] | (unsigned char) at[2] << 8);
+			next = at + 3;
+		}
+		else if(end - at >= 2 && *at == WORD_TEXT)
+		{
+			word = at + 1;
+			next = memchr(word, '\0', end - word);
+			next = next != NULL ? next + 1 : NULL;
+		}
+
+		if(word == NULL || next == NULL)
+		{
+			free(record);
+			return NULL;
+		}
+
+		if(record != NULL)
+		{
+			record[i] = word;
+		}
+		at = next;
+	}
+
+	return at;
+}
+
+/**
+ * Maps the snapshot and restores its definitions, nothing of the rc
+ * file is tokenized and function bodies are compiled on first call
+ * @return 0 if the snapshot was current and loaded, -1 if not
+**/
+static int load_snapshot(char* rc, struct stat* rc_stat, uint64_t hash, rc_load_t* load)
+{
+	char* path = snapshot_path(rc, ".snap");
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	struct stat snap_stat;
+
+	free(path);
+
+	if(fd == -1)
+	{
+		return -1;
+	}
+
+	if(fstat(fd, &snap_stat) == -1 || snap_stat.st_size < (off_t) sizeof(rc_snapshot_header_t))
+	{
+		close(fd);
+		return -1;
+	}
+
+	//private and writable so nothing that is handed a word can fault on it
+	char* map = mmap(NULL, snap_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	if(map == MAP_FAILED)
+	{
+		return -1;
+	}
+
+	rc_snapshot_header_t header;
+
+	memcpy(&header, map, sizeof(header));
+
+	if(memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0 || header.version != RC_SNAPSHOT_VERSION ||
+		header.rc_mtime_sec != rc_stat->st_mtim.tv_sec || header.rc_mtime_nsec != rc_stat->st_mtim.tv_nsec ||
+		header.rc_size != (uint64_t) rc_stat->st_size || header.rc_inode != (uint64_t) rc_stat->st_ino ||
+		header.env_hash != hash || header.operators_hash != operators_hash() || header.data_length != snap_stat.st_size - sizeof(header))
+	{
+		munmap(map, snap_stat.st_size);
+		return -1;
+	}
+
+	char* end = map + snap_stat.st_size;
+	char* at = map + sizeof(header);
+
+	//the whole file is checked before anything in it is used
+	for(uint32_t i = 0; i < header.record_count; i++)
+	{
+		char kind;
+		uint32_t count;
+
+		at = read_record(at, end, &kind, NULL, &count);
+
+		if(at == NULL)
+		{
+			munmap(map, snap_stat.st_size);
+			return -1;
+		}
+
+		if(!((kind == RECORD_VARIABLE && count == 2) || (kind == RECORD_ALIAS && count >= 3) ||
+			(kind == RECORD_FUNCTION && count >= 2) || kind == RECORD_SET))
+		{
+			munmap(map, snap_stat.st_size);
+			return -1;
+		}
+	}
+
+	at = map + sizeof(header);
+
+	//function bodies and alias tokens point into the mapping from here
+	//on, so it stays mapped for the life of the shell
+	for(uint32_t i = 0; i < header.record_count; i++)
+	{
+		char kind;
+		char** words;
+		uint32_t count;
+
+		at = read_record(at, end, &kind, &words, &count);
+
+		if(kind == RECORD_VARIABLE)
+		{
+			set_var(&var_table, words[0], words[1]);
+			load->variables++;
+			free(words);
+		}
+		else if(kind == RECORD_ALIAS)
+		{
+			//the alias's tokens come first, then its name and text
+			char* name = words[count - 2];
+			char* text = words[count - 1];
+
+			words[count - 2] = NULL;
+			declare_alias(&function_table, name, text, words, count - 2);
+			load->aliases++;
+		}
+		else if(kind == RECORD_FUNCTION)
+		{
+			//the body comes first and the name last
+			char* name = words[count - 1];
+
+			words[count - 1] = NULL;
+			declare_function(&function_table, name, words, count - 1);
+			load->functions++;
+		}
+		else
+		{
+			set_builtin(words);
+			load->options++;
+			free(words);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Blanks lines that start with #, the tokenizer has no comments
+**/
+static void strip_comments(char* text)
+{
+	char* line = text;
+
+	while(*line != '\0')
+	{
+		char* c = line + strspn(line, " \t");
+		char* newline = strchr(line, '\n');
+
+		if(*c == '#')
+		{
+			memset(c, ' ', newline != NULL ? (size_t) (newline - c) : strlen(c));
+		}
+
+		if(newline == NULL)
+		{
+			break;
+		}
+		line = newline + 1;
+	}
+}
+
+/**
+ * Reads the whole rc file and runs it as one program
+ * @return the program that ran, NULL if the file couldn't be read
+ * or parsed, free it with free_program()
+**/
+static program_t* evaluate_rc(char* rc, struct stat* rc_stat)
+{
+	int fd = open(rc, O_RDONLY | O_CLOEXEC);
+
+	if(fd == -1)
+	{
+		fprintf(stderr, "%s: %s\n", rc, strerror(errno));
+		return NULL;
+	}
+
+	char* text = malloc(rc_stat->st_size + 1);
+
+	if(text == NULL)
+	{
+		perror("Could not allocate memory for rc file");
+		exit(EXIT_FAILURE);
+	}
+
+	ssize_t length = read(fd, text, rc_stat->st_size);
+
+	close(fd);
+
+	if(length < 0)
+	{
+		fprintf(stderr, "%s: %s\n", rc, strerror(errno));
+		free(text);
+		return NULL;
+	}
+
+	text[length] = '\0';
+	strip_comments(text);
+
+	int token_count;
+	int incomplete;
+	int result;
+
+	char** tokens = tokenize(text, &token_count, &incomplete);
+
+	free(text);
+
+	program_t* program = tokens != NULL ? compile_program(tokens, token_count, &result) : NULL;
+
+	if(program == NULL)
+	{
+		fprintf(stderr, "%s: %s\n", rc, incomplete || (tokens != NULL && result == COMPILE_INCOMPLETE) ? "unexpected end of file" : "syntax error");
+		free_tokens(tokens);
+		return NULL;
+	}
+
+	run_program(program);
+
+	return program;
+}
+
+/**
+ * Loads ~/.cshellrc, or $CSHELLRC, at startup. The definitions it
+ * leaves are saved next to it as FILE.snap and later starts map that
+ * instead, for as long as the rc file's mtime, size and inode and the
+ * environment are the same
+**/
+void load_rc(rc_load_t* load)
+{
+	uint64_t start = now_ns();
+	struct stat rc_stat;
+
+	memset(load, 0, sizeof(rc_load_t));
+	load->path = rc_path();
+
+	if(load->path == NULL || stat(load->path, &rc_stat) == -1)
+	{
+		return;
+	}
+
+	uint64_t hash = env_hash();
+
+	if(load_snapshot(load->path, &rc_stat, hash, load) == 0)
+	{
+		load->source = RC_SNAPSHOT;
+		load->load_ns = now_ns() - start;
+		return;
+	}
+
+	program_t* program = evaluate_rc(load->path, &rc_stat);
+
+	load->source = RC_EVALUATED;
+	load->variables = var_table.size;
+	load->aliases = function_table.alias_count;
+	load->functions = function_table.count;
+
+	if(program != NULL)
+	{
+		for(int pc = 0; pc < program->length; pc++)
+		{
+			load->options += program->code[pc].op == OP_EXEC && strcmp(program->code[pc].words[0], "set") == 0;
+		}
+
+		load->uncacheable = uncacheable_command(program);
+
+		if(load->uncacheable == NULL)
+		{
+			load->snapshot_written = save_snapshot(load->path, &rc_stat, hash, program) == 0;
+		}
+		else
+		{
+			load->uncacheable = strdup(load->uncacheable);
+		}
+
+		free_program(program);
+	}
+
+	load->load_ns = now_ns() - start;
+}
+
+/**
+ * The report of --startup-bench
+ * @param startup_ns from entering main() to the first prompt
+**/
+void print_rc_load(rc_load_t* load, uint64_t startup_ns)
+{
+	printf("rc file\t\t%s\n", load->path != NULL ? load->path : "none");
+
+	if(load->source == RC_SNAPSHOT)
+	{
+		printf("loaded from\tsnapshot\n");
+	}
+	else if(load->source == RC_EVALUATED && load->uncacheable != NULL)
+	{
+		printf("loaded from\tevaluation, not cached because of '%s'\n", load->uncacheable);
+	}
+	else if(load->source == RC_EVALUATED)
+	{
+		printf("loaded from\tevaluation, snapshot %s\n", load->snapshot_written ? "written" : "could not be written");
+	}
+	else
+	{
+		printf("loaded from\tnothing, no rc file\n");
+	}
+
+	printf("definitions\t%d variables, %d aliases, %d functions, %d options\n", load->variables, load->aliases, load->functions, load->options);
+	printf("rc load\t\t%.3f ms\n", load->load_ns / 1e6);
+	printf("startup\t\t%.3f ms\n", startup_ns / 1e6);
+	fflush(stdout);
+}
@@ -0,0 +1,59 @@
+#ifndef RC_H
+#define RC_H
+#include <stdint.h>
+
+//bumped whenever the snapshot layout changes
+#define RC_SNAPSHOT_VERSION 2
+
+//where the definitions of the rc file came from
+#define RC_NONE 0
+#define RC_EVALUATED 1
+#define RC_SNAPSHOT 2
+
+/**
+ * Start of a snapshot file, the records follow. A snapshot is only
+ * used while the rc file and the environment still match the key
+**/
+typedef struct rc_snapshot_header_t
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t record_count;
+
+	int64_t rc_mtime_sec;
+	int64_t rc_mtime_nsec;
+	uint64_t rc_size;
+	uint64_t rc_inode;
+	uint64_t env_hash;
+	uint64_t operators_hash;
+
+	uint64_t data_length;
+
+}rc_snapshot_header_t;
+
+/**
+ * What loading the rc file did, printed by --startup-bench
+**/
+typedef struct rc_load_t
+{
+	char* path;
+	int source;
+	int snapshot_written;
+
+	//first command that keeps the rc file from being cached, NULL if none
+	char* uncacheable;
+
+	int variables;
+	int aliases;
+	int functions;
+	int options;
+
+	uint64_t load_ns;
+
+}rc_load_t;
+
+void load_rc(rc_load_t* load);
+
+void print_rc_load(rc_load_t* load, uint64_t startup_ns);
+
+#endif
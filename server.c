@@ -0,0 +1,361 @@
+#include "server.h"
+#include "shell.h"
+#include "input_parser.h"
+#include "stats.h"
+#include "pipe_stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+extern int last_status;
+extern pipe_stats_config_t pipe_stats_config;
+
+static volatile sig_atomic_t stop_server = 0;
+
+//connection the reply goes to, set only inside a request worker
+static int reply_fd = -1;
+static pid_t reply_owner;
+static uint64_t request_start;
+
+/**
+ * Reaps request workers without printing anything, the server
+ * has no prompt and workers are not jobs
+**/
+static void server_sig_chld_handler(int sig)
+{
+	int saved_errno = errno;
+
+	while(waitpid(-1, NULL, WNOHANG) > 0)
+	{
+	}
+
+	errno = saved_errno;
+}
+
+static void server_stop_handler(int sig)
+{
+	stop_server = 1;
+}
+
+/**
+ * Reads exactly len bytes unless the peer goes away first
+ * @return 0 on success, -1 on error or early EOF
+**/
+static int read_full(int fd, void* buf, size_t len)
+{
+	char* pos = buf;
+
+	while(len > 0)
+	{
+		ssize_t n = read(fd, pos, len);
+
+		if(n < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(n <= 0)
+		{
+			return -1;
+		}
+
+		pos += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Receives the request header along with the client's stdio descriptors
+ * @param conn connected client socket
+ * @param header filled in from the client
+ * @param fds receives stdin, stdout and stderr of the client
+ * @return 0 on success, -1 if the request is malformed
+**/
+static int receive_request(int conn, server_request_t* header, int fds[3])
+{
+	union
+	{
+		char buf[CMSG_SPACE(sizeof(int) * 3)];
+		struct cmsghdr align;
+	}control;
+
+	struct iovec iov = {header, sizeof(server_request_t)};
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	ssize_t n;
+
+	do
+	{
+		n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+	}while(n < 0 && errno == EINTR);
+
+	if(n <= 0)
+	{
+		return -1;
+	}
+
+	struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+	if(cmsg == NULL || (msg.msg_flags & MSG_CTRUNC) || cmsg->cmsg_level != SOL_SOCKET
+		|| cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int) * 3))
+	{
+		fprintf(stderr, "server: request did not carry stdio descriptors\n");
+		return -1;
+	}
+
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * 3);
+
+	//a stream socket may split the header even though it was sent in one go
+	if(n < sizeof(server_request_t) && read_full(conn, (char*) header + n, sizeof(server_request_t) - n) < 0)
+	{
+		for(int i = 0; i < 3; i++)
+		{
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	if(header->magic != SERVER_MAGIC || header->length > SERVER_MAX_REQUEST)
+	{
+		fprintf(stderr, "server: bad request header\n");
+		for(int i = 0; i < 3; i++)
+		{
+			close(fds[i]);
+		}
+		return -1;
+	}
+
+	return 0;
+}
+
+static int64_t timeval_us(struct timeval* tv)
+{
+	return (int64_t) tv->tv_sec * 1000000 + tv->tv_usec;
+}
+
+/**
+ * Sends the exit status and rusage of the request back to the client,
+ * registered with atexit so the exit builtin still answers
+**/
+static void send_server_reply()
+{
+	//children that fail to exec also run atexit handlers
+	if(reply_fd < 0 || getpid() != reply_owner)
+	{
+		return;
+	}
+
+	//output has to reach the client before it sees the reply
+	fflush(stdout);
+	fflush(stderr);
+
+	struct rusage usage;
+	server_reply_t reply;
+
+	memset(&reply, 0, sizeof(reply));
+	getrusage(RUSAGE_CHILDREN, &usage);
+
+	reply.status = last_status;
+	reply.wall_us = (now_ns() - request_start) / 1000;
+	reply.user_us = timeval_us(&usage.ru_utime);
+	reply.sys_us = timeval_us(&usage.ru_stime);
+	reply.max_rss_kb = usage.ru_maxrss;
+	reply.minor_faults = usage.ru_minflt;
+	reply.major_faults = usage.ru_majflt;
+	reply.voluntary_switches = usage.ru_nvcsw;
+	reply.involuntary_switches = usage.ru_nivcsw;
+	reply.pipe_bytes = pipe_stats_config.total_bytes;
+	reply.pipe_read_wait_us = pipe_stats_config.total_read_wait_ns / 1000;
+	reply.pipe_write_wait_us = pipe_stats_config.total_write_wait_ns / 1000;
+
+	if(send(reply_fd, &reply, sizeof(reply), MSG_NOSIGNAL) != sizeof(reply))
+	{
+		perror("server: could not send reply");
+	}
+
+	close(reply_fd);
+	reply_fd = -1;
+}
+
+/**
+ * Runs one request inside a freshly forked worker, the client's descriptors
+ * become the worker's stdio and the command goes through the same path as
+ * an interactive line, the worker never returns
+ * @param conn connected client socket
+**/
+static void handle_request(int conn)
+{
+	server_request_t header;
+	int fds[3];
+
+	request_start = now_ns();
+
+	if(receive_request(conn, &header, fds) < 0)
+	{
+		_exit(EXIT_FAILURE);
+	}
+
+	char* body = malloc(header.length + 1);
+
+	if(body == NULL)
+	{
+		perror("Could not allocate memory for request");
+		_exit(EXIT_FAILURE);
+	}
+
+	if(read_full(conn, body, header.length) < 0)
+	{
+		fprintf(stderr, "server: request was cut short\n");
+		_exit(EXIT_FAILURE);
+	}
+
+	body[header.length] = '\0';
+
+	for(int i = 0; i < 3; i++)
+	{
+		if(dup2(fds[i], i) < 0)
+		{
+			perror("server: dup2");
+			_exit(EXIT_FAILURE);
+		}
+		close(fds[i]);
+	}
+
+	//the worker behaves like the interactive shell from here on
+	signal(SIGTERM, SIG_DFL);
+	register_signal_handler();
+	register_sig_chld_handler();
+
+	reply_fd = conn;
+	reply_owner = getpid();
+	atexit(send_server_reply);
+
+	last_status = 0;
+
+	char* command = remove_whitespace(body);
+	free(body);
+
+	if(command != NULL)
+	{
+		run_command_line(command, 0);
+	}
+
+	exit(last_status);
+}
+
+/**
+ * Serves command lines from local clients until SIGINT or SIGTERM,
+ * every request runs in its own forked worker so a slow command
+ * never holds up other clients
+ * @param socket_path filesystem path of the AF_UNIX socket
+ * @return exit status for the shell
+**/
+int run_server(const char* socket_path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+
+	if(strlen(socket_path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "server: socket path too long: %s\n", socket_path);
+		return EXIT_FAILURE;
+	}
+
+	strcpy(addr.sun_path, socket_path);
+
+	//only a stale socket gets replaced, never a regular file
+	if(lstat(socket_path, &st) == 0)
+	{
+		if(!S_ISSOCK(st.st_mode))
+		{
+			fprintf(stderr, "server: %s exists and is not a socket\n", socket_path);
+			return EXIT_FAILURE;
+		}
+		unlink(socket_path);
+	}
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	if(listen_fd < 0)
+	{
+		perror("server: socket");
+		return EXIT_FAILURE;
+	}
+
+	if(bind(listen_fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(listen_fd, SOMAXCONN) < 0)
+	{
+		perror("server: bind");
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	//no SA_RESTART so a stop signal breaks out of accept()
+	struct sigaction stop_action;
+
+	memset(&stop_action, 0, sizeof(stop_action));
+	stop_action.sa_handler = server_stop_handler;
+	sigemptyset(&stop_action.sa_mask);
+	sigaction(SIGINT, &stop_action, NULL);
+	sigaction(SIGTERM, &stop_action, NULL);
+
+	if(signal(SIGCHLD, server_sig_chld_handler) == SIG_ERR)
+	{
+		perror("Could not register signals");
+		exit(EXIT_FAILURE);
+	}
+
+	fprintf(stderr, "server: listening on %s\n", socket_path);
+
+	while(!stop_server)
+	{
+		int conn = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+
+		if(conn < 0)
+		{
+			if(errno != EINTR && errno != ECONNABORTED)
+			{
+				perror("server: accept");
+			}
+			continue;
+		}
+
+		pid_t pid = fork();
+
+		if(pid < 0)
+		{
+			perror("server: fork");
+		}
+
+		else if(pid == 0)
+		{
+			close(listen_fd);
+			handle_request(conn);
+		}
+
+		close(conn);
+	}
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	return EXIT_SUCCESS;
+}
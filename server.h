@@ -0,0 +1,44 @@
+#ifndef SERVER_H
+#define SERVER_H
+#include <stdint.h>
+
+//"CSH1", sent first so stray connections are rejected early
+#define SERVER_MAGIC 0x43534831
+#define SERVER_MAX_REQUEST (1 << 20)
+
+/**
+ * Sent by the client in a single sendmsg() along with its stdin,
+ * stdout and stderr as SCM_RIGHTS, the command line follows
+**/
+typedef struct server_request_t
+{
+	uint32_t magic;
+	uint32_t length;
+}server_request_t;
+
+/**
+ * Sent back once the request is finished, the rusage fields
+ * cover every child the request waited for
+**/
+typedef struct server_reply_t
+{
+	int32_t status;
+	int32_t reserved;
+	int64_t wall_us;
+	int64_t user_us;
+	int64_t sys_us;
+	int64_t max_rss_kb;
+	int64_t minor_faults;
+	int64_t major_faults;
+	int64_t voluntary_switches;
+	int64_t involuntary_switches;
+
+	//set -o pipestats figures, summed over the request's pipes
+	int64_t pipe_bytes;
+	int64_t pipe_read_wait_us;
+	int64_t pipe_write_wait_us;
+}server_reply_t;
+
+int run_server(const char* socket_path);
+
+#endif
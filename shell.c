@@ -7,66 +7,250 @@
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
+#include <spawn.h>
 #include "input_parser.h"
 #include "shell.h"
 #include "utils.h"
+#include "variables.h"
+#include "control_flow.h"
+#include "stats.h"
+#include "trace.h"
+#include "launch_opts.h"
+#include "fanout.h"
+#include "job_wait.h"
+#include "server.h"
+#include "job_log.h"
+#include "dag.h"
+#include "proc_monitor.h"
+#include "notify.h"
+#include "alloc_stats.h"
+#include "functions.h"
+#include "line_reader.h"
+#include "fd_table.h"
+#include "pipe_stats.h"
+#include "coproc.h"
+#include "rc.h"
+#include "stage_stderr.h"
+#include "plan.h"
 
 #define MAX_LINE 4096
 
-INPUT_PARSER* input_parser;
-
 pid_t child_pid;
 
 bg_proc_manager_t bg_proc_manager;
 process_t* bg_processes[MAX_BG_PROC];
 command_history_t command_history;
+var_table_t var_table;
+stats_t stats;
+trace_t tracer;
+
+//affinity, nice and ulimit given without a command apply to every later job
+launch_opts_t default_launch_opts;
+
+//set with the joblog builtin, applies to jobs started afterwards
+job_log_config_t job_log_config;
+
+//keeps /proc descriptors of job processes open between jobs -l and jtop refreshes
+proc_monitor_t proc_monitor;
+
+//finished background jobs, filled by the SIGCHLD handler and printed before the prompt
+notify_queue_t notify_queue;
+
+//shell functions and aliases, kept compiled
+function_table_t function_table;
+
+//buffered standard input of the read builtin
+line_reader_t line_reader;
+
+//descriptors the shell keeps open through exec
+fd_table_t fd_table;
+
+//set -o pipestats and what the instrumented pipes moved so far
+pipe_stats_config_t pipe_stats_config;
+
+//helpers started with coproc and the pipe ends the shell keeps
+coproc_table_t coproc_table;
+
+//set -o pipeerr, pipeline stages' stderr is merged behind stage prefixes
+int pipe_err_enabled;
+
+//exit status of the last command, used by if/while and $?
+int last_status;
+
+//set by SIGINT so a running loop stops at the next instruction
+volatile sig_atomic_t interrupted;
 
 /**
- * Function gets the command from the user and 
- * calls the remove whitespace to return a cleaned command
- * @return a trimmed command, NULL if errors on malloc
- * or read
+ * Function gets the next line from the user, anything read past
+ * the newline is kept for the next call so scripts piped into the
+ * shell run line by line
+ * @param trim 1 to call remove whitespace for a cleaned command,
+ * 0 to keep the line as typed
+ * @return the line, NULL if trimming leaves it empty or on a read error
 **/
-char* get_command()
+static char* read_line(int trim)
 {
-	char* buf = malloc(MAX_LINE);
+	static char* buf = NULL;
+	static int buf_len = 0;
+	static int buf_capacity = 0;
 
-	if(!buf)
-	{
-		perror("Could not allocate memory for buffer");
-		exit(EXIT_FAILURE);
-	}
+	char* newline;
 
-	int bytes_read = read(STDIN_FILENO,buf,MAX_LINE-1);
+	trace_event(&tracer,'B',"read_line",0,NULL);
 
-	if(bytes_read < 0)
+	while((newline = memchr(buf, '\n', buf_len)) == NULL)
 	{
-		perror("Error reading from standard in");
-		return NULL;
+		if(buf_len + MAX_LINE > buf_capacity)
+		{
+			buf_capacity = buf_len + MAX_LINE;
+			buf = realloc(buf, buf_capacity);
+
+			if(!buf)
+			{
+				perror("Could not allocate memory for buffer");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		//captured background output is drained while the shell sits here
+		wait_for_input(STDIN_FILENO, &bg_proc_manager, &notify_queue);
+
+		int bytes_read = read(STDIN_FILENO,buf+buf_len,MAX_LINE-1);
+
+		if(bytes_read < 0)
+		{
+			perror("Error reading from standard in");
+			return NULL;
+		}
+
+		if(bytes_read == 0)
+		{
+			//a last line without a newline still gets run
+			if(buf_len > 0)
+			{
+				newline = buf + buf_len;
+				break;
+			}
+
+			free(buf);
+			free_history(&command_history);
+			free_var_table(&var_table);
+			exit(last_status);
+		}
+
+		buf_len += bytes_read;
 	}
 
-	if(bytes_read == 0)
+	trace_event(&tracer,'E',"read_line",0,NULL);
+
+	int line_len = newline - buf;
+
+	buf[line_len] = '\0';
+
+	char* cleaned_command = trim ? remove_whitespace(buf) : strdup(buf);
+
+	if(cleaned_command == NULL && !trim)
 	{
-		free(buf);
-		free_history(&command_history);
-		exit(EXIT_SUCCESS);
+		perror("Could not allocate memory for line");
+		exit(EXIT_FAILURE);
 	}
 
-	buf[bytes_read] = '\0';
-
-	char* cleaned_command = remove_whitespace(buf);
+	//shift whatever is left over to the front of the buffer
+	int consumed = line_len < buf_len ? line_len + 1 : buf_len;
 
-	free(buf);
+	memmove(buf, buf + consumed, buf_len - consumed);
+	buf_len -= consumed;
 
 	return cleaned_command;
 }
 
-int main()
+/**
+ * @return the next line trimmed, NULL if it is empty or on a read error
+**/
+char* get_command()
+{
+	return read_line(1);
+}
+
+/**
+ * Reads a line that continues an open quote, its blanks are part
+ * of the string so nothing is trimmed and an empty line is kept
+ * @return the line as typed, NULL on a read error
+**/
+char* get_raw_line()
+{
+	return read_line(0);
+}
+
+int main(int argc, char** argv)
 {
+	uint64_t startup = now_ns();
+	char* socket_path = NULL;
+	int norc = 0;
+	int startup_bench = 0;
+	rc_load_t rc_load;
+
+	for(int i = 1; i < argc; i++)
+	{
+		if(strcmp(argv[i], "--server") == 0 && i + 1 < argc)
+		{
+			socket_path = argv[++i];
+		}
+		else if(strcmp(argv[i], "--norc") == 0)
+		{
+			norc = 1;
+		}
+		else if(strcmp(argv[i], "--startup-bench") == 0)
+		{
+			startup_bench = 1;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--norc] [--startup-bench] [--server SOCKET]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	init_notify_queue(&notify_queue);
 	register_signal_handler();
 	register_sig_chld_handler();
 	init_bg_proc_manager(&bg_proc_manager);
 	init_command_hist_arr(&command_history);
+	init_var_table(&var_table);
+	init_function_table(&function_table);
+	init_line_reader(&line_reader, STDIN_FILENO);
+	init_fd_table(&fd_table);
+	init_pipe_stats_config(&pipe_stats_config);
+	init_coproc_table(&coproc_table);
+	init_stats(&stats);
+	init_trace(&tracer);
+	init_launch_opts(&default_launch_opts);
+	init_job_log_config(&job_log_config);
+	init_proc_monitor(&proc_monitor);
+	atexit(flush_trace_at_exit);
+
+	//definitions from ~/.cshellrc, mapped from its snapshot when current
+	if(!norc)
+	{
+		load_rc(&rc_load);
+	}
+
+	if(startup_bench)
+	{
+		if(norc)
+		{
+			memset(&rc_load, 0, sizeof(rc_load));
+		}
+		print_rc_load(&rc_load, now_ns() - startup);
+		return EXIT_SUCCESS;
+	}
+
+	if(socket_path != NULL)
+	{
+		return run_server(socket_path);
+	}
+
 	while(1)
 	{
 		run_shell();
@@ -77,130 +261,339 @@ int main()
 
 /**
  * Method will run our shell which is called in a loop in main
- * Will exit program if errors on system calls such as fork() or execvp()
+ * Lines that open an if, for or while block keep reading until
+ * the block is closed, then the whole thing is compiled once
+ * and run by the bytecode interpreter
 **/
 void run_shell()
 {
-	char* tokens[1000];
+	interrupted = 0;
+
+	//jobs that finished while the last command ran
+	if(has_job_notices(&notify_queue))
+	{
+		print_job_notices(&notify_queue, &bg_proc_manager);
+	}
 
-	int pipe_index = -1; 
-	
-	//placeholder for background so we know whether to call wait() or not
-	int background = 0;
-	
 	print_prompt();	
+
+	//each line is one window for the allocs builtin
+	begin_alloc_window();
 	
 	char* command = get_command();
 
+	if(command)
+	{
+		run_command_line(command, 1);
+	}
 
-	if(!command) return;
+	end_alloc_window();
+}
 
-	add_to_history(&command_history,command);
+/**
+ * Tokenizes and compiles a command line
+ * @param command line to parse, it isn't modified
+ * @param result set to COMPILE_OK, COMPILE_INCOMPLETE when quotes or
+ * a block are still open at the end, or COMPILE_ERROR
+ * @param open_quote set to 1 when the line ends inside a quote or
+ * a continuation, 0 otherwise
+ * @return compiled program owning its tokens, NULL unless result is COMPILE_OK
+**/
+static program_t* parse_command_line(char* command, int* result, int* open_quote)
+{
+	int token_count;
+	int incomplete;
+
+	char** tokens = tokenize(command, &token_count, &incomplete);
 
-	if(check_basic_commands(&command) == 0)
+	*open_quote = tokens == NULL && incomplete;
+
+	if(tokens == NULL)
 	{
-		return;
+		*result = incomplete ? COMPILE_INCOMPLETE : COMPILE_ERROR;
+		return NULL;
 	}
-	input_parser = init_input_parser(command);
+
+	program_t* program = compile_program(tokens, token_count, result);
+
+	if(*result != COMPILE_OK)
+	{
+		free_tokens(tokens);
+	}
+
+	return program;
+}
+
+/**
+ * Tokenizes, compiles and runs one command line, this is the path shared
+ * by the interactive loop and by requests coming in over the server socket
+ * @param command malloc'd command line, ownership passes to this function
+ * @param read_more 1 to keep reading lines from stdin while a block is open,
+ * 0 to treat an unclosed block as a syntax error
+ * @return exit status of the last command that ran
+**/
+int run_command_line(char* command, int read_more)
+{
+	int result;
+	int open_quote;
+
+	uint64_t parse_start = now_ns();
+	trace_event(&tracer,'B',"parse",0,NULL);
+
+	program_t* program = parse_command_line(command, &result, &open_quote);
+
+	trace_event(&tracer,'E',"parse",0,NULL);
+	uint64_t parse_time = now_ns() - parse_start;
+
+	if(result == COMPILE_INCOMPLETE && !read_more)
+	{
+		fprintf(stderr, "parse error: unexpected end of input\n");
+		result = COMPILE_ERROR;
+	}
+
+	while(result == COMPILE_INCOMPLETE)
+	{
+		print_continuation_prompt();
+
+		//the rest of a quoted string is read as typed, blank lines included
+		char* line = open_quote ? get_raw_line() : get_command();
+
+		if(line != NULL)
+		{
+			command = realloc(command, strlen(command) + strlen(line) + 2);
+
+			if(!command)
+			{
+				perror("Could not grow command");
+				exit(EXIT_FAILURE);
+			}
+
+			strcat(command, "\n");
+			strcat(command, line);
+			free(line);
+		}
+
+		parse_start = now_ns();
+		trace_event(&tracer,'B',"parse",0,NULL);
+		program = parse_command_line(command, &result, &open_quote);
+		trace_event(&tracer,'E',"parse",0,NULL);
+		parse_time += now_ns() - parse_start;
+	}
+
+	record_latency(&stats, HIST_PARSE, parse_time);
+
+	add_to_history(&command_history,command);
 
 	free(command);
 
-	int start_index = 0;
+	if(result == COMPILE_ERROR)
+	{
+		last_status = 2;
+		return last_status;
+	}
+
+	run_program(program);
+
+	free_program(program);
+
+	return last_status;
+}
+
+/**
+ * Splits a command at its pipes into one NULL terminated array per
+ * stage, the pipe tokens are overwritten with NULL
+ * @param commands room for token_count stages
+ * @param stderr_piped set to 1 for each stage followed by |&
+ * @param consumer_count set to the number of |> consumers at the end
+ * @return number of stages, -1 after reporting a parse error
+**/
+static int split_pipeline(char** tokens, int token_count, char** commands[], int* stderr_piped, int* consumer_count)
+{
+	int command_count = 1;
 
-	char* token = get_token(input_parser);
+	*consumer_count = 0;
+	commands[0] = tokens;
+	stderr_piped[0] = 0;
 
-	while(token != NULL)
+	for(int i = 0; i < token_count;i++)
 	{
-		tokens[start_index] = token;
-		start_index++;
-		token = get_token(input_parser);
+		int fanout = is_operator(tokens[i], "|>");
+		int pipe_err = is_operator(tokens[i], "|&");
+
+		if(is_operator(tokens[i], "|") || fanout || pipe_err)
+		{
+			if(i-1 >= 0 && tokens[i-1] != NULL && is_operator(tokens[i-1], "&"))
+			{
+				fprintf(stderr,"parse error near |: & \n");
+				last_status = 2;
+				return -1;
+			}
+
+			//a pipe needs a command on both sides
+			if(i == 0 || tokens[i-1] == NULL || i == token_count-1)
+			{
+				fprintf(stderr,"parse error near |\n");
+				last_status = 2;
+				return -1;
+			}
+
+			//everything after the first |> is a single command consumer
+			if(*consumer_count > 0 && !fanout)
+			{
+				fprintf(stderr,"parse error near |: a |> consumer must be a single command\n");
+				last_status = 2;
+				return -1;
+			}
+
+			*consumer_count += fanout;
+
+			//|& sends the stage's stderr down the pipe with its stdout
+			stderr_piped[command_count-1] = pipe_err;
+
+			//split the tokens into one NULL terminated array per stage
+			tokens[i] = NULL;
+			stderr_piped[command_count] = 0;
+			commands[command_count++] = &tokens[i+1];
+		}
 	}
-		
-	if(strcmp(tokens[0],"fg") == 0)
+
+	return command_count;
+}
+
+/**
+ * Function runs a single command, which is either a builtin,
+ * a variable assignment, a pipeline or a command with redirection
+ * Will exit program if errors on system calls such as fork()
+ * @param tokens NULL terminated command, the strings are still
+ * owned by the caller but entries may be overwritten
+ * @param token_count number of tokens
+ * @return exit status of the command
+**/
+int execute_tokens(char** tokens, int token_count)
+{
+	//placeholder for background so we know whether to call wait() or not
+	int background = 0;
+
+	if(token_count == 0)
 	{
-		tokens[start_index] = NULL;	
-		bring_to_fg(tokens, &bg_proc_manager);
-		free_tokens(tokens);
-		free_input_parser(input_parser);
-		return;
+		return last_status;
 	}
 
+	uint64_t builtin_start = now_ns();
+
+	if(check_basic_commands(tokens) == 0)
+	{
+		record_latency(&stats, HIST_BUILTIN, now_ns() - builtin_start);
+		return last_status;
+	}
 
-	if(strcmp(tokens[start_index-1], "&") == 0)
+	if(is_operator(tokens[token_count-1], "&"))
 	{
 		background = 1;
 	}
 	
-	//important: remove the background symbol and decrease start_index
+	//important: remove the background symbol and decrease token_count
 	//so we don't segfault
 	if(background)
 	{
-		free(tokens[start_index-1]);
-		tokens[start_index-1] = NULL;
-		start_index--;
-		
+		tokens[token_count-1] = NULL;
+		token_count--;
+
+		if(token_count == 0)
+		{
+			fprintf(stderr,"parse error near &\n");
+			last_status = 2;
+			return last_status;
+		}
 	}
-	else
+
+	//a line made up only of NAME=value words sets shell variables
+	int assignments = 0;
+
+	while(assignments < token_count && is_assignment(tokens[assignments]))
 	{
-		//null terminate tokens, very important for execvp() call
-		tokens[start_index] = NULL;
+		assignments++;
 	}
 
-	for(int i = 0; i < start_index;i++)
+	if(assignments == token_count)
 	{
-		if(strcmp("|",tokens[i]) == 0)
+		for(int i = 0; i < token_count; i++)
 		{
-			if(i-1 >= 0 && strcmp("&",tokens[i-1]) == 0)
-			{
-				fprintf(stderr,"parse error near |: & \n");
-				free_tokens(tokens);
-				free_input_parser(input_parser);
-				return;
-			}
-			pipe_index = i;
+			char* equals = strchr(tokens[i], '=');
+			*equals = '\0';
+			set_var(&var_table, tokens[i], equals + 1);
+			*equals = '=';
 		}
+		last_status = 0;
+		return last_status;
+	}
 
+	char** commands[token_count];
+	int stderr_piped[token_count];
+	int consumer_count;
+	int command_count = split_pipeline(tokens, token_count, commands, stderr_piped, &consumer_count);
+
+	if(command_count == -1)
+	{
+		return last_status;
 	}
-	
+
 	//pipe symbol is present, handle accordingly 
-	if(pipe_index != -1)
+	if(command_count > 1)
 	{
-		free(tokens[pipe_index]);
-		tokens[pipe_index] = NULL;
+		implement_pipeline(commands, stderr_piped, command_count, consumer_count, background);
 
-		implement_pipeline(tokens,&tokens[pipe_index+1], background);
+		return last_status;
+	}
 
-		free_tokens(tokens);
-		free_tokens(&tokens[pipe_index+1]);
-		free_input_parser(input_parser);
-		return;
+	launch_opts_t opts = default_launch_opts;
+	launch_opts_t parsed;
 
+	if(token_count == 1 && is_launch_modifier(tokens[0]))
+	{
+		print_launch_opts(&default_launch_opts, tokens[0]);
+		last_status = 0;
+		return last_status;
 	}
 
-	char** potential_files = check_for_files(tokens,start_index);
+	init_launch_opts(&parsed);
 
-	char** final_command_array = prepare_command_array(tokens,start_index);
+	int consumed = parse_launch_opts(tokens, token_count, &parsed);
 
-	
-	//these next two lines may be a bit redundant
-	//however, I think using exit() under an error was more
-	//important so it was better to have a bit of 
-	//duplicate code 
-	if(execute_command(final_command_array,potential_files,background) == -1)
+	if(consumed == -1)
 	{
-		free_tokens(tokens);
-		free(potential_files);
-		free(final_command_array);
-		free_input_parser(input_parser);
-		free_history(&command_history);
-		exit(EXIT_FAILURE);
+		last_status = 2;
+		return last_status;
 	}
 
+	//modifiers with no command set the defaults for later jobs
+	if(consumed == token_count)
+	{
+		merge_launch_opts(&default_launch_opts, &parsed);
+		last_status = 0;
+		return last_status;
+	}
+
+	merge_launch_opts(&opts, &parsed);
+	tokens += consumed;
+	token_count -= consumed;
+
+	char** potential_files = check_for_files(tokens,token_count);
+
+	char** final_command_array = prepare_command_array(tokens,token_count);
+
+	int result = execute_command(final_command_array,tokens,potential_files,background,&opts);
+
 	free(potential_files);
 	free(final_command_array);
-	free_tokens(tokens);
-	free_input_parser(input_parser);
-	return;
+
+	if(result == -1)
+	{
+		free_history(&command_history);
+		exit(EXIT_FAILURE);
+	}
+
+	return last_status;
 }
 
 /**
@@ -222,6 +615,8 @@ void register_signal_handler()
 **/ 
 void sig_int_handler(int handler)
 {
+	interrupted = 1;
+
 	if(child_pid != 0)
 	{
 		kill(child_pid, SIGINT);
@@ -231,20 +626,68 @@ void sig_int_handler(int handler)
 /**
  * Function for reclaiming the zombies in the
  * background so they are removed from 
- * the process table
+ * the process table, finished jobs are queued
+ * and reported by the shell before its next prompt
 **/
 void sig_chld_handler(int sig)
 {
-	int status;
-	int pid;
-	while((pid = waitpid(-1, &status,WNOHANG))> 0)
+	int saved_errno = errno;
+
+	reap_children();
+
+	errno = saved_errno;
+}
+
+/**
+ * Collects every child that has exited, REAP_BATCH at a time, and
+ * applies each batch to the job table in one pass instead of one
+ * scan per pid, finished jobs are queued to be reported. Runs in
+ * the SIGCHLD handler and in wait with SIGCHLD blocked, so it only
+ * calls waitpid and touches memory
+ * @return number of children reaped
+**/
+int reap_children()
+{
+	reaped_child_t batch[REAP_BATCH];
+	process_t* finished[REAP_BATCH];
+	uint64_t start = now_ns();
+	int total = 0;
+	int count;
+
+	do
+	{
+		int status;
+		pid_t pid;
+
+		count = 0;
+
+		while(count < REAP_BATCH && (pid = waitpid(-1, &status, WNOHANG)) > 0)
+		{
+			trace_event(&tracer,'E',"exec",pid,NULL);
+			trace_event(&tracer,'i',"sigchld_reap",pid,NULL);
+
+			batch[count].pid = pid;
+			batch[count].status = status;
+			count++;
+		}
+
+		int done = reap_bg_batch(batch, count, &bg_proc_manager, finished);
+
+		for(int i = 0; i < done; i++)
+		{
+			push_job_notice(&notify_queue, finished[i]);
+		}
+
+		total += count;
+	}
+	while(count == REAP_BATCH);
+
+	if(total > 0)
 	{
-		char buffer[100];
-		snprintf(buffer, sizeof(buffer), "\npid %d done\n", pid);
-		write(STDOUT_FILENO, buffer, strlen(buffer));		
-		free_bg_proc(pid, &bg_proc_manager);
-		print_prompt();
+		record_reap(&stats, total, now_ns() - start);
 	}
+
+	return total;
 }
 
 /**
@@ -274,172 +717,563 @@ void kill_child_process()
 }
 
 /**
- * Function represents a two stage pipeline
- * @param first command (first half before the pipe symbol)
- * @param second command (second half after the pipe symbol)
+ * Blocks SIGCHLD so the reaper can't collect a child between
+ * fork() and our own waitpid(), or before a background
+ * job has been added to the job table
+ * @param prev_mask filled with the mask to restore afterwards
 **/
-void implement_pipeline(char** first_command, char** second_command, int background)
+void block_sig_chld(sigset_t* prev_mask)
 {
-	int fd[2];
-	pid_t child_pid_1;
-	pid_t child_pid_2;
+	sigset_t mask;
 
+	sigemptyset(&mask);
+	sigaddset(&mask,SIGCHLD);
 
-	if(!first_command || !second_command)
+	if(sigprocmask(SIG_BLOCK,&mask,prev_mask) == -1)
 	{
-		perror("Pipe commands cannot be null");
-		free(first_command);
-		free(second_command);
-		return;
+		perror("Could not block child signal");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Turns a waitpid() status into a shell exit status,
+ * commands killed by a signal report 128 + signal number
+**/
+int decode_status(int status)
+{
+	if(WIFEXITED(status))
+	{
+		return WEXITSTATUS(status);
+	}
+
+	if(WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+
+	return 1;
+}
+
+/**
+ * Closes the fork span in the shell, the child
+ * pid is attached so it can be matched to its track
+ * @param pid returned by fork()
+**/
+void trace_fork_end(pid_t pid)
+{
+	if(pid > 0 && tracer.enabled)
+	{
+		char detail[16];
+		snprintf(detail, sizeof(detail), "%d", pid);
+		trace_event(&tracer,'E',"fork",0,detail);
 	}
+}
 
+/**
+ * Forks the relay of an instrumented pipe, the stage's output goes
+ * through it into a new pipe that the next stage reads
+ * @param in_fd read end of the stage's pipe, the shell's copy is closed
+ * @param link shared figures the relay fills in
+ * @param log_fds capture pipe of a background job, the relay doesn't hold it
+ * @param pid set to the relay's pid
+ * @return read end of the pipe for the next stage
+**/
+static int start_pipe_relay(int in_fd, int pipe_size, pipe_link_t* link, int* log_fds, sigset_t* prev_mask, int background, pid_t* pid)
+{
+	int relay_fd[2];
 
-	if(pipe(fd) == -1)
+	if(pipe(relay_fd) == -1)
 	{
 		perror("Pipe error");
-		free(first_command);
-		free(second_command);
-		free_input_parser(input_parser);
 		exit(EXIT_FAILURE);
 	}
 
-	//code block represents our first child process running 
-	//call fork and immediately exit if call fails
-	child_pid_1 = fork();
+	set_pipe_size(relay_fd[1], pipe_size);
+
+	trace_event(&tracer,'B',"fork",0,"pipestats");
+	*pid = fork();
+	trace_fork_end(*pid);
 
-	if(child_pid_1 == -1)
+	if(*pid == -1)
 	{
 		perror("Fork error");
-		free(first_command);
-		free(second_command);
-		free_input_parser(input_parser);
 		exit(EXIT_FAILURE);
 	}
 
-	if(child_pid_1 == 0)
+	if(*pid == 0)
 	{
-		close(fd[0]);
+		sigprocmask(SIG_SETMASK,prev_mask,NULL);
+		signal(SIGINT,background ? SIG_IGN : SIG_DFL);
+		signal(SIGCHLD,SIG_DFL);
 
-		int first_command_len = array_length(first_command);
+		close(relay_fd[0]);
 
-		char** files = check_for_files(first_command,first_command_len);
-
-		char** cleaned_array = prepare_command_array(first_command,first_command_len);
-
-		if(dup2(fd[1],STDOUT_FILENO) == -1)
+		for(int i = 0; i < 2; i++)
 		{
-			perror("Cannot change pipe output");
-			free(first_command);
-			free(second_command);
-			free(files);
-			free(cleaned_array);
-			free_input_parser(input_parser);
-			exit(EXIT_FAILURE);
+			if(log_fds[i] != -1)
+			{
+				close(log_fds[i]);
+			}
 		}
 
-		if(files[0] != NULL)
+		relay_pipe_link(in_fd, relay_fd[1], link);
+	}
+
+	close(in_fd);
+	close(relay_fd[1]);
+
+	return relay_fd[0];
+}
+
+/**
+ * Function runs a pipeline of any number of stages, every stage
+ * reads from the one before it and writes into the one after it
+ * Each stage may start with launch modifiers (affinity, nice, ulimit),
+ * "affinity -p LIST" on the first stage spreads the stages over LIST
+ * and "pipesize SIZE" on the first stage resizes every pipe, on a
+ * later stage only the pipe that stage writes into
+ * With "producer |> a |> b" the last consumer_count stages are
+ * consumers that each get a full copy of the producer's output
+ * With set -o pipestats every pipe gets a relay that counts what
+ * passes through it, the table is printed once the pipeline is done
+ * "a |& b" pipes a's stderr along with its stdout, before a's own
+ * redirections so "a 2>err |& b" still writes err. With set -o pipeerr
+ * every other stage's stderr goes to a relay that prints it line by
+ * line behind the stage's index
+ * @param commands NULL terminated token arrays, one per stage
+ * @param stderr_piped 1 for each stage followed by |&
+ * @param command_count number of stages
+ * @param consumer_count number of fan-out consumers at the end
+ * @param background whether to wait for the pipeline or not
+**/
+void implement_pipeline(char** commands[], int* stderr_piped, int command_count, int consumer_count, int background)
+{
+	int fd[2];
+	int prev_read = -1;
+	int producer_count = command_count - consumer_count;
+	int process_count = command_count + (consumer_count > 0 ? 1 : 0);
+	int fanout_fds[consumer_count + 1];
+	pid_t pids[2 * command_count];
+	uint64_t fork_times[2 * command_count];
+	launch_opts_t stage_opts[command_count];
+	launch_opts_t parsed[command_count];
+	sigset_t prev_mask;
+	int log_fds[2] = {-1, -1};
+	int stderr_fds[2 * command_count];
+	int merge_stderr = pipe_err_enabled;
+	pid_t stderr_relay = -1;
+	uint64_t stderr_fork_time = 0;
+
+	//parse every stage's modifiers before anything is forked
+	//so a typo doesn't leave half a pipeline running
+	for(int i = 0; i < command_count; i++)
+	{
+		int command_len = array_length(commands[i]);
+
+		init_launch_opts(&parsed[i]);
+
+		int consumed = parse_launch_opts(commands[i], command_len, &parsed[i]);
+
+		if(consumed == -1)
 		{
-			change_output(files[0]);
+			last_status = 2;
+			return;
 		}
 
-		if(files[1] != NULL)
+		if(consumed == command_len)
 		{
-			change_input(files[1]);
+			fprintf(stderr,"parse error near |\n");
+			last_status = 2;
+			return;
 		}
 
-		if(execvp(cleaned_array[0],cleaned_array) == -1)
+		commands[i] += consumed;
+
+		stage_opts[i] = default_launch_opts;
+
+		if(parsed[0].spread && !parsed[i].has_affinity)
 		{
-			free(cleaned_array);
-			free(first_command);
-			free(second_command);
-			free(files);
-			free_input_parser(input_parser);
-			perror("Cannot process command");
-			exit(EXIT_FAILURE);
+			merge_launch_opts(&stage_opts[i], &parsed[0]);
 		}
 
-		close(fd[1]);
-
+		merge_launch_opts(&stage_opts[i], &parsed[i]);
 	}
 
+	//set -o pipestats puts a counting relay on every pipe, fan-out keeps its own
+	pipe_stats_t* pipe_stats = pipe_stats_config.enabled && consumer_count == 0 ? new_pipe_stats(commands, command_count) : NULL;
 
-	//process is exactly the same as above except 
-	// the different file descriptor
-	child_pid_2 = fork();
+	if(background)
+	{
+		open_job_log_pipe(&job_log_config, log_fds);
+	}
 
-	if(child_pid_2 == -1)
+	if(merge_stderr && open_stage_stderr(command_count, stderr_fds) == -1)
 	{
-		perror("Fork error");
-		free(first_command);
-		free(second_command);
-		free_input_parser(input_parser);
-		exit(EXIT_FAILURE);
+		merge_stderr = 0;
 	}
 
-	if(child_pid_2 == 0)
+	block_sig_chld(&prev_mask);
+
+	//the stderr relay is forked first so it holds none of the stage pipes
+	if(merge_stderr)
 	{
-		close(fd[1]);
+		stderr_fork_time = now_ns();
+		trace_event(&tracer,'B',"fork",0,"pipeerr");
+		stderr_relay = fork();
+		trace_fork_end(stderr_relay);
 
-		int second_command_len = array_length(second_command);
+		if(stderr_relay == -1)
+		{
+			perror("Fork error");
+			exit(EXIT_FAILURE);
+		}
 
-		char** files = check_for_files(second_command,second_command_len);
+		if(stderr_relay == 0)
+		{
+			sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+			signal(SIGINT,background ? SIG_IGN : SIG_DFL);
+			signal(SIGCHLD,SIG_DFL);
+			attach_job_log(log_fds[1]);
+
+			if(log_fds[0] != -1)
+			{
+				close(log_fds[0]);
+			}
 
-		char** cleaned_array = prepare_command_array(second_command,second_command_len);
+			relay_stage_stderr(stderr_fds, commands, command_count);
+		}
+	}
 
+	for(int i = 0; i < command_count; i++)
+	{
+		int consumer = i >= producer_count;
+		int writes_pipe = i < producer_count - 1 || (i == producer_count - 1 && consumer_count > 0);
+		int stage_pipe_size = parsed[i].has_pipe_size ? stage_opts[i].pipe_size : stage_opts[0].pipe_size;
 
-		if(dup2(fd[0],STDIN_FILENO) == -1)
+		//a consumer reads its own pipe which the fan-out relay fills
+		if(writes_pipe || consumer)
 		{
-			perror("Cannot change pipe input");
-			free(first_command);
-			free(second_command);
-			free(files);
-			free(cleaned_array);
-			free_input_parser(input_parser);
+			if(pipe(fd) == -1)
+			{
+				perror("Pipe error");
+				exit(EXIT_FAILURE);
+			}
+
+			set_pipe_size(fd[1], stage_pipe_size);
+		}
+
+		//call fork and immediately exit if call fails
+		fork_times[i] = now_ns();
+		trace_event(&tracer,'B',"fork",0,commands[i][0]);
+		pids[i] = fork();
+		trace_fork_end(pids[i]);
+
+		if(pids[i] == -1)
+		{
+			perror("Fork error");
 			exit(EXIT_FAILURE);
 		}
 
-		if(files[0] != NULL)
+		if(pids[i] == 0)
 		{
-			change_output(files[0]);
+			sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+
+			if(background)
+			{
+				signal(SIGINT,SIG_IGN);
+			}
+
+			//every stage's stderr and the last stages' stdout are captured
+			attach_job_log(log_fds[1]);
+
+			if(merge_stderr && dup2(stderr_fds[2 * i + 1],STDERR_FILENO) == -1)
+			{
+				perror("Cannot change stage stderr");
+				exit(EXIT_FAILURE);
+			}
+
+			if(consumer)
+			{
+				//drop the relay's ends so this consumer sees end of input
+				close(prev_read);
+
+				for(int j = 0; j < i - producer_count; j++)
+				{
+					close(fanout_fds[j]);
+				}
+
+				close(fd[1]);
+				prev_read = fd[0];
+			}
+
+			if(prev_read != -1)
+			{
+				if(dup2(prev_read,STDIN_FILENO) == -1)
+				{
+					perror("Cannot change pipe input");
+					exit(EXIT_FAILURE);
+				}
+				close(prev_read);
+			}
+
+			if(writes_pipe)
+			{
+				close(fd[0]);
+
+				if(dup2(fd[1],STDOUT_FILENO) == -1 || (stderr_piped[i] && dup2(fd[1],STDERR_FILENO) == -1))
+				{
+					perror("Cannot change pipe output");
+					exit(EXIT_FAILURE);
+				}
+				close(fd[1]);
+			}
+
+			exec_pipeline_stage(commands[i], i, &stage_opts[i], !background);
 		}
 
-		if(files[1] != NULL)
+		if(consumer)
 		{
-			change_input(files[1]);
+			close(fd[0]);
+			fanout_fds[i - producer_count] = fd[1];
+			continue;
+		}
+
+		//the shell keeps no pipe ends, only the read end
+		//that the next stage still needs
+		if(prev_read != -1)
+		{
+			close(prev_read);
 		}
 
-		if(execvp(cleaned_array[0],cleaned_array) == -1)
+		if(writes_pipe)
 		{
-			perror("Cannot process command");
-			free(first_command);
-			free(second_command);
-			free(files);
-			free(cleaned_array);
-			free_input_parser(input_parser);
+			close(fd[1]);
+			prev_read = fd[0];
+		}
+
+		if(writes_pipe && pipe_stats != NULL)
+		{
+			fork_times[process_count] = now_ns();
+			prev_read = start_pipe_relay(prev_read, stage_pipe_size, &pipe_stats->links[i], log_fds, &prev_mask, background, &pids[process_count]);
+			process_count++;
+		}
+	}
+
+	//the relay is a plain fork of the shell that moves the last
+	//producer's output into every consumer with tee() and splice()
+	if(consumer_count > 0)
+	{
+		fork_times[command_count] = now_ns();
+		trace_event(&tracer,'B',"fork",0,"fanout");
+		pids[command_count] = fork();
+		trace_fork_end(pids[command_count]);
+
+		if(pids[command_count] == -1)
+		{
+			perror("Fork error");
 			exit(EXIT_FAILURE);
 		}
 
-		close(fd[0]);
+		if(pids[command_count] == 0)
+		{
+			sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+			signal(SIGINT,background ? SIG_IGN : SIG_DFL);
+			signal(SIGCHLD,SIG_DFL);
+			relay_fanout(prev_read, fanout_fds, consumer_count);
+		}
+
+		close(prev_read);
+
+		for(int j = 0; j < consumer_count; j++)
+		{
+			close(fanout_fds[j]);
+		}
+	}
+
+	//the relay sees end of input once the last stage is gone
+	if(merge_stderr)
+	{
+		close_stage_stderr(command_count, stderr_fds);
+		fork_times[process_count] = stderr_fork_time;
+		pids[process_count++] = stderr_relay;
 	}
-	
-	close(fd[0]);
-	close(fd[1]);
 
 	if(!background)
 	{
-		waitpid(child_pid_1,NULL,0);
-		waitpid(child_pid_2,NULL,0);
+		int statuses[process_count];
+		uint64_t reaped_times[process_count];
+		uint64_t wait_start = now_ns();
+		trace_event(&tracer,'B',"waitpid",0,NULL);
+
+		//a timeout on the first stage covers the whole pipeline
+		int timed_out = wait_foreground(pids,process_count,statuses,reaped_times,&stage_opts[0]);
+
+		for(int i = 0; i < process_count; i++)
+		{
+			record_child(&stats,i,fork_times[i],reaped_times[i]);
+			trace_event(&tracer,'E',"exec",pids[i],NULL);
+		}
+
+		record_latency(&stats,HIST_WAIT,now_ns() - wait_start);
+		trace_event(&tracer,'E',"waitpid",0,NULL);
+
+		//like other shells the pipeline reports its last stage
+		last_status = timed_out ? WAIT_TIMEOUT_STATUS : decode_status(statuses[command_count-1]);
+
+		if(pipe_stats != NULL)
+		{
+			print_pipe_stats(pipe_stats, stderr);
+			add_pipe_totals(&pipe_stats_config, pipe_stats);
+			free_pipe_stats(pipe_stats);
+		}
 	}
 	else
 	{
-		init_bg_process(child_pid_1,&command_history);
-		init_bg_process(child_pid_2,&command_history);
+		if(log_fds[1] != -1)
+		{
+			close(log_fds[1]);
+		}
+
+		process_t* job = init_bg_process(pids,process_count,command_count-1,log_fds[0],job_name(commands,stderr_piped,command_count,consumer_count));
+
+		//a background job keeps its figures for jobs -l
+		if(job != NULL)
+		{
+			job->pipe_stats = pipe_stats;
+		}
+		else
+		{
+			free_pipe_stats(pipe_stats);
+		}
+
+		last_status = 0;
 	}
 
-	child_pid_1 = 0;
-	child_pid_2 = 0;
+	sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+}
 
-	return;
+/**
+ * Runs a shell function in a forked child that would otherwise exec,
+ * so functions work in pipelines, with redirection and with &
+ * @param array the command, array[0] is checked against the functions
+**/
+static void exec_function_in_child(char** array)
+{
+	function_t* function = find_function(&function_table, array[0]);
+
+	if(function == NULL)
+	{
+		return;
+	}
+
+	int status = call_function(&function_table, function, array, array_length(array));
+
+	fflush(stdout);
+	exit(status);
+}
+
+/**
+ * Runs in the child of a pipeline stage once its pipe ends are
+ * in place, sets up redirection and modifiers then execs
+ * @param command the stage's tokens
+ * @param stage index of the stage in the pipeline
+ * @param opts launch modifiers for this stage
+ * @param foreground 1 if the shell waits for the stage and times its spawn
+**/
+void exec_pipeline_stage(char** command, int stage, launch_opts_t* opts, int foreground)
+{
+	int command_len = array_length(command);
+
+	char** files = check_for_files(command,command_len);
+
+	char** cleaned_array = prepare_command_array(command,command_len);
+
+	if(files[0] != NULL)
+	{
+		change_output(files[0]);
+	}
+
+	if(files[1] != NULL)
+	{
+		change_input(files[1]);
+	}
+
+	apply_child_redirections(command);
+
+	apply_launch_opts(opts, stage);
+
+	//a background stage would overwrite the slot of a foreground one
+	if(foreground)
+	{
+		mark_exec(&stats,stage);
+	}
+	trace_event(&tracer,'B',"exec",0,cleaned_array[0]);
+
+	run_compound_stage(command);
+
+	exec_function_in_child(cleaned_array);
+
+	execvp(cleaned_array[0],cleaned_array);
+
+	perror("Cannot process command");
+	free(files);
+	free(cleaned_array);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * Forks a coprocess the way implement_pipeline() forks a stage, with
+ * one pipe as its input and another as its output. It runs as a
+ * background job so jobs, wait and the SIGCHLD handler see it
+ * @param command the helper's tokens, redirections and modifiers apply
+ * @param to_child pipe the helper reads, the shell keeps to_child[1]
+ * @param from_child pipe the helper writes, the shell keeps from_child[0]
+ * @return the helper's pid, -1 if fork failed
+**/
+pid_t spawn_coproc(char** command, int to_child[2], int from_child[2])
+{
+	sigset_t prev_mask;
+	launch_opts_t opts = default_launch_opts;
+	pid_t pid;
+
+	block_sig_chld(&prev_mask);
+
+	trace_event(&tracer,'B',"fork",0,command[0]);
+	pid = fork();
+	trace_fork_end(pid);
+
+	if(pid == -1)
+	{
+		perror("Fork error");
+		sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+		return -1;
+	}
+
+	if(pid == 0)
+	{
+		sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+		signal(SIGINT,SIG_IGN);
+
+		if(dup2(to_child[0],STDIN_FILENO) == -1 || dup2(from_child[1],STDOUT_FILENO) == -1)
+		{
+			perror("Cannot change coprocess pipes");
+			exit(EXIT_FAILURE);
+		}
+
+		//a function run as the helper must not hold its own input open
+		close(to_child[0]);
+		close(to_child[1]);
+		close(from_child[0]);
+		close(from_child[1]);
+
+		exec_pipeline_stage(command, 0, &opts, 0);
+	}
+
+	init_bg_process(&pid,1,0,-1,job_name(&command,NULL,1,0));
+
+	sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+	return pid;
 }
 
 /**
@@ -449,6 +1283,8 @@ void implement_pipeline(char** first_command, char** second_command, int backgro
 **/ 
 void change_input(char* file_name)
 {
+	trace_event(&tracer,'B',"redirect_in",0,file_name);
+
 	int fd = open(file_name,O_RDONLY);
 
 	if(fd < 0)
@@ -465,6 +1301,8 @@ void change_input(char* file_name)
 	}
 
 	close(fd);
+
+	trace_event(&tracer,'E',"redirect_in",0,NULL);
 }
 
 /**
@@ -474,6 +1312,8 @@ void change_input(char* file_name)
 **/ 
 void change_output(char* file_name)
 {
+	trace_event(&tracer,'B',"redirect_out",0,file_name);
+
 	int fd = open(file_name,O_WRONLY | O_CREAT | O_TRUNC,0644);
 
 	if(fd < 0)
@@ -490,6 +1330,8 @@ void change_output(char* file_name)
 	}
 
 	close(fd);
+
+	trace_event(&tracer,'E',"redirect_out",0,NULL);
 }
 
 /**
@@ -520,7 +1362,7 @@ char** prepare_command_array(char* tokens[],int array_length)
 
 	for(int i = 0; i < array_length;i++)
 	{
-		if(strcmp(tokens[i],"<") == 0 || strcmp(tokens[i],">") == 0)
+		if(parse_redirection(tokens[i], NULL))
 		{
 			i++;
 		}
@@ -536,34 +1378,83 @@ char** prepare_command_array(char* tokens[],int array_length)
 }
 
 
+/**
+ * Waits for the foreground child in child_pid and records its times,
+ * the exit status is stored in last_status
+ * @param fork_time taken right before the child was started
+**/
+static void wait_for_child(uint64_t fork_time, launch_opts_t* opts)
+{
+	int status;
+	uint64_t wait_start = now_ns();
+	uint64_t wait_end;
+	trace_event(&tracer,'B',"waitpid",0,NULL);
+
+	int timed_out = wait_foreground(&child_pid,1,&status,&wait_end,opts);
+
+	trace_event(&tracer,'E',"exec",child_pid,NULL);
+	trace_event(&tracer,'E',"waitpid",0,NULL);
+	record_child(&stats,0,fork_time,wait_end);
+	record_latency(&stats,HIST_WAIT,wait_end - wait_start);
+
+	child_pid = 0;
+	last_status = timed_out ? WAIT_TIMEOUT_STATUS : decode_status(status);
+}
+
 /**
  * Function will execute the command after calling fork() and execvp()
  * @param array, the command array that will be passed to execvp()
- * @param output_file_name name of output file (could be null if no
- * redirection)
- * @param input_file_name name of input file (could also be null if no 
- * redirection)
+ * @param tokens the command before redirections were taken out,
+ * the child applies the ones beyond < and >, NULL when there are none
+ * @param files the output file then the input file, either may be
+ * NULL, or files may be NULL when there is no redirection
+ * @param opts launch modifiers applied in the child
+ * @return 0 once the command is started or waited for, -1 if fork
+ * fails, the exit status is stored in last_status
 **/ 
-int execute_command(char** array,char** files, int background)
+int execute_command(char** array,char** tokens,char** files, int background, launch_opts_t* opts)
 {
 
+	sigset_t prev_mask;
+	uint64_t fork_time;
+	int log_fds[2] = {-1, -1};
+
 	if(array == NULL)
 	{
 		printf("%s\n","command array must not be null");
 		return -1;
 	}
 
+	if(background)
+	{
+		open_job_log_pipe(&job_log_config, log_fds);
+	}
+
+	block_sig_chld(&prev_mask);
+
+	fork_time = now_ns();
+	trace_event(&tracer,'B',"fork",0,array[0]);
 	child_pid = fork();
+	trace_fork_end(child_pid);
 
 	
 	if(child_pid == -1)
 	{
 		perror("Fork failure");
+		sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+
+		if(log_fds[0] != -1)
+		{
+			close(log_fds[0]);
+			close(log_fds[1]);
+		}
 		return -1;
 	}
 
 	if(child_pid == 0)
 	{
+		sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+
 
 		//we want to make sure control + c doesn't 
 		//end a bg process
@@ -572,37 +1463,188 @@ int execute_command(char** array,char** files, int background)
 			signal(SIGINT,SIG_IGN);
 		}
 
-		if(files[0] != NULL)
+		attach_job_log(log_fds[1]);
+
+		if(files != NULL && files[0] != NULL)
 		{
 			change_output(files[0]);
 		}
 
-		if(files[1] != NULL)
+		if(files != NULL && files[1] != NULL)
 		{
 			change_input(files[1]);
 		}
+
+		if(tokens != NULL)
+		{
+			apply_child_redirections(tokens);
+		}
+
+		apply_launch_opts(opts, 0);
+
+		if(!background)
+		{
+			mark_exec(&stats,0);
+		}
+		trace_event(&tracer,'B',"exec",0,array[0]);
+
+		exec_function_in_child(array);
 		
 		if(execvp(array[0],array) == -1)
 		{
 			perror("Could not execute command");
-			return -1;
+			exit(EXIT_FAILURE);
 		}
 	}
 	
 	if(!background)
 	{
-		waitpid(child_pid,NULL,0);
-		child_pid = 0;
-		return 0;
+		wait_for_child(fork_time,opts);
 	}
 	else 
 	{
-		init_bg_process(child_pid,&command_history);
+		if(log_fds[1] != -1)
+		{
+			close(log_fds[1]);
+		}
+
+		init_bg_process(&child_pid,1,0,log_fds[0],job_name(tokens != NULL ? &tokens : &array,NULL,1,0));
+		last_status = 0;
 	}
+
+	sigprocmask(SIG_SETMASK,&prev_mask,NULL);
 	return 0;
 
 }
 
+/**
+ * Starts a foreground command with nothing to set up in the child
+ * through posix_spawnp(), which shares the shell's memory until the
+ * exec instead of copying its page tables the way fork() does
+ * @param argv the command, already free of redirections
+**/
+static void spawn_simple(char** argv, launch_opts_t* opts)
+{
+	posix_spawnattr_t attr;
+	sigset_t prev_mask;
+
+	block_sig_chld(&prev_mask);
+
+	//SIGCHLD is let through again in the child, exec resets the handlers
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &prev_mask);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	uint64_t fork_time = now_ns();
+	int error = posix_spawnp(&child_pid, argv[0], NULL, &attr, argv, environ);
+
+	posix_spawnattr_destroy(&attr);
+
+	//the child that could not exec has already been collected
+	if(error != 0)
+	{
+		fprintf(stderr, "Could not execute command: %s\n", strerror(error));
+		child_pid = 0;
+		last_status = EXIT_FAILURE;
+		sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+		return;
+	}
+
+	//posix_spawnp() returns once the exec went through
+	mark_exec(&stats,0);
+
+	wait_for_child(fork_time,opts);
+
+	sigprocmask(SIG_SETMASK,&prev_mask,NULL);
+}
+
+/**
+ * Runs a command through the executor its plan picked. Builtins are
+ * called directly, simple and redirected commands are started from
+ * the expanded words without building new arrays and pipelines are
+ * split and started, anything else goes to execute_tokens()
+ * @param plan from plan_command() for these words
+ * @param tokens the expanded command, entries may be overwritten
+ * @return exit status of the command
+**/
+int execute_plan(command_plan_t* plan, char** tokens, int token_count)
+{
+	if(plan->kind == PLAN_GENERAL)
+	{
+		return execute_tokens(tokens, token_count);
+	}
+
+	if(plan->kind == PLAN_BUILTIN)
+	{
+		uint64_t builtin_start = now_ns();
+
+		plan->builtin(tokens);
+		record_latency(&stats, HIST_BUILTIN, now_ns() - builtin_start);
+		return last_status;
+	}
+
+	if(plan->background)
+	{
+		tokens[--token_count] = NULL;
+	}
+
+	if(plan->kind == PLAN_PIPELINE)
+	{
+		char** commands[token_count];
+		int stderr_piped[token_count];
+		int consumer_count;
+		int command_count = split_pipeline(tokens, token_count, commands, stderr_piped, &consumer_count);
+
+		if(command_count != -1)
+		{
+			implement_pipeline(commands, stderr_piped, command_count, consumer_count, plan->background);
+		}
+		return last_status;
+	}
+
+	launch_opts_t opts = default_launch_opts;
+
+	if(plan->kind == PLAN_SIMPLE && !plan->background && !tracer.enabled && !launch_opts_in_child(&opts))
+	{
+		spawn_simple(tokens, &opts);
+		return last_status;
+	}
+
+	char* args[plan->arg_count + 1];
+	char* files[2] = {NULL, NULL};
+	int arg_count = 0;
+
+	//operators here are all redirections, each one takes the word after it
+	for(int i = 0; i < token_count; i++)
+	{
+		if(is_any_operator(tokens[i]))
+		{
+			i++;
+			continue;
+		}
+		args[arg_count++] = tokens[i];
+	}
+	args[arg_count] = NULL;
+
+	if(plan->output_word != -1)
+	{
+		files[0] = tokens[plan->output_word];
+	}
+
+	if(plan->input_word != -1)
+	{
+		files[1] = tokens[plan->input_word];
+	}
+
+	if(execute_command(args, plan->child_redirections ? tokens : NULL, files, plan->background, &opts) == -1)
+	{
+		free_history(&command_history);
+		exit(EXIT_FAILURE);
+	}
+
+	return last_status;
+}
+
 /**
  * Function will check if redirection files exist and return them if necessary
  * @param array, this is the command array, return NULL if null
@@ -621,107 +1663,464 @@ char** check_for_files(char** array,int array_length)
 		return NULL;
 	}
 
-	for(int i = 0; i < array_length;i++)
+	for(int i = 0; i < array_length;i++)
+	{
+		if(is_operator(array[i], "<") && i+1 < array_length)
+		{
+			input_file_name = array[i+1];
+		}
+
+		if(is_operator(array[i], ">") && i+1 < array_length)
+		{
+			output_file_name = array[i+1];
+		}
+	}
+
+	//dynamically allocate and assign the files
+	//possible that they are both null if no files
+	char** files = malloc(sizeof(char*) * 2);
+
+	files[0] = output_file_name;
+	files[1] = input_file_name;
+
+	return files;
+}
+
+/**
+ * Function just writes the prompt
+ * out to stdout, makes code more modular
+ * since we are calling it in a couple 
+ * spots
+ **/
+void print_prompt()
+{
+	char* arrow = "enter command here: > ";
+
+	trace_event(&tracer,'i',"prompt",0,NULL);
+
+	if(write(STDOUT_FILENO,arrow,strlen(arrow)) == -1)
+	{
+		perror("Error writing to std out");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Prompt shown while an if, for or while block
+ * is still waiting to be closed
+**/
+void print_continuation_prompt()
+{
+	char* arrow = "> ";
+
+	if(write(STDOUT_FILENO,arrow,strlen(arrow)) == -1)
+	{
+		perror("Error writing to std out");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * Builds the name jobs shows for a job from its own words, the history
+ * entry may be a whole line or an older command once history is full
+ * @param commands NULL terminated token arrays, one per stage
+ * @param stderr_piped 1 for each stage followed by |&, NULL for one stage
+ * @param consumer_count number of fan-out consumers at the end
+ * @return the stages joined by their pipes, the caller frees it
+**/
+char* job_name(char** commands[], int* stderr_piped, int command_count, int consumer_count)
+{
+	size_t length = 1;
+
+	for(int i = 0; i < command_count; i++)
+	{
+		length += 4;
+
+		for(int j = 0; commands[i][j] != NULL; j++)
+		{
+			length += strlen(commands[i][j]) + 1;
+		}
+	}
+
+	char* name = malloc(length);
+
+	if(name == NULL)
+	{
+		perror("Could not allocate memory for job name");
+		exit(EXIT_FAILURE);
+	}
+
+	name[0] = '\0';
+
+	for(int i = 0; i < command_count; i++)
+	{
+		if(i > 0)
+		{
+			char* pipe = i >= command_count - consumer_count ? "|>" : (stderr_piped[i-1] ? "|&" : "|");
+
+			strcat(name, " ");
+			strcat(name, pipe);
+		}
+
+		for(int j = 0; commands[i][j] != NULL; j++)
+		{
+			//the & that sent it to the background isn't part of the name
+			if(is_operator(commands[i][j], "&"))
+			{
+				continue;
+			}
+
+			if(name[0] != '\0')
+			{
+				strcat(name, " ");
+			}
+			strcat(name, commands[i][j]);
+		}
+	}
+
+	return name;
+}
+
+/**
+ * Function will initialize a bg job 
+ * and place it into our bg processes array
+ * by finding the first available non-null index,
+ * a finished job is evicted if the table is full
+ * Must be called with SIGCHLD blocked
+ * @param pids every process of the job
+ * @param pid_count number of processes
+ * @param status_index which process gives the job its exit status
+ * @param log_fd read end of the job's capture pipe, -1 if not captured
+ * @param name from job_name(), the job owns it from here on
+ * @return the new job, NULL if it could not be tracked
+**/
+process_t* init_bg_process(pid_t* pids, int pid_count, int status_index, int log_fd, char* name)
+{
+	if(pids == NULL || pid_count < 1 || name == NULL)
+	{
+		fprintf(stderr,"process ids and job name must not be empty");
+		free(name);
+		return NULL;
+	}
+
+	if(pid_count > MAX_JOB_PROCS)
+	{
+		fprintf(stderr,"job has more than %d processes, only the first are tracked\n",MAX_JOB_PROCS);
+		pid_count = MAX_JOB_PROCS;
+		status_index = pid_count-1;
+	}
+
+	int index = -1;
+
+	for(int i = 0; i < MAX_BG_PROC && index == -1; i++)
+	{
+		if(bg_proc_manager.bg_processes[i] == NULL)
+		{
+			index = i;
+		}
+	}
+
+	for(int i = 0; i < MAX_BG_PROC && index == -1; i++)
+	{
+		if(bg_proc_manager.bg_processes[i]->done)
+		{
+			free_bg_job(bg_proc_manager.bg_processes[i], &bg_proc_manager);
+			index = i;
+		}
+	}
+
+	if(index == -1)
+	{
+		fprintf(stderr,"too many background jobs, job is not tracked\n");
+		free(name);
+
+		if(log_fd != -1)
+		{
+			close(log_fd);
+		}
+		return NULL;
+	}
+
+	process_t* bg_process = malloc(sizeof(process_t));
+
+	if(!bg_process)
+	{
+		perror("Malloc failure trying to init bg process");
+		exit(EXIT_FAILURE);
+	}
+
+	bg_process->command = name;
+	bg_process->pid = pids[0];
+	bg_process->pid_count = pid_count;
+	bg_process->running = pid_count;
+	bg_process->status_index = status_index;
+	bg_process->status = 0;
+	bg_process->done = 0;
+	bg_process->log = log_fd != -1 ? new_job_log(&job_log_config, log_fd, pids[0]) : NULL;
+	bg_process->pipe_stats = NULL;
+
+	for(int i = 0; i < pid_count; i++)
+	{
+		bg_process->pids[i] = pids[i];
+		bg_process->reaped[i] = 0;
+	}
+
+	//a reported job with the same number can't be waited for any more
+	for(int i = 0; i < MAX_FINISHED_JOBS; i++)
+	{
+		if(bg_proc_manager.finished[i].job == index+1)
+		{
+			bg_proc_manager.finished[i].job = 0;
+		}
+	}
+
+	bg_process->index = index;
+	bg_proc_manager.bg_processes[index] = bg_process;
+	bg_proc_manager.size++;
+
+	printf("[%d] %d %s\n", bg_process->index+1,bg_process->pid, bg_process->command);	
+	fflush(stdout);
+	return bg_process;
+}
+
+/**
+ * Function frees the bg job that owns the pid
+ * this also allows us to simply assign 
+ * the next bg job to the first available space
+ **/ 
+void free_bg_proc(pid_t pid, bg_proc_manager_t* bg_proc_manager)
+{
+	if(!bg_proc_manager)
+	{
+		fprintf(stderr, "cannot free bg process if bg process manager is null");
+		return;
+	}
+	for(int i = 0; i < MAX_BG_PROC; i++)
+	{
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		if(job == NULL)
+		{
+			continue;
+		}
+
+		for(int j = 0; j < job->pid_count; j++)
+		{
+			if(job->pids[j] == pid)
+			{
+				free_bg_job(job, bg_proc_manager);
+				return;
+			}
+		}
+	}
+}
+
+/**
+ * Frees a job the caller already holds, without looking up its pid
+**/
+void free_bg_job(process_t* job, bg_proc_manager_t* bg_proc_manager)
+{
+	bg_proc_manager->bg_processes[job->index] = NULL;
+	bg_proc_manager->size--;
+
+	free(job->command);
+	free_job_log(job->log);
+	free_pipe_stats(job->pipe_stats);
+	free(job);
+}
+
+/**
+ * Takes a reported job out of the table, its number, pid and status
+ * are kept a while longer so wait can still collect them
+ * Must be called with SIGCHLD blocked
+**/
+void forget_bg_job(process_t* job, bg_proc_manager_t* bg_proc_manager)
+{
+	finished_job_t* finished = &bg_proc_manager->finished[bg_proc_manager->next_finished];
+
+	finished->job = job->index + 1;
+	finished->pid = job->pid;
+	finished->status = job->status;
+	bg_proc_manager->next_finished = (bg_proc_manager->next_finished + 1) % MAX_FINISHED_JOBS;
+
+	free_bg_job(job, bg_proc_manager);
+}
+
+/**
+ * Collects the status of a job that was already reported and taken
+ * out of the table, by %N, N or its pid like find_job()
+ * @return the exit status, -1 if no reported job matches
+**/
+int collect_finished_job(char* jobspec, bg_proc_manager_t* bg_proc_manager)
+{
+	int number = atoi(jobspec[0] == '%' ? jobspec + 1 : jobspec);
+
+	for(int i = 0; i < MAX_FINISHED_JOBS; i++)
 	{
-		if((strcmp(array[i],"<") == 0) && i+1 < array_length)
-		{
-			input_file_name = array[i+1];
-		}
+		finished_job_t* finished = &bg_proc_manager->finished[i];
 
-		if((strcmp(array[i],">") == 0) && i+1 < array_length)
+		if(finished->job != 0 && (finished->job == number || (jobspec[0] != '%' && finished->pid == number)))
 		{
-			output_file_name = array[i+1];
+			finished->job = 0;
+			return finished->status;
 		}
 	}
 
-	//dynamically allocate and assign the files
-	//possible that they are both null if no files
-	char** files = malloc(sizeof(char*) * 2);
+	return -1;
+}
 
-	files[0] = output_file_name;
-	files[1] = input_file_name;
+/**
+ * Records that a process of a bg job was reaped, the job is
+ * kept with its exit status until it is reported or wait or fg
+ * collects it
+ * This runs in the SIGCHLD handler so it must not allocate
+ * @param pid reaped process
+ * @param status from waitpid()
+ * @return the job if this was its last running process, NULL otherwise
+**/
+process_t* reap_bg_proc(pid_t pid, int status, bg_proc_manager_t* bg_proc_manager)
+{
+	reaped_child_t child = {pid, status};
+	process_t* finished;
 
-	return files;
+	return reap_bg_batch(&child, 1, bg_proc_manager, &finished) == 1 ? finished : NULL;
 }
 
 /**
- * Function just writes the prompt
- * out to stdout, makes code more modular
- * since we are calling it in a couple 
- * spots
- **/
-void print_prompt()
+ * Finds a pid in a batch sorted by pid
+ * @return its entry, NULL if it isn't in the batch
+**/
+static reaped_child_t* find_reaped(reaped_child_t* batch, int count, pid_t pid)
 {
-	char* arrow = "enter command here: > ";
+	int low = 0;
+	int high = count - 1;
 
-	if(write(STDOUT_FILENO,arrow,strlen(arrow)) == -1)
+	while(low <= high)
 	{
-		perror("Error writing to std out");
-		exit(EXIT_FAILURE);
+		int middle = (low + high) / 2;
+
+		if(batch[middle].pid == pid)
+		{
+			return &batch[middle];
+		}
+
+		if(batch[middle].pid < pid)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle - 1;
+		}
 	}
+	return NULL;
 }
 
 /**
- * Function will initialize a bg process 
- * and place it into our bg processes array
- * by finding the first available non-null index
+ * Records a batch of reaped children in the job table with one pass
+ * over the jobs, each running process is looked up in the batch. The
+ * batch is sorted in place, by insertion since waitpid mostly returns
+ * pids in order and qsort isn't safe in a signal handler
+ * @param finished filled with the jobs whose last process is in the batch
+ * @return number of jobs in finished
 **/
-void init_bg_process(pid_t process_id,command_history_t* command_history)
+int reap_bg_batch(reaped_child_t* batch, int count, bg_proc_manager_t* bg_proc_manager, process_t** finished)
 {
-	if(process_id == -1 || command_history == NULL)
+	for(int i = 1; i < count; i++)
 	{
-		fprintf(stderr,"process id must not be -1 and command history must not be null");
-		return; 
+		reaped_child_t child = batch[i];
+		int j = i - 1;
+
+		while(j >= 0 && batch[j].pid > child.pid)
+		{
+			batch[j + 1] = batch[j];
+			j--;
+		}
+		batch[j + 1] = child;
 	}
 
-	process_t* bg_process = malloc(sizeof(process_t));
+	int matched = 0;
+	int done = 0;
 
-	if(!bg_process)
+	for(int i = 0; i < MAX_BG_PROC && matched < count; i++)
 	{
-		perror("Malloc failure trying to init bg process");
-		exit(EXIT_FAILURE);
-	}
-    bg_process->command = command_history->commands[command_history->last_used_index-1];
-	bg_process->pid = process_id;
+		process_t* job = bg_proc_manager->bg_processes[i];
 
+		if(job == NULL || job->done)
+		{
+			continue;
+		}
 
-	for(int i = 0; i < MAX_BG_PROC; i++)
-	{
-		if(bg_proc_manager.bg_processes[i] == NULL)
+		for(int j = 0; j < job->pid_count; j++)
+		{
+			reaped_child_t* child = job->reaped[j] ? NULL : find_reaped(batch, count, job->pids[j]);
+
+			if(child == NULL)
+			{
+				continue;
+			}
+
+			job->reaped[j] = 1;
+			job->running--;
+			matched++;
+
+			if(j == job->status_index)
+			{
+				job->status = decode_status(child->status);
+			}
+		}
+
+		if(job->running == 0)
 		{
-			bg_proc_manager.bg_processes[i] = bg_process;
-			bg_process->index = i;
-			bg_proc_manager.size++;
-			break;
+			job->done = 1;
+			finished[done++] = job;
 		}
 	}
-	printf("[%d] %d %s\n", bg_process->index+1,bg_process->pid, bg_process->command);	
-	return;
+
+	return done;
 }
 
 /**
- * Function frees the bg process
- * by finding the job with that pid
- * this also allows us to simply assign 
- * the next bg job to the first available space
- **/ 
-void free_bg_proc(pid_t pid, bg_proc_manager_t* bg_proc_manager)
+ * Looks up a job by %N or N (its number in the jobs list)
+ * or by the pid of any of its processes
+ * @param jobspec from the command line
+ * @return the job, NULL if there is no such job
+**/
+process_t* find_job(char* jobspec, bg_proc_manager_t* bg_proc_manager)
 {
-	if(!bg_proc_manager)
+	if(jobspec[0] == '%')
 	{
-		fprintf(stderr, "cannot free bg process if bg process manager is null");
-		return;
+		int bg_index = atoi(jobspec+1);
+
+		if(bg_index-1 < 0 || bg_index-1 >= MAX_BG_PROC)
+		{
+			return NULL;
+		}
+		return bg_proc_manager->bg_processes[bg_index-1];
+	}
+
+	pid_t pid = atoi(jobspec);
+
+	//small numbers are job indexes like the original fg took,
+	//anything else is treated as a pid
+	if(pid > 0 && pid <= MAX_BG_PROC && bg_proc_manager->bg_processes[pid-1] != NULL)
+	{
+		return bg_proc_manager->bg_processes[pid-1];
 	}
+
 	for(int i = 0; i < MAX_BG_PROC; i++)
 	{
-		if(bg_proc_manager->bg_processes[i] != NULL && bg_proc_manager->bg_processes[i]->pid == pid)
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		for(int j = 0; job != NULL && j < job->pid_count; j++)
 		{
-			free(bg_proc_manager->bg_processes[i]);
-			bg_proc_manager->bg_processes[i] = NULL;
-			bg_proc_manager->size--;
-			break;
+			if(job->pids[j] == pid)
+			{
+				return job;
+			}
 		}
 	}
+	return NULL;
 }
 
 /**
@@ -730,6 +2129,7 @@ void free_bg_proc(pid_t pid, bg_proc_manager_t* bg_proc_manager)
  * not, if it doesn't have an index
  * we pull the last started bg process
  * to the fg
+ * Ctrl-C stops waiting and leaves the job in the background
  **/
 void bring_to_fg(char** tokens, bg_proc_manager_t* bg_proc_manager)
 {
@@ -740,63 +2140,59 @@ void bring_to_fg(char** tokens, bg_proc_manager_t* bg_proc_manager)
 	}
 
 	int tokens_length = array_length(tokens);
+	process_t* job = NULL;
 
 	// handle the case where no index is passed in
 	if(tokens_length == 1)
 	{
-		int index = -1;
-
 		for(int i = 0; i < MAX_BG_PROC; i++)
 		{
 			if(bg_proc_manager->bg_processes[i] != NULL)
 			{
-					index = i;
+				job = bg_proc_manager->bg_processes[i];
 			}
 		}
 
-		if(index != -1)
-		{
-			waitpid(bg_proc_manager->bg_processes[index]->pid,NULL,0);
-			free_bg_proc(bg_proc_manager->bg_processes[index]->pid, bg_proc_manager);
-			bg_proc_manager->size--;
-		}
-		else
+		if(job == NULL)
 		{
 			printf("%s\n", "No bg processes currently running");
+			last_status = 1;
 			return;
 		}
-			
 	}
 	else
 	{
 		if(tokens_length > 2)
 		{
 			printf("%s\n", "Please provide a single valid bg process index");
+			last_status = 2;
 			return;
 		}
 
-		//atoi returning 0 either means the input
-		//was not valid
-		//or it means that the index
-		//passed in was 0 which is still invalid
-		int bg_index = atoi(tokens[1]);
-		if(bg_index-1 < 0 || bg_index-1 >= MAX_BG_PROC)
+		job = find_job(tokens[1], bg_proc_manager);
+
+		if(job == NULL)
 		{
 			printf("%s\n", "no such job");
+			last_status = 1;
 			return;
 		}
-		
-		if(bg_proc_manager->bg_processes[bg_index-1] != NULL)
-		{
-			waitpid(bg_proc_manager->bg_processes[bg_index-1]->pid,NULL,0);
-			free_bg_proc(bg_proc_manager->bg_processes[bg_index-1]->pid, bg_proc_manager);
-			bg_proc_manager->size--;
-		}
-		else
+	}
+
+	if(wait_for_jobs(bg_proc_manager, &job, 1, 0, -1, NULL) == WAIT_DONE)
+	{
+		//the job is collected here so its captured output is shown now
+		if(job->log != NULL)
 		{
-			printf("%s\n", "no such job");
-			return;
+			print_job_log(job, bg_proc_manager);
 		}
+
+		last_status = job->status;
+		free_bg_job(job, bg_proc_manager);
+	}
+	else
+	{
+		last_status = 130;
 	}
 }
 
@@ -809,15 +2205,31 @@ void print_jobs(bg_proc_manager_t* bg_proc_manager)
 	if(bg_proc_manager->size == 0)
 	{
 		printf("%s\n", "no jobs running in background");
+		fflush(stdout);
 		return;
 	}
 
 	printf("%s\n","No.\tStatus\tCommand");
 	for(int i = 0; i < MAX_BG_PROC; i++)
 	{
-		if(bg_proc_manager->bg_processes[i] != NULL)
+		process_t* job = bg_proc_manager->bg_processes[i];
+
+		if(job == NULL)
+		{
+			continue;
+		}
+
+		if(!job->done)
+		{
+			printf("[%d]\tRunning\t%s\n",i+1, job->command);
+		}
+		else if(job->status == 0)
+		{
+			printf("[%d]\tDone\t%s\n",i+1, job->command);
+		}
+		else
 		{
-			printf("[%d]\tRunning\t%s\n",i+1, bg_proc_manager->bg_processes[i]->command);
+			printf("[%d]\tExit %d\t%s\n",i+1, job->status, job->command);
 		}
 	}
 	fflush(stdout);
@@ -840,6 +2252,12 @@ void init_bg_proc_manager(bg_proc_manager_t* process_manager)
 		process_manager->bg_processes[i] = NULL;
 	}
 	process_manager->size = 0;
+	process_manager->next_finished = 0;
+
+	for(int i = 0; i < MAX_FINISHED_JOBS; i++)
+	{
+		process_manager->finished[i].job = 0;
+	}
 }
 
 void init_command_hist_arr(command_history_t* command_history)
@@ -922,39 +2340,302 @@ void free_history(command_history_t *command_history)
 	}
 }
 
+static void builtin_exit(char** tokens)
+{
+	int status = tokens[1] != NULL ? atoi(tokens[1]) : last_status;
+	free_history(&command_history);
+	free_var_table(&var_table);
+	//a server worker reports last_status back to its client on exit
+	last_status = status;
+	exit(status);
+}
+
+static void builtin_jobs(char** tokens)
+{
+	if(tokens[1] != NULL && strcmp(tokens[1], "-l") == 0)
+	{
+		print_job_usage(&proc_monitor, &bg_proc_manager);
+	}
+	else
+	{
+		print_jobs(&bg_proc_manager);
+	}
+	last_status = 0;
+}
+
+static void builtin_history(char** tokens)
+{
+	print_history(&command_history);
+	last_status = 0;
+}
+
+static void builtin_fg(char** tokens)
+{
+	bring_to_fg(tokens, &bg_proc_manager);
+}
+
+static void builtin_wait(char** tokens)
+{
+	wait_builtin(tokens, &bg_proc_manager);
+}
+
+static void builtin_jtop(char** tokens)
+{
+	jtop_builtin(tokens, &proc_monitor, &bg_proc_manager);
+}
+
+static void builtin_joblog(char** tokens)
+{
+	joblog_builtin(tokens, &job_log_config, &bg_proc_manager);
+}
+
+static void builtin_alias(char** tokens)
+{
+	alias_builtin(tokens, &function_table);
+}
+
+static void builtin_unalias(char** tokens)
+{
+	unalias_builtin(tokens, &function_table);
+}
+
+static void builtin_return(char** tokens)
+{
+	return_builtin(tokens, &function_table);
+}
+
+static void builtin_read(char** tokens)
+{
+	read_builtin(tokens, &line_reader);
+}
+
+static void builtin_exec(char** tokens)
+{
+	exec_builtin(tokens, &fd_table);
+}
+
+static void builtin_coproc(char** tokens)
+{
+	coproc_builtin(tokens, &coproc_table);
+}
+
+/**
+ * Commands that run inside the shell instead of being forked,
+ * this is where new builtins are added
+**/
+static builtin_t builtins[] =
+{
+	{"exit", builtin_exit},
+	{"jobs", builtin_jobs},
+	{"history", builtin_history},
+	{"fg", builtin_fg},
+	{"wait", builtin_wait},
+	{"stats", stats_builtin},
+	{"trace", trace_builtin},
+	{"jtop", builtin_jtop},
+	{"dag", dag_builtin},
+	{"joblog", builtin_joblog},
+	{"set", set_builtin},
+	{"allocs", allocs_builtin},
+	{"alias", builtin_alias},
+	{"unalias", builtin_unalias},
+	{"return", builtin_return},
+	{"read", builtin_read},
+	{"exec", builtin_exec},
+	{"coproc", builtin_coproc},
+	{NULL, NULL}
+};
+
+/**
+ * @return the builtin called name, NULL if it isn't one
+**/
+builtin_fn_t find_builtin(char* name)
+{
+	for(builtin_t* builtin = builtins; builtin->name != NULL; builtin++)
+	{
+		if(builtin->name[0] == name[0] && strcmp(builtin->name, name) == 0)
+		{
+			return builtin->run;
+		}
+	}
+	return NULL;
+}
+
 /**
  * this function serves as a way to clean up the run_shell()
- * function, this is where I will add commands that don't
- * necessarily need tokenizing
+ * function, it runs the command if it is a builtin
+ * @param tokens NULL terminated command
+ * @return 0 if the command was a builtin, 1 otherwise
 **/
-int check_basic_commands(char** command)
+int check_basic_commands(char** tokens)
 {
-	if(!(*command))
+	if(!tokens || !tokens[0])
 	{
 		fprintf(stderr, "Cannot interpret NULL command");
 		return 1;
 	}
 
-	if(strcmp(*command,"exit") == 0)
+	builtin_fn_t builtin = find_builtin(tokens[0]);
+
+	if(builtin == NULL)
 	{
-		free(*command);
-		free_history(&command_history);
-		exit(EXIT_SUCCESS);
+		return 1;
+	}
+
+	builtin(tokens);
+	return 0;
+}
+
+/**
+ * The "set" builtin for shell options, "set" alone prints them
+ * "set -b" or "set -o notify" reports finished jobs as soon as they
+ * finish while the shell waits at the prompt
+ * "set +b" or "set +o notify" holds them until the next prompt
+ * "set -o pipestats" times the pipes of every pipeline and prints
+ * what each one moved and how long it waited on either side
+**/
+void set_builtin(char** tokens)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		printf("notify\t%s\n", notify_queue.immediate ? "on" : "off");
+		printf("pipestats\t%s\n", pipe_stats_config.enabled ? "on" : "off");
+		printf("pipeerr\t%s\n", pipe_err_enabled ? "on" : "off");
+		fflush(stdout);
+		return;
 	}
 
-	else if(strcmp(*command,"jobs") == 0)
+	for(int i = 1; tokens[i] != NULL; i++)
 	{
-		print_jobs(&bg_proc_manager);
-		free(*command);
-		return 0;
+		char* option = tokens[i];
+		char* name = NULL;
+
+		//the flag is read only once the word is known to start with - or +,
+		//an empty word has nothing past its terminator
+		if((option[0] == '-' || option[0] == '+') && strcmp(option + 1, "b") == 0)
+		{
+			name = "notify";
+		}
+		else if((option[0] == '-' || option[0] == '+') && strcmp(option + 1, "o") == 0)
+		{
+			name = tokens[++i];
+		}
+
+		if(name == NULL)
+		{
+			fprintf(stderr, "usage: set [-b|+b] [-o|+o notify|pipestats|pipeerr]\n");
+			last_status = 2;
+			return;
+		}
+
+		if(strcmp(name, "notify") == 0)
+		{
+			notify_queue.immediate = option[0] == '-';
+		}
+		else if(strcmp(name, "pipestats") == 0)
+		{
+			pipe_stats_config.enabled = option[0] == '-';
+		}
+		else if(strcmp(name, "pipeerr") == 0)
+		{
+			pipe_err_enabled = option[0] == '-';
+		}
+		else
+		{
+			fprintf(stderr, "set: %s: unknown option\n", name);
+			last_status = 1;
+			return;
+		}
+	}
+}
+
+/**
+ * The "stats" builtin, prints latency percentiles
+ * "stats -j [file]" dumps the histograms as JSON
+ * "stats -r" clears them
+**/
+void stats_builtin(char** tokens)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		print_stats(&stats);
+		return;
 	}
 
-	else if(strcmp(*command, "history") == 0)
+	if(strcmp(tokens[1], "-r") == 0)
 	{
-		print_history(&command_history);
-		free(*command);
-		return 0;
+		reset_stats(&stats);
+		return;
 	}
 
-	return 1;
+	if(strcmp(tokens[1], "-j") == 0)
+	{
+		if(tokens[2] == NULL)
+		{
+			print_stats_json(&stats, stdout);
+			return;
+		}
+
+		FILE* out = fopen(tokens[2], "w");
+
+		if(out == NULL)
+		{
+			perror("Could not open stats file");
+			last_status = 1;
+			return;
+		}
+
+		print_stats_json(&stats, out);
+		fclose(out);
+		return;
+	}
+
+	fprintf(stderr, "usage: stats [-r | -j [file]]\n");
+	last_status = 2;
+}
+
+/**
+ * The "trace" builtin, "trace on [file]" starts recording
+ * Chrome trace events and "trace off" writes them out
+**/
+void trace_builtin(char** tokens)
+{
+	last_status = 0;
+
+	if(tokens[1] == NULL)
+	{
+		printf("tracing is %s\n", tracer.enabled ? "on" : "off");
+		return;
+	}
+
+	if(strcmp(tokens[1], "on") == 0)
+	{
+		if(trace_on(&tracer, tokens[2]) == -1)
+		{
+			last_status = 1;
+		}
+		return;
+	}
+
+	if(strcmp(tokens[1], "off") == 0)
+	{
+		trace_off(&tracer);
+		return;
+	}
+
+	fprintf(stderr, "usage: trace [on [file] | off]\n");
+	last_status = 2;
+}
+
+/**
+ * Registered with atexit() so a trace still gets
+ * written when the shell leaves through exit()
+**/
+void flush_trace_at_exit()
+{
+	trace_off(&tracer);
 }
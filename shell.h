@@ -1,22 +1,89 @@
 #ifndef SHELL_H
 #define SHELL_H
 #include <sys/types.h>
+#include <signal.h>
+#include "launch_opts.h"
 
-#define MAX_BG_PROC 100
+#define MAX_BG_PROC 1024
 #define MAX_COM_HIST 200
+#define MAX_JOB_PROCS 64
 
+//reported jobs whose status wait can still collect, oldest go first
+#define MAX_FINISHED_JOBS 64
+
+//children collected per waitpid pass before the job table is updated
+#define REAP_BATCH 256
+
+struct job_log_t;
+struct pipe_stats_t;
+struct command_plan_t;
+
+typedef void (*builtin_fn_t)(char** tokens);
+
+typedef struct builtin_t
+{
+	char* name;
+	builtin_fn_t run;
+
+}builtin_t;
+
+/**
+ * A background job, every process of a pipeline belongs to
+ * the same job and the job is done once all of them are reaped
+**/
 typedef struct process_t
 {
 	int index;
 	pid_t pid;
 	char* command;
 
+	pid_t pids[MAX_JOB_PROCS];
+	char reaped[MAX_JOB_PROCS];
+	int pid_count;
+	int running;
+
+	//the process whose exit status is the job's status
+	int status_index;
+	int status;
+	int done;
+
+	//captured output, NULL when the job writes to the terminal
+	struct job_log_t* log;
+
+	//figures of its pipes when started with set -o pipestats
+	struct pipe_stats_t* pipe_stats;
+
 }process_t;
 
+/**
+ * A child collected by waitpid, waiting to be matched to its job
+**/
+typedef struct reaped_child_t
+{
+	pid_t pid;
+	int status;
+
+}reaped_child_t;
+
+/**
+ * A job that left the table once it was reported as done
+**/
+typedef struct finished_job_t
+{
+	int job;
+	pid_t pid;
+	int status;
+
+}finished_job_t;
+
 typedef struct bg_proc_manager_t
 {
 	process_t* bg_processes[MAX_BG_PROC];
 	int size;
+
+	//ring of reported jobs, job 0 marks an empty or collected entry
+	finished_job_t finished[MAX_FINISHED_JOBS];
+	int next_finished;
 	
 }bg_proc_manager_t;
 
@@ -29,6 +96,10 @@ typedef struct command_history_t
 
 void run_shell();
 
+int run_command_line(char* command, int read_more);
+
+int execute_tokens(char** tokens, int token_count);
+
 void register_signal_handler();
 
 void kill_child_process();
@@ -43,20 +114,48 @@ void register_sig_chld_handler();
 
 void sig_chld_handler(int sig);
 
-int execute_command(char** command, char** files, int background);
+int reap_children();
+
+int execute_plan(struct command_plan_t* plan, char** tokens, int token_count);
+
+int execute_command(char** command, char** tokens, char** files, int background, launch_opts_t* opts);
 
 char** prepare_command_array(char** tokens, int array_length);
 
 char** check_for_files(char** array, int array_length);
 
-void implement_pipeline(char** first_command,char** second_command, int background);
+void implement_pipeline(char** commands[], int* stderr_piped, int command_count, int consumer_count, int background);
+
+void exec_pipeline_stage(char** command, int stage, launch_opts_t* opts, int foreground);
+
+pid_t spawn_coproc(char** command, int to_child[2], int from_child[2]);
 
 void print_prompt();
 
-void init_bg_process(pid_t pid,command_history_t* command_history);
+void print_continuation_prompt();
+
+void block_sig_chld(sigset_t* prev_mask);
+
+int decode_status(int status);
+
+char* job_name(char** commands[], int* stderr_piped, int command_count, int consumer_count);
+
+process_t* init_bg_process(pid_t* pids, int pid_count, int status_index, int log_fd, char* name);
 
 void free_bg_proc(pid_t pid,bg_proc_manager_t* bg_proc_manager);
 
+void free_bg_job(process_t* job, bg_proc_manager_t* bg_proc_manager);
+
+void forget_bg_job(process_t* job, bg_proc_manager_t* bg_proc_manager);
+
+int collect_finished_job(char* jobspec, bg_proc_manager_t* bg_proc_manager);
+
+process_t* reap_bg_proc(pid_t pid, int status, bg_proc_manager_t* bg_proc_manager);
+
+int reap_bg_batch(reaped_child_t* batch, int count, bg_proc_manager_t* bg_proc_manager, process_t** finished);
+
+process_t* find_job(char* jobspec, bg_proc_manager_t* bg_proc_manager);
+
 void bring_to_fg(char** tokens, bg_proc_manager_t* bg_proc_manager);
 
 void print_jobs(bg_proc_manager_t* bg_proc_manager);
@@ -71,7 +170,19 @@ void add_to_history(command_history_t* command_history, char* command);
 
 void free_history(command_history_t* command_history);
 
-int check_basic_commands(char** command);
+int check_basic_commands(char** tokens);
+
+builtin_fn_t find_builtin(char* name);
+
+void set_builtin(char** tokens);
+
+void stats_builtin(char** tokens);
+
+void trace_builtin(char** tokens);
+
+void trace_fork_end(pid_t pid);
+
+void flush_trace_at_exit();
 
 #endif
 
@@ -0,0 +1,171 @@
+#include "stage_stderr.h"
+#include "utils.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/**
+ * A stage's stderr as the relay sees it, bytes after the last
+ * newline wait here for the rest of their line
+**/
+typedef struct stage_line_t
+{
+	char prefix[STAGE_NAME_MAX + 16];
+	char text[STAGE_LINE_MAX];
+	int length;
+
+}stage_line_t;
+
+/**
+ * Opens one close-on-exec pipe per stage, a stage moves its write
+ * end onto stderr so exec keeps only that copy
+ * @param fds room for 2 * stage_count, stage i gets fds[2*i] to read
+ * and fds[2*i+1] to write
+ * @return 0 on success, -1 with nothing left open
+**/
+int open_stage_stderr(int stage_count, int* fds)
+{
+	for(int i = 0; i < stage_count; i++)
+	{
+		if(pipe2(&fds[2 * i], O_CLOEXEC) == -1)
+		{
+			perror("Could not create stage stderr pipe");
+			close_stage_stderr(i, fds);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void close_stage_stderr(int stage_count, int* fds)
+{
+	for(int i = 0; i < 2 * stage_count; i++)
+	{
+		close(fds[i]);
+	}
+}
+
+/**
+ * Moves a finished line into out behind its stage's prefix, out is
+ * flushed first when it can't take the line
+**/
+static void emit_line(stage_line_t* line, char* out, size_t* out_length, size_t out_size)
+{
+	size_t prefix_length = strlen(line->prefix);
+	size_t needed = prefix_length + line->length + 1;
+
+	if(*out_length + needed > out_size)
+	{
+		write_all(STDERR_FILENO, out, *out_length);
+		*out_length = 0;
+	}
+
+	memcpy(out + *out_length, line->prefix, prefix_length);
+	memcpy(out + *out_length + prefix_length, line->text, line->length);
+	out[*out_length + needed - 1] = '\n';
+
+	*out_length += needed;
+	line->length = 0;
+}
+
+/**
+ * Runs in the relay process of a pipeline under set -o pipeerr, reads
+ * the stderr pipe of every stage and writes their lines to its own
+ * stderr, each one behind "[N name] " for the stage that wrote it.
+ * Whole lines are written, so diagnostics of two stages never end up
+ * mixed within a line. Exits once every stage has closed its pipe
+ * @param fds from open_stage_stderr(), the write ends are closed here
+ * @param commands the stages, their names go in the prefix
+**/
+void relay_stage_stderr(int* fds, char*** commands, int stage_count)
+{
+	struct pollfd polled[stage_count];
+	stage_line_t* lines = malloc(sizeof(stage_line_t) * stage_count);
+	size_t out_size = STAGE_READ_CHUNK + STAGE_LINE_MAX + sizeof(lines->prefix) + 1;
+	char* out = malloc(out_size);
+	char* chunk = malloc(STAGE_READ_CHUNK);
+	int open_count = stage_count;
+
+	if(lines == NULL || out == NULL || chunk == NULL)
+	{
+		perror("Could not allocate memory for stage stderr");
+		exit(EXIT_FAILURE);
+	}
+
+	for(int i = 0; i < stage_count; i++)
+	{
+		close(fds[2 * i + 1]);
+
+		snprintf(lines[i].prefix, sizeof(lines[i].prefix), "[%d %.*s] ", i, STAGE_NAME_MAX, commands[i][0]);
+		lines[i].length = 0;
+
+		polled[i].fd = fds[2 * i];
+		polled[i].events = POLLIN;
+	}
+
+	while(open_count > 0)
+	{
+		if(poll(polled, stage_count, -1) < 0)
+		{
+			if(errno == EINTR)
+			{
+				continue;
+			}
+			perror("Stage stderr relay");
+			exit(EXIT_FAILURE);
+		}
+
+		size_t out_length = 0;
+
+		for(int i = 0; i < stage_count; i++)
+		{
+			if(polled[i].revents == 0)
+			{
+				continue;
+			}
+
+			stage_line_t* line = &lines[i];
+			ssize_t bytes_read = read(polled[i].fd, chunk, STAGE_READ_CHUNK);
+
+			if(bytes_read < 0 && errno == EINTR)
+			{
+				continue;
+			}
+
+			//end of input, a last line without its newline still gets one
+			if(bytes_read <= 0)
+			{
+				if(line->length > 0)
+				{
+					emit_line(line, out, &out_length, out_size);
+				}
+
+				close(polled[i].fd);
+				polled[i].fd = -1;
+				open_count--;
+				continue;
+			}
+
+			for(ssize_t j = 0; j < bytes_read; j++)
+			{
+				if(chunk[j] != '\n')
+				{
+					line->text[line->length++] = chunk[j];
+				}
+
+				if(chunk[j] == '\n' || line->length == STAGE_LINE_MAX)
+				{
+					emit_line(line, out, &out_length, out_size);
+				}
+			}
+		}
+
+		write_all(STDERR_FILENO, out, out_length);
+	}
+
+	exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,19 @@
+#ifndef STAGE_STDERR_H
+#define STAGE_STDERR_H
+
+//longest line a stage can write before it is cut in two
+#define STAGE_LINE_MAX 4096
+
+//bytes read from a stage's pipe in one go
+#define STAGE_READ_CHUNK 65536
+
+//command names kept for the prefix, longer ones are cut
+#define STAGE_NAME_MAX 24
+
+int open_stage_stderr(int stage_count, int* fds);
+
+void close_stage_stderr(int stage_count, int* fds);
+
+void relay_stage_stderr(int* fds, char*** commands, int stage_count);
+
+#endif
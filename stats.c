@@ -0,0 +1,272 @@
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+
+static char* hist_names[HIST_COUNT] = {"spawn", "run", "wait", "builtin", "parse", "reap"};
+
+/**
+ * Sets up empty histograms and the page shared with
+ * children for exec timestamps
+ * @param stats to initialize
+**/
+void init_stats(stats_t* stats)
+{
+	memset(stats->histograms, 0, sizeof(stats->histograms));
+	stats->reaped = 0;
+
+	stats->exec_times = mmap(NULL, sizeof(uint64_t) * STATS_MAX_STAGES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(stats->exec_times == MAP_FAILED)
+	{
+		perror("Could not map stats page");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/**
+ * @return monotonic clock in nanoseconds
+**/
+uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Maps a value to its log bucket, values below SUB_BUCKETS
+ * get a bucket each and every power of two above that
+ * is split into SUB_BUCKETS linear pieces
+**/
+static int bucket_index(uint64_t value)
+{
+	if(value < SUB_BUCKETS)
+	{
+		return value;
+	}
+
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - SUB_BUCKET_BITS;
+
+	return (shift + 1) * SUB_BUCKETS + ((value >> shift) & (SUB_BUCKETS - 1));
+}
+
+/**
+ * @return the largest value that lands in a bucket
+**/
+static uint64_t bucket_upper(int index)
+{
+	if(index < SUB_BUCKETS)
+	{
+		return index;
+	}
+
+	int shift = index / SUB_BUCKETS - 1;
+	uint64_t lower = (uint64_t) (SUB_BUCKETS + index % SUB_BUCKETS) << shift;
+
+	return lower + ((1ULL << shift) - 1);
+}
+
+/**
+ * Adds a sample to a histogram, this is only a
+ * few adds so it is cheap enough to leave on
+ * @param hist which histogram to record into
+ * @param ns sample in nanoseconds
+**/
+void record_latency(stats_t* stats, hist_id_t hist, uint64_t ns)
+{
+	histogram_t* histogram = &stats->histograms[hist];
+
+	histogram->counts[bucket_index(ns)]++;
+	histogram->count++;
+	histogram->sum += ns;
+
+	if(ns > histogram->max)
+	{
+		histogram->max = ns;
+	}
+}
+
+/**
+ * Clears every histogram
+**/
+void reset_stats(stats_t* stats)
+{
+	memset(stats->histograms, 0, sizeof(stats->histograms));
+	stats->reaped = 0;
+}
+
+/**
+ * Records one pass that collected exited children, called from
+ * the SIGCHLD handler so it only updates counters
+ * @param children number of children the pass reaped
+**/
+void record_reap(stats_t* stats, int children, uint64_t ns)
+{
+	record_latency(stats, HIST_REAP, ns);
+	stats->reaped += children;
+}
+
+/**
+ * Called by a foreground child right before execvp(), or by the
+ * shell once posix_spawnp() returns, background children don't mark
+ * since nothing waits to read their slot
+ * @param stage index of the command in its pipeline
+**/
+void mark_exec(stats_t* stats, int stage)
+{
+	if(stage < STATS_MAX_STAGES)
+	{
+		stats->exec_times[stage] = now_ns();
+	}
+}
+
+/**
+ * Records spawn and run time of a reaped foreground child, a
+ * child that never reached execvp() only counts as run time
+ * @param stage index of the command in its pipeline
+ * @param fork_time taken right before fork()
+ * @param reaped_time taken right after waitpid() returned
+**/
+void record_child(stats_t* stats, int stage, uint64_t fork_time, uint64_t reaped_time)
+{
+	uint64_t exec_time = stage < STATS_MAX_STAGES ? stats->exec_times[stage] : 0;
+
+	if(exec_time < fork_time)
+	{
+		record_latency(stats, HIST_RUN, reaped_time - fork_time);
+		return;
+	}
+
+	record_latency(stats, HIST_SPAWN, exec_time - fork_time);
+	record_latency(stats, HIST_RUN, reaped_time > exec_time ? reaped_time - exec_time : 0);
+}
+
+/**
+ * @param percentile between 0 and 100
+ * @return upper edge of the bucket holding the percentile,
+ * capped at the largest value seen
+**/
+uint64_t hist_percentile(histogram_t* histogram, double percentile)
+{
+	if(histogram->count == 0)
+	{
+		return 0;
+	}
+
+	uint64_t target = (uint64_t) (histogram->count * percentile / 100.0 + 0.5);
+
+	if(target == 0)
+	{
+		target = 1;
+	}
+
+	uint64_t seen = 0;
+
+	for(int i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += histogram->counts[i];
+
+		if(seen >= target)
+		{
+			uint64_t upper = bucket_upper(i);
+			return upper < histogram->max ? upper : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+/**
+ * Formats nanoseconds with a readable unit
+**/
+static void format_ns(uint64_t ns, char* buf, int size)
+{
+	if(ns < 1000)
+	{
+		snprintf(buf, size, "%luns", (unsigned long) ns);
+	}
+	else if(ns < 1000000)
+	{
+		snprintf(buf, size, "%.1fus", ns / 1e3);
+	}
+	else if(ns < 1000000000)
+	{
+		snprintf(buf, size, "%.1fms", ns / 1e6);
+	}
+	else
+	{
+		snprintf(buf, size, "%.2fs", ns / 1e9);
+	}
+}
+
+/**
+ * Prints count and p50/p90/p99/max for every histogram
+**/
+void print_stats(stats_t* stats)
+{
+	printf("%-8s %8s %10s %10s %10s %10s\n", "", "count", "p50", "p90", "p99", "max");
+
+	for(int i = 0; i < HIST_COUNT; i++)
+	{
+		histogram_t* histogram = &stats->histograms[i];
+		char p50[32], p90[32], p99[32], max[32];
+
+		format_ns(hist_percentile(histogram, 50), p50, sizeof(p50));
+		format_ns(hist_percentile(histogram, 90), p90, sizeof(p90));
+		format_ns(hist_percentile(histogram, 99), p99, sizeof(p99));
+		format_ns(histogram->max, max, sizeof(max));
+
+		printf("%-8s %8lu %10s %10s %10s %10s\n", hist_names[i], (unsigned long) histogram->count, p50, p90, p99, max);
+	}
+
+	if(stats->reaped > 0)
+	{
+		char total[32];
+
+		format_ns(stats->histograms[HIST_REAP].sum, total, sizeof(total));
+		printf("reaped %lu children in %lu passes, %s in all\n", (unsigned long) stats->reaped, (unsigned long) stats->histograms[HIST_REAP].count, total);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Dumps every histogram as JSON, including the non-empty
+ * buckets as [upper_ns, count] pairs so they can be re-plotted
+**/
+void print_stats_json(stats_t* stats, FILE* out)
+{
+	fprintf(out, "{");
+
+	for(int i = 0; i < HIST_COUNT; i++)
+	{
+		histogram_t* histogram = &stats->histograms[i];
+
+		fprintf(out, "%s\"%s\":{\"count\":%lu,\"sum_ns\":%lu,\"p50_ns\":%lu,\"p90_ns\":%lu,\"p99_ns\":%lu,\"max_ns\":%lu,\"buckets\":[",
+			i == 0 ? "" : ",", hist_names[i],
+			(unsigned long) histogram->count, (unsigned long) histogram->sum,
+			(unsigned long) hist_percentile(histogram, 50), (unsigned long) hist_percentile(histogram, 90),
+			(unsigned long) hist_percentile(histogram, 99), (unsigned long) histogram->max);
+
+		int first = 1;
+
+		for(int j = 0; j < HIST_BUCKETS; j++)
+		{
+			if(histogram->counts[j] != 0)
+			{
+				fprintf(out, "%s[%lu,%lu]", first ? "" : ",", (unsigned long) bucket_upper(j), (unsigned long) histogram->counts[j]);
+				first = 0;
+			}
+		}
+
+		fprintf(out, "]}");
+	}
+
+	fprintf(out, ",\"reaped\":%lu}\n", (unsigned long) stats->reaped);
+	fflush(out);
+}
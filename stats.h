@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdint.h>
+#include <stdio.h>
+
+//16 sub-buckets per power of two keeps every bucket within ~6%
+#define SUB_BUCKET_BITS 4
+#define SUB_BUCKETS (1 << SUB_BUCKET_BITS)
+#define HIST_BUCKETS ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS)
+
+#define STATS_MAX_STAGES 64
+
+typedef enum hist_id_t
+{
+	HIST_SPAWN,
+	HIST_RUN,
+	HIST_WAIT,
+	HIST_BUILTIN,
+	HIST_PARSE,
+	HIST_REAP,
+	HIST_COUNT
+
+}hist_id_t;
+
+typedef struct histogram_t
+{
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+
+}histogram_t;
+
+typedef struct stats_t
+{
+	histogram_t histograms[HIST_COUNT];
+
+	//children collected by the reap passes timed in HIST_REAP
+	uint64_t reaped;
+
+	//shared with children so each stage can stamp the
+	//moment right before it calls execvp()
+	volatile uint64_t* exec_times;
+
+}stats_t;
+
+void init_stats(stats_t* stats);
+
+uint64_t now_ns();
+
+void record_latency(stats_t* stats, hist_id_t hist, uint64_t ns);
+
+void reset_stats(stats_t* stats);
+
+void record_reap(stats_t* stats, int children, uint64_t ns);
+
+void mark_exec(stats_t* stats, int stage);
+
+void record_child(stats_t* stats, int stage, uint64_t fork_time, uint64_t reaped_time);
+
+uint64_t hist_percentile(histogram_t* histogram, double percentile);
+
+void print_stats(stats_t* stats);
+
+void print_stats_json(stats_t* stats, FILE* out);
+
+#endif
@@ -0,0 +1,28 @@
+#!/bin/bash
+# Replays every tests/*.cmds file through a shell built with
+# make ALLOC_STATS=1. Each file runs its commands once to warm up,
+# runs allocs mark, replays them and ends in allocs check BYTES, so a
+# leak or a peak above BYTES fails the file.
+# usage: tests/run.sh [counting shell binary]
+
+SHELL_BIN=${1:-./tests/alloc_shell}
+DIR=$(dirname "$0")
+failed=0
+
+# history keeps 200 lines, past that each new line only replaces one
+WARMUP=210
+
+for file in "$DIR"/*.cmds; do
+	errors=$({ seq "$WARMUP" | sed 's/^/WARM=/'; cat "$file"; } | "$SHELL_BIN" 2>&1 > /dev/null)
+	status=$?
+
+	if [ $status -ne 0 ] || grep -q '^allocs:' <<< "$errors"; then
+		printf "%-20s FAIL\n" "$(basename "$file")"
+		grep '^allocs:' <<< "$errors"
+		failed=1
+	else
+		printf "%-20s ok\n" "$(basename "$file")"
+	fi
+done
+
+exit $failed
@@ -0,0 +1,193 @@
+#include "trace.h"
+#include "stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/**
+ * Sets up a disabled tracer, tracing starts right away
+ * when CSHELL_TRACE names an output file
+ * @param tracer to initialize
+**/
+void init_trace(trace_t* tracer)
+{
+	tracer->enabled = 0;
+	tracer->owner = getpid();
+	tracer->start = 0;
+	tracer->file_name = NULL;
+	tracer->ring = NULL;
+
+	char* file_name = getenv("CSHELL_TRACE");
+
+	if(file_name != NULL && *file_name != '\0')
+	{
+		trace_on(tracer, file_name);
+	}
+}
+
+/**
+ * Starts recording events, the ring is mapped the first
+ * time and kept for the life of the shell
+ * @param file_name where the trace is written on flush,
+ * NULL for TRACE_DEFAULT_FILE
+ * @return 0 on success, -1 if the ring can't be mapped
+**/
+int trace_on(trace_t* tracer, char* file_name)
+{
+	if(tracer->ring == NULL)
+	{
+		tracer->ring = mmap(NULL, sizeof(trace_ring_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+		if(tracer->ring == MAP_FAILED)
+		{
+			perror("Could not map trace ring");
+			tracer->ring = NULL;
+			return -1;
+		}
+	}
+
+	free(tracer->file_name);
+	tracer->file_name = strdup(file_name != NULL ? file_name : TRACE_DEFAULT_FILE);
+	tracer->start = tracer->ring->head;
+	tracer->enabled = 1;
+
+	return 0;
+}
+
+/**
+ * Stops recording and writes out what was recorded
+**/
+void trace_off(trace_t* tracer)
+{
+	if(!tracer->enabled)
+	{
+		return;
+	}
+
+	flush_trace(tracer);
+	tracer->enabled = 0;
+}
+
+/**
+ * Adds an event to the ring, a slot is claimed with a single
+ * atomic add so this is safe from children and from signal
+ * handlers, old events are overwritten once the ring wraps
+ * @param phase Chrome trace phase, 'B' begin, 'E' end or 'i' instant
+ * @param name event name, must be a string literal so the
+ * pointer is still valid in the shell after a fork
+ * @param tid process the event belongs to, 0 for the caller
+ * @param detail optional text shown with the event
+**/
+void trace_event(trace_t* tracer, char phase, char* name, pid_t tid, char* detail)
+{
+	if(!tracer->enabled)
+	{
+		return;
+	}
+
+	uint64_t seq = __atomic_fetch_add(&tracer->ring->head, 1, __ATOMIC_RELAXED);
+
+	trace_event_t* event = &tracer->ring->events[seq & (TRACE_RING_SIZE - 1)];
+
+	event->ts_ns = now_ns();
+	event->tid = tid != 0 ? tid : getpid();
+	event->phase = phase;
+	event->name = name;
+
+	if(detail != NULL)
+	{
+		strncpy(event->detail, detail, TRACE_DETAIL_LEN - 1);
+		event->detail[TRACE_DETAIL_LEN - 1] = '\0';
+	}
+	else
+	{
+		event->detail[0] = '\0';
+	}
+
+	//publish last so a flush never reads a half written slot
+	__atomic_store_n(&event->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Writes a string as a JSON string body
+**/
+static void write_json_string(FILE* out, char* str)
+{
+	for(; *str; str++)
+	{
+		if(*str == '"' || *str == '\\')
+		{
+			fputc('\\', out);
+			fputc(*str, out);
+		}
+		else if((unsigned char) *str < 0x20)
+		{
+			fprintf(out, "\\u%04x", *str);
+		}
+		else
+		{
+			fputc(*str, out);
+		}
+	}
+}
+
+/**
+ * Writes the ring out in Chrome Trace Event JSON, each process
+ * gets its own track so pipeline stages line up side by side.
+ * Only the shell that started tracing writes, children that
+ * exit through exit() leave the file alone
+**/
+void flush_trace(trace_t* tracer)
+{
+	if(!tracer->enabled || tracer->ring == NULL || getpid() != tracer->owner)
+	{
+		return;
+	}
+
+	FILE* out = fopen(tracer->file_name, "w");
+
+	if(out == NULL)
+	{
+		perror("Could not open trace file");
+		return;
+	}
+
+	uint64_t head = __atomic_load_n(&tracer->ring->head, __ATOMIC_ACQUIRE);
+	uint64_t start = head - tracer->start > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : tracer->start;
+	int first = 1;
+
+	fprintf(out, "{\"traceEvents\":[\n");
+
+	for(uint64_t seq = start; seq < head; seq++)
+	{
+		trace_event_t* event = &tracer->ring->events[seq & (TRACE_RING_SIZE - 1)];
+
+		if(__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != seq + 1)
+		{
+			continue;
+		}
+
+		fprintf(out, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+			first ? "" : ",\n", event->name, event->phase, event->ts_ns / 1000.0, tracer->owner, event->tid);
+
+		if(event->phase == 'i')
+		{
+			fprintf(out, ",\"s\":\"t\"");
+		}
+
+		if(event->detail[0] != '\0')
+		{
+			fprintf(out, ",\"args\":{\"detail\":\"");
+			write_json_string(out, event->detail);
+			fprintf(out, "\"}");
+		}
+
+		fprintf(out, "}");
+		first = 0;
+	}
+
+	fprintf(out, "\n]}\n");
+	fclose(out);
+}
@@ -0,0 +1,54 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdint.h>
+#include <sys/types.h>
+
+//must stay a power of two so the ring index is a mask
+#define TRACE_RING_SIZE 65536
+#define TRACE_DETAIL_LEN 48
+#define TRACE_DEFAULT_FILE "cshell_trace.json"
+
+typedef struct trace_event_t
+{
+	uint64_t seq;
+	uint64_t ts_ns;
+	pid_t tid;
+	char phase;
+	char* name;
+	char detail[TRACE_DETAIL_LEN];
+
+}trace_event_t;
+
+/**
+ * The ring lives in a MAP_SHARED mapping so children can
+ * add events between fork() and execvp() and the shell
+ * sees them when it flushes
+**/
+typedef struct trace_ring_t
+{
+	uint64_t head;
+	trace_event_t events[TRACE_RING_SIZE];
+
+}trace_ring_t;
+
+typedef struct trace_t
+{
+	int enabled;
+	pid_t owner;
+	uint64_t start;
+	char* file_name;
+	trace_ring_t* ring;
+
+}trace_t;
+
+void init_trace(trace_t* tracer);
+
+int trace_on(trace_t* tracer, char* file_name);
+
+void trace_off(trace_t* tracer);
+
+void trace_event(trace_t* tracer, char phase, char* name, pid_t tid, char* detail);
+
+void flush_trace(trace_t* tracer);
+
+#endif
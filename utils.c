@@ -2,6 +2,8 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
 
 int array_length(char** array)
 {
@@ -21,3 +23,29 @@ int array_length(char** array)
 	return length;
 
 }
+
+/**
+ * Writes a whole buffer, retrying short writes and EINTR
+ * @return 0 on success, -1 if the reader went away or write failed
+**/
+int write_all(int fd, char* buffer, size_t length)
+{
+	while(length > 0)
+	{
+		ssize_t written = write(fd, buffer, length);
+
+		if(written < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if(written <= 0)
+		{
+			return -1;
+		}
+
+		buffer += written;
+		length -= written;
+	}
+	return 0;
+}
@@ -2,7 +2,11 @@
 
 #define UTILS_H
 
+#include <stddef.h>
+
 int array_length(char** array);
 
+int write_all(int fd, char* buffer, size_t length);
+
 #endif
 
@@ -0,0 +1,367 @@
+#include "variables.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+/**
+ * Initializes an empty shell variable table
+ * @param var_table table to initialize
+**/
+void init_var_table(var_table_t* var_table)
+{
+	for(int i = 0; i < MAX_SHELL_VARS; i++)
+	{
+		var_table->vars[i].name = NULL;
+		var_table->vars[i].value = NULL;
+	}
+	var_table->size = 0;
+	var_table->positional = NULL;
+	var_table->positional_count = 0;
+}
+
+/**
+ * Finds the slot of a variable in the table
+ * @param name of the variable
+ * @param length number of characters of name to compare
+ * @return index of the variable, -1 if not set
+**/
+static int find_var(var_table_t* var_table, char* name, int length)
+{
+	for(int i = 0; i < var_table->size; i++)
+	{
+		if(strncmp(var_table->vars[i].name, name, length) == 0 && var_table->vars[i].name[length] == '\0')
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Sets a shell variable, replacing the old value if it exists
+ * @param name of the variable
+ * @param value that will be copied into the table
+**/
+void set_var(var_table_t* var_table, char* name, char* value)
+{
+	if(!var_table || !name || !value)
+	{
+		fprintf(stderr, "variable table, name and value cannot be NULL\n");
+		return;
+	}
+
+	char* new_value = strdup(value);
+
+	if(new_value == NULL)
+	{
+		perror("Could not allocate memory for variable");
+		exit(EXIT_FAILURE);
+	}
+
+	int index = find_var(var_table, name, strlen(name));
+
+	if(index != -1)
+	{
+		free(var_table->vars[index].value);
+		var_table->vars[index].value = new_value;
+		return;
+	}
+
+	if(var_table->size == MAX_SHELL_VARS)
+	{
+		fprintf(stderr, "too many shell variables, cannot set %s\n", name);
+		free(new_value);
+		return;
+	}
+
+	var_table->vars[var_table->size].name = strdup(name);
+	var_table->vars[var_table->size].value = new_value;
+	var_table->size++;
+}
+
+/**
+ * Looks up a variable, shell variables take priority
+ * over the environment
+ * @param name of the variable
+ * @return the value, NULL if it is not set anywhere
+**/
+char* get_var(var_table_t* var_table, char* name)
+{
+	int index = find_var(var_table, name, strlen(name));
+
+	if(index != -1)
+	{
+		return var_table->vars[index].value;
+	}
+
+	return getenv(name);
+}
+
+/**
+ * Releases every name and value held by the table
+**/
+void free_var_table(var_table_t* var_table)
+{
+	for(int i = 0; i < var_table->size; i++)
+	{
+		free(var_table->vars[i].name);
+		free(var_table->vars[i].value);
+		var_table->vars[i].name = NULL;
+		var_table->vars[i].value = NULL;
+	}
+	var_table->size = 0;
+}
+
+/**
+ * Checks that a name is a letter or underscore followed
+ * by letters, digits or underscores
+ * @param name to check
+ * @param length number of characters to check
+ * @return 1 if valid, 0 otherwise
+**/
+int is_valid_name(char* name, int length)
+{
+	if(length <= 0 || !(isalpha((unsigned char) name[0]) || name[0] == '_'))
+	{
+		return 0;
+	}
+
+	for(int i = 1; i < length; i++)
+	{
+		if(!(isalnum((unsigned char) name[i]) || name[i] == '_'))
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Checks a name that may end in a subscript, as in ${COPROC[1]}
+ * Elements are stored as plain variables named NAME[N]
+ * @param length number of characters of name to check
+**/
+int is_valid_subscripted(char* name, int length)
+{
+	char* bracket = memchr(name, '[', length);
+
+	if(bracket == NULL)
+	{
+		return is_valid_name(name, length);
+	}
+
+	char* close = name + length - 1;
+
+	if(*close != ']' || close == bracket + 1)
+	{
+		return 0;
+	}
+
+	for(char* c = bracket + 1; c < close; c++)
+	{
+		if(!isdigit((unsigned char) *c))
+		{
+			return 0;
+		}
+	}
+
+	return is_valid_name(name, bracket - name);
+}
+
+/**
+ * Checks if a word has the form NAME=value
+ * @param word to check
+ * @return 1 if it is an assignment, 0 otherwise
+**/
+int is_assignment(char* word)
+{
+	char* equals = strchr(word, '=');
+
+	return equals != NULL && is_valid_name(word, equals - word);
+}
+
+/**
+ * Appends a string to a growing buffer
+**/
+static void append(char** buf, int* len, int* capacity, char* str, int str_len)
+{
+	if(*len + str_len + 1 > *capacity)
+	{
+		while(*len + str_len + 1 > *capacity)
+		{
+			*capacity *= 2;
+		}
+
+		*buf = realloc(*buf, *capacity);
+
+		if(*buf == NULL)
+		{
+			perror("Could not grow expansion buffer");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	memcpy(*buf + *len, str, str_len);
+	*len += str_len;
+	(*buf)[*len] = '\0';
+}
+
+/**
+ * @param word to check
+ * @return 1 if the word has a $ to expand or a quoted $ to restore
+**/
+int has_expansion(char* word)
+{
+	const char special[] = {'$', LITERAL_DOLLAR, '\0'};
+
+	return strpbrk(word, special) != NULL;
+}
+
+/**
+ * Appends $@ or $*, the positional parameters joined by spaces
+**/
+static void append_positional(var_table_t* var_table, char** buf, int* len, int* capacity)
+{
+	for(int i = 0; i < var_table->positional_count; i++)
+	{
+		if(i > 0)
+		{
+			append(buf, len, capacity, " ", 1);
+		}
+		append(buf, len, capacity, var_table->positional[i], strlen(var_table->positional[i]));
+	}
+}
+
+/**
+ * Replaces $NAME, ${NAME}, $? and the positional parameters
+ * $1 ... ${10} ..., $# and $@ in a word with their values,
+ * unset variables expand to an empty string and a quoted $ is
+ * restored as a plain $
+ * @param word to expand
+ * @param last_status exit status used for $?
+ * @return a newly allocated expanded word
+**/
+char* expand_word(var_table_t* var_table, char* word, int last_status)
+{
+	int capacity = strlen(word) + 16;
+	int len = 0;
+
+	char* expanded = malloc(capacity);
+
+	if(expanded == NULL)
+	{
+		perror("Could not allocate memory for expansion");
+		exit(EXIT_FAILURE);
+	}
+
+	expanded[0] = '\0';
+
+	const char special[] = {'$', LITERAL_DOLLAR, '\0'};
+	char* pos = word;
+
+	while(*pos)
+	{
+		char* dollar = strpbrk(pos, special);
+
+		if(dollar == NULL)
+		{
+			append(&expanded, &len, &capacity, pos, strlen(pos));
+			break;
+		}
+
+		append(&expanded, &len, &capacity, pos, dollar - pos);
+
+		if(*dollar == LITERAL_DOLLAR)
+		{
+			append(&expanded, &len, &capacity, "$", 1);
+			pos = dollar + 1;
+			continue;
+		}
+
+		char* name = dollar + 1;
+		char* end = name;
+		int braced = 0;
+
+		if(*name == '?')
+		{
+			char status[16];
+			snprintf(status, sizeof(status), "%d", last_status);
+			append(&expanded, &len, &capacity, status, strlen(status));
+			pos = name + 1;
+			continue;
+		}
+
+		if(*name == '#' || *name == '@' || *name == '*')
+		{
+			if(*name == '#')
+			{
+				char count[16];
+				snprintf(count, sizeof(count), "%d", var_table->positional_count);
+				append(&expanded, &len, &capacity, count, strlen(count));
+			}
+			else
+			{
+				append_positional(var_table, &expanded, &len, &capacity);
+			}
+			pos = name + 1;
+			continue;
+		}
+
+		if(*name == '{')
+		{
+			braced = 1;
+			name++;
+			end = strchr(name, '}');
+		}
+		else
+		{
+			while(isalnum((unsigned char) *end) || *end == '_')
+			{
+				end++;
+			}
+		}
+
+		//$1 is one digit, more need braces as in ${10}
+		if(isdigit((unsigned char) *name) && !braced)
+		{
+			end = name + 1;
+		}
+
+		if(end != NULL && isdigit((unsigned char) *name))
+		{
+			int index = atoi(name);
+
+			if(index >= 1 && index <= var_table->positional_count)
+			{
+				char* value = var_table->positional[index - 1];
+				append(&expanded, &len, &capacity, value, strlen(value));
+			}
+
+			pos = braced ? end + 1 : end;
+			continue;
+		}
+
+		//a lone $ or an unterminated ${ is kept as it is
+		if(end == NULL || !(braced ? is_valid_subscripted(name, end - name) : is_valid_name(name, end - name)))
+		{
+			append(&expanded, &len, &capacity, "$", 1);
+			pos = dollar + 1;
+			continue;
+		}
+
+		char saved = *end;
+		*end = '\0';
+		char* value = get_var(var_table, name);
+		*end = saved;
+
+		if(value != NULL)
+		{
+			append(&expanded, &len, &capacity, value, strlen(value));
+		}
+
+		pos = braced ? end + 1 : end;
+	}
+
+	return expanded;
+}
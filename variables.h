@@ -0,0 +1,46 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#define MAX_SHELL_VARS 256
+
+//the lexer writes this in place of a quoted or escaped $,
+//expansion turns it back into a plain $
+#define LITERAL_DOLLAR '\001'
+
+typedef struct shell_var_t
+{
+	char* name;
+	char* value;
+
+}shell_var_t;
+
+typedef struct var_table_t
+{
+	shell_var_t vars[MAX_SHELL_VARS];
+	int size;
+
+	//$1, $2 ... of the function being run, borrowed from its caller
+	char** positional;
+	int positional_count;
+
+}var_table_t;
+
+void init_var_table(var_table_t* var_table);
+
+void set_var(var_table_t* var_table, char* name, char* value);
+
+char* get_var(var_table_t* var_table, char* name);
+
+void free_var_table(var_table_t* var_table);
+
+int is_valid_name(char* name, int length);
+
+int is_valid_subscripted(char* name, int length);
+
+int is_assignment(char* word);
+
+int has_expansion(char* word);
+
+char* expand_word(var_table_t* var_table, char* word, int last_status);
+
+#endif